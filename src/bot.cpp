@@ -0,0 +1,370 @@
+/*
+Minetest-c55
+Copyright (C) 2010-2011 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "bot.h"
+#include "clientserver.h"
+#include "constants.h"
+#include "player.h"
+#include "debug.h"
+#include <sstream>
+
+// Radius of the circle walked around the spawn position
+#define BOT_WALK_RADIUS (BS*10)
+// Walking speed, about the same as a player's
+#define BOT_WALK_SPEED (BS*4)
+// Seconds between digging and placing
+#define BOT_ACTION_INTERVAL 5.0
+// Seconds between chat messages
+#define BOT_CHAT_INTERVAL 30.0
+
+Bot::Bot(const std::string &name, const std::string &password):
+	m_name(name),
+	m_password(password),
+	m_con(PROTOCOL_ID, 512, CONNECTION_TIMEOUT, this),
+	m_receive_buffer(200000),
+	m_ser_version(SER_FMT_VER_INVALID),
+	m_disconnected(false),
+	m_time(0),
+	m_init_timer(0),
+	m_rtt_timer(0),
+	m_position_received(false),
+	m_center(0,0,0),
+	m_position(0,0,0),
+	m_speed(0,0,0),
+	m_angle(myrand_range(0, 359) * core::DEGTORAD),
+	m_playerpos_timer(0),
+	// Spread the actions of different bots over time
+	m_action_timer(myrand_range(0, BOT_ACTION_INTERVAL * 100) / 100.0),
+	m_chat_timer(myrand_range(0, BOT_CHAT_INTERVAL * 100) / 100.0),
+	m_chat_count(0)
+{
+}
+
+Bot::~Bot()
+{
+	m_con.Disconnect();
+}
+
+void Bot::connect(Address address)
+{
+	DSTACK(__FUNCTION_NAME);
+	m_con.setTimeoutMs(0);
+	m_con.Connect(address);
+}
+
+void Bot::step(float dtime)
+{
+	DSTACK(__FUNCTION_NAME);
+
+	if(m_disconnected)
+		return;
+
+	m_time += dtime;
+
+	receiveAll();
+	if(m_disconnected)
+		return;
+
+	m_con.RunTimeouts(dtime);
+	if(m_disconnected)
+		return;
+
+	/*
+		Sample round trip time
+	*/
+	m_rtt_timer -= dtime;
+	if(m_rtt_timer <= 0.0)
+	{
+		m_rtt_timer = 1.0;
+		con::Peer *peer = m_con.GetPeerNoEx(PEER_ID_SERVER);
+		if(peer != NULL && peer->avg_rtt > 0)
+		{
+			m_stats.rtt_sum += peer->avg_rtt;
+			m_stats.rtt_count++;
+			if(peer->avg_rtt > m_stats.rtt_max)
+				m_stats.rtt_max = peer->avg_rtt;
+		}
+	}
+
+	if(isInitialized() == false)
+	{
+		// Send TOSERVER_INIT until the server answers
+		m_init_timer -= dtime;
+		if(m_init_timer <= 0.0 && m_con.Connected())
+		{
+			m_init_timer = 2.0;
+			sendInit();
+		}
+		return;
+	}
+
+	act(dtime);
+}
+
+void Bot::peerAdded(con::Peer *peer)
+{
+}
+
+void Bot::deletingPeer(con::Peer *peer, bool timeout)
+{
+	dstream<<"Bot "<<m_name<<": Disconnected from server"
+			<<(timeout ? " (timeout)" : "")<<std::endl;
+	m_disconnected = true;
+}
+
+void Bot::receiveAll()
+{
+	DSTACK(__FUNCTION_NAME);
+	for(;;)
+	{
+		try{
+			u16 sender_peer_id;
+			u32 datasize = m_con.Receive(sender_peer_id,
+					*m_receive_buffer, m_receive_buffer.getSize());
+			if(sender_peer_id != PEER_ID_SERVER)
+				continue;
+			processData(*m_receive_buffer, datasize);
+		}
+		catch(con::NoIncomingDataException &e)
+		{
+			break;
+		}
+		catch(con::InvalidIncomingDataException &e)
+		{
+			dstream<<"Bot "<<m_name<<": InvalidIncomingDataException: "
+					<<"what()="<<e.what()<<std::endl;
+		}
+		catch(con::PeerNotFoundException &e)
+		{
+			m_disconnected = true;
+			break;
+		}
+	}
+}
+
+void Bot::processData(u8 *data, u32 datasize)
+{
+	DSTACK(__FUNCTION_NAME);
+
+	m_stats.bytes_received += datasize;
+
+	if(datasize < 2)
+		return;
+
+	ToClientCommand command = (ToClientCommand)readU16(&data[0]);
+
+	if(command == TOCLIENT_INIT)
+	{
+		if(datasize < 3)
+			return;
+
+		u8 deployed = data[2];
+		if(ser_ver_supported(deployed) == false)
+		{
+			dstream<<"Bot "<<m_name<<": Server sent unsupported "
+					<<"ser_fmt_ver"<<std::endl;
+			return;
+		}
+
+		if(isInitialized() == false)
+			m_stats.init_time = m_time;
+		m_ser_version = deployed;
+
+		// Reply to server
+		SharedBuffer<u8> reply(2);
+		writeU16(&reply[0], TOSERVER_INIT2);
+		send(1, reply, true);
+	}
+	else if(command == TOCLIENT_ACCESS_DENIED)
+	{
+		dstream<<"Bot "<<m_name<<": Access denied"<<std::endl;
+		m_disconnected = true;
+	}
+	else if(command == TOCLIENT_BLOCKDATA)
+	{
+		if(datasize < 8)
+			return;
+		m_stats.blocks_received++;
+		sendGotBlock(readV3S16(&data[2]));
+	}
+	else if(command == TOCLIENT_BLOCKDIFF)
+	{
+		if(datasize < 10)
+			return;
+		m_stats.blockdiffs_received++;
+		sendGotBlock(readV3S16(&data[2]));
+	}
+	else if(command == TOCLIENT_MOVE_PLAYER)
+	{
+		if(datasize < 2+12)
+			return;
+		m_position = readV3F1000(&data[2]);
+		if(m_position_received == false)
+		{
+			m_position_received = true;
+			m_center = m_position - v3f(
+					cos(m_angle) * BOT_WALK_RADIUS, 0,
+					sin(m_angle) * BOT_WALK_RADIUS);
+		}
+		else
+		{
+			// Keep walking around the same center at the new height
+			m_center.Y = m_position.Y;
+		}
+	}
+	// Everything else is ignored
+}
+
+void Bot::send(u16 channelnum, SharedBuffer<u8> data, bool reliable)
+{
+	m_stats.bytes_sent += data.getSize();
+	m_con.Send(PEER_ID_SERVER, channelnum, data, reliable);
+}
+
+void Bot::sendInit()
+{
+	// See TOSERVER_INIT in clientserver.h
+	SharedBuffer<u8> data(2+1+PLAYERNAME_SIZE+PASSWORD_SIZE+2);
+	writeU16(&data[0], TOSERVER_INIT);
+	writeU8(&data[2], SER_FMT_VER_HIGHEST);
+
+	memset((char*)&data[3], 0, PLAYERNAME_SIZE);
+	snprintf((char*)&data[3], PLAYERNAME_SIZE, "%s", m_name.c_str());
+
+	memset((char*)&data[23], 0, PASSWORD_SIZE);
+	snprintf((char*)&data[23], PASSWORD_SIZE, "%s", m_password.c_str());
+
+	// The same network protocol version as the real client
+	writeU16(&data[51], 4);
+
+	// Send as unreliable
+	send(0, data, false);
+}
+
+void Bot::sendPlayerPos()
+{
+	// See TOSERVER_PLAYERPOS in clientserver.h
+	v3s32 position(m_position.X*100, m_position.Y*100, m_position.Z*100);
+	v3s32 speed(m_speed.X*100, m_speed.Y*100, m_speed.Z*100);
+	s32 pitch = 0;
+	s32 yaw = (m_angle * core::RADTODEG + 180) * 100;
+
+	SharedBuffer<u8> data(2+12+12+4+4);
+	writeU16(&data[0], TOSERVER_PLAYERPOS);
+	writeV3S32(&data[2], position);
+	writeV3S32(&data[2+12], speed);
+	writeS32(&data[2+12+12], pitch);
+	writeS32(&data[2+12+12+4], yaw);
+
+	// Send as unreliable
+	send(0, data, false);
+}
+
+void Bot::sendGroundAction(u8 action, v3s16 nodepos_undersurface,
+		v3s16 nodepos_oversurface)
+{
+	// See TOSERVER_GROUND_ACTION in clientserver.h
+	SharedBuffer<u8> data(2+1+6+6+2);
+	writeU16(&data[0], TOSERVER_GROUND_ACTION);
+	writeU8(&data[2], action);
+	writeV3S16(&data[3], nodepos_undersurface);
+	writeV3S16(&data[9], nodepos_oversurface);
+	// Always the first item
+	writeU16(&data[15], 0);
+	send(0, data, true);
+}
+
+void Bot::sendChatMessage(const std::wstring &message)
+{
+	// See TOSERVER_CHAT_MESSAGE in clientserver.h
+	SharedBuffer<u8> data(2+2+message.size()*2);
+	writeU16(&data[0], TOSERVER_CHAT_MESSAGE);
+	writeU16(&data[2], message.size());
+	for(u32 i=0; i<message.size(); i++)
+		writeU16(&data[4+i*2], message[i]);
+	send(0, data, true);
+}
+
+void Bot::sendGotBlock(v3s16 blockpos)
+{
+	// See TOSERVER_GOTBLOCKS in clientserver.h
+	SharedBuffer<u8> data(2+1+6);
+	writeU16(&data[0], TOSERVER_GOTBLOCKS);
+	data[2] = 1;
+	writeV3S16(&data[3], blockpos);
+	send(1, data, true);
+}
+
+void Bot::act(float dtime)
+{
+	// Wait until the server tells where we are
+	if(m_position_received == false)
+		return;
+
+	/*
+		Walk around the circle
+	*/
+	m_angle += dtime * BOT_WALK_SPEED / BOT_WALK_RADIUS;
+	if(m_angle > 2*core::PI)
+		m_angle -= 2*core::PI;
+	v3f new_position = m_center + v3f(
+			cos(m_angle) * BOT_WALK_RADIUS, 0,
+			sin(m_angle) * BOT_WALK_RADIUS);
+	if(dtime > 0.001)
+		m_speed = (new_position - m_position) / dtime;
+	m_position = new_position;
+
+	m_playerpos_timer -= dtime;
+	if(m_playerpos_timer <= 0.0)
+	{
+		// The same interval as the real client
+		m_playerpos_timer = 0.2;
+		sendPlayerPos();
+	}
+
+	/*
+		Dig the node under the bot and place it back the next time
+	*/
+	m_action_timer -= dtime;
+	if(m_action_timer <= 0.0)
+	{
+		m_action_timer = BOT_ACTION_INTERVAL;
+
+		v3s16 p = floatToInt(m_position, BS) + v3s16(0,-1,0);
+		// Digging start, digging completed, then placing
+		sendGroundAction(0, p, p + v3s16(0,1,0));
+		sendGroundAction(3, p, p + v3s16(0,1,0));
+		sendGroundAction(1, p + v3s16(0,-1,0), p);
+	}
+
+	/*
+		Chat
+	*/
+	m_chat_timer -= dtime;
+	if(m_chat_timer <= 0.0)
+	{
+		m_chat_timer = BOT_CHAT_INTERVAL;
+
+		std::wostringstream os(std::ios_base::binary);
+		os<<L"Load test message "<<m_chat_count;
+		sendChatMessage(os.str());
+		m_chat_count++;
+	}
+}
+
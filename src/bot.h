@@ -0,0 +1,149 @@
+/*
+Minetest-c55
+Copyright (C) 2010-2011 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef BOT_HEADER
+#define BOT_HEADER
+
+#include "connection.h"
+#include "common_irrlicht.h"
+#include "utility.h"
+#include "serialization.h"
+#include <string>
+
+/*
+	Headless clients for load testing a server.
+
+	A Bot speaks the network protocol directly and has no map or
+	graphics. It walks in a circle around the place where the server
+	puts it, digs and places nodes under itself, chats now and then and
+	acknowledges every block it receives without deserializing it.
+*/
+
+struct BotStats
+{
+	// Seconds from connecting to TOCLIENT_INIT, -1 if not yet
+	float init_time;
+	// Round trip times of the connection, sampled once a second
+	float rtt_sum;
+	float rtt_max;
+	u32 rtt_count;
+	// Counts of TOCLIENT_BLOCKDATA and TOCLIENT_BLOCKDIFF
+	u32 blocks_received;
+	u32 blockdiffs_received;
+	// Bytes of packet data, not counting connection headers
+	u32 bytes_received;
+	u32 bytes_sent;
+
+	BotStats():
+		init_time(-1),
+		rtt_sum(0),
+		rtt_max(0),
+		rtt_count(0),
+		blocks_received(0),
+		blockdiffs_received(0),
+		bytes_received(0),
+		bytes_sent(0)
+	{
+	}
+
+	float getAvgRtt()
+	{
+		if(rtt_count == 0)
+			return 0;
+		return rtt_sum / rtt_count;
+	}
+};
+
+class Bot : public con::PeerHandler
+{
+public:
+	Bot(const std::string &name, const std::string &password);
+	~Bot();
+
+	void connect(Address address);
+	// Receives and handles everything, then acts
+	void step(float dtime);
+
+	bool isInitialized()
+	{
+		return m_ser_version != SER_FMT_VER_INVALID;
+	}
+	// True if the server refused or dropped the connection
+	bool isDisconnected()
+	{
+		return m_disconnected;
+	}
+	const std::string & getName()
+	{
+		return m_name;
+	}
+	BotStats & getStats()
+	{
+		return m_stats;
+	}
+
+private:
+	// Virtual methods from con::PeerHandler
+	void peerAdded(con::Peer *peer);
+	void deletingPeer(con::Peer *peer, bool timeout);
+
+	void receiveAll();
+	void processData(u8 *data, u32 datasize);
+	void send(u16 channelnum, SharedBuffer<u8> data, bool reliable);
+
+	void sendInit();
+	void sendPlayerPos();
+	void sendGroundAction(u8 action, v3s16 nodepos_undersurface,
+			v3s16 nodepos_oversurface);
+	void sendChatMessage(const std::wstring &message);
+	void sendGotBlock(v3s16 blockpos);
+
+	// Moves along the path and digs, places and chats now and then
+	void act(float dtime);
+
+	std::string m_name;
+	std::string m_password;
+	con::Connection m_con;
+	Buffer<u8> m_receive_buffer;
+
+	u8 m_ser_version;
+	bool m_disconnected;
+	float m_time;
+	float m_init_timer;
+	float m_rtt_timer;
+
+	/*
+		Walking in a circle around m_center, starting from a random
+		place on it
+	*/
+	bool m_position_received;
+	v3f m_center;
+	v3f m_position;
+	v3f m_speed;
+	float m_angle;
+	float m_playerpos_timer;
+	float m_action_timer;
+	float m_chat_timer;
+	u32 m_chat_count;
+
+	BotStats m_stats;
+};
+
+#endif
+
@@ -0,0 +1,360 @@
+/*
+Minetest-c55
+Copyright (C) 2010-2011 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+	Connects a number of headless bots to a server and reports how the
+	server keeps up with them. Used for load testing servers.
+*/
+
+#ifndef SERVER
+	#ifdef _WIN32
+		#pragma error ("For a bot build, SERVER must be defined globally")
+	#else
+		#error "For a bot build, SERVER must be defined globally"
+	#endif
+#endif
+
+#ifdef _MSC_VER
+#pragma comment(lib, "jthread.lib")
+#pragma comment(lib, "zlibwapi.lib")
+#endif
+
+#include <iostream>
+#include <sstream>
+#include <time.h>
+#include <locale.h>
+#include "common_irrlicht.h"
+#include "debug.h"
+#include "main.h"
+#include "porting.h"
+#include "filesys.h"
+#include "bot.h"
+
+/*
+	Settings.
+	These are loaded from the config file.
+*/
+
+Settings g_settings;
+
+extern void set_default_settings();
+
+// Global profiler
+Profiler g_profiler;
+
+// A dummy thing
+ITextureSource *g_texturesource = NULL;
+
+/*
+	Debug streams
+*/
+
+// Connection
+std::ostream *dout_con_ptr = &dummyout;
+std::ostream *derr_con_ptr = &dstream_no_stderr;
+
+// Server
+std::ostream *dout_server_ptr = &dstream;
+std::ostream *derr_server_ptr = &dstream;
+
+// Client
+std::ostream *dout_client_ptr = &dstream;
+std::ostream *derr_client_ptr = &dstream;
+
+/*
+	gettime.h implementation
+*/
+
+u32 getTimeMs()
+{
+	/*
+		Use imprecise system calls directly (from porting.h)
+	*/
+	return porting::getTimeMs();
+}
+
+static void print_stats(core::array<Bot*> &bots, float time)
+{
+	if(bots.size() == 0)
+		return;
+	u32 connected_count = 0;
+	u32 blocks = 0;
+	u32 bytes_received = 0;
+	u32 bytes_sent = 0;
+	float rtt_sum = 0;
+	float rtt_max = 0;
+	for(u32 i=0; i<bots.size(); i++)
+	{
+		BotStats &stats = bots[i]->getStats();
+		if(bots[i]->isInitialized() && bots[i]->isDisconnected() == false)
+			connected_count++;
+		blocks += stats.blocks_received;
+		bytes_received += stats.bytes_received;
+		bytes_sent += stats.bytes_sent;
+		rtt_sum += stats.getAvgRtt();
+		if(stats.rtt_max > rtt_max)
+			rtt_max = stats.rtt_max;
+	}
+	if(time < 0.001)
+		time = 0.001;
+	dstream<<DTIME<<connected_count<<"/"<<bots.size()<<" bots connected, "
+			<<"avg rtt "<<(rtt_sum / bots.size() * 1000)<<"ms, "
+			<<"max rtt "<<(rtt_max * 1000)<<"ms, "
+			<<((float)blocks / time)<<" blocks/s, "
+			<<"in "<<((float)bytes_received / time / 1024)<<" KiB/s, "
+			<<"out "<<((float)bytes_sent / time / 1024)<<" KiB/s"
+			<<std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	/*
+		Initialization
+	*/
+
+	// Set locale. This is for forcing '.' as the decimal point.
+	std::locale::global(std::locale("C"));
+
+	/*
+		Low-level initialization
+	*/
+
+	bool disable_stderr = false;
+#ifdef _WIN32
+	disable_stderr = true;
+#endif
+
+	porting::signal_handler_init();
+	bool &kill = *porting::signal_handler_killstatus();
+
+	// Initialize porting::path_data and porting::path_userdata
+	porting::initializePaths();
+
+	// Create user data directory
+	fs::CreateDir(porting::path_userdata);
+
+	// Initialize debug streams
+#ifdef RUN_IN_PLACE
+	std::string debugfile = DEBUGFILE;
+#else
+	std::string debugfile = porting::path_userdata+"/"+DEBUGFILE;
+#endif
+	debugstreams_init(disable_stderr, debugfile.c_str());
+	// Initialize debug stacks
+	debug_stacks_init();
+
+	DSTACK(__FUNCTION_NAME);
+
+	// Debug handler
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	/*
+		Parse command line
+	*/
+
+	// List all allowed options
+	core::map<std::string, ValueSpec> allowed_options;
+	allowed_options.insert("help", ValueSpec(VALUETYPE_FLAG));
+	allowed_options.insert("address", ValueSpec(VALUETYPE_STRING,
+			"Address of the server (default: localhost)"));
+	allowed_options.insert("port", ValueSpec(VALUETYPE_STRING,
+			"Port of the server (default: 30000)"));
+	allowed_options.insert("bots", ValueSpec(VALUETYPE_STRING,
+			"Number of bots (default: 10)"));
+	allowed_options.insert("time", ValueSpec(VALUETYPE_STRING,
+			"Seconds to run, 0 = until interrupted (default: 60)"));
+	allowed_options.insert("name", ValueSpec(VALUETYPE_STRING,
+			"Start of the player names of the bots (default: bot)"));
+	allowed_options.insert("password", ValueSpec(VALUETYPE_STRING,
+			"Password of the bots"));
+	allowed_options.insert("connect-interval", ValueSpec(VALUETYPE_STRING,
+			"Seconds between connecting bots (default: 0.1)"));
+
+	Settings cmd_args;
+
+	bool ret = cmd_args.parseCommandLine(argc, argv, allowed_options);
+
+	if(ret == false || cmd_args.getFlag("help"))
+	{
+		dstream<<"Allowed options:"<<std::endl;
+		for(core::map<std::string, ValueSpec>::Iterator
+				i = allowed_options.getIterator();
+				i.atEnd() == false; i++)
+		{
+			dstream<<"  --"<<i.getNode()->getKey();
+			if(i.getNode()->getValue().type == VALUETYPE_FLAG)
+			{
+			}
+			else
+			{
+				dstream<<" <value>";
+			}
+			dstream<<std::endl;
+
+			if(i.getNode()->getValue().help != NULL)
+			{
+				dstream<<"      "<<i.getNode()->getValue().help
+						<<std::endl;
+			}
+		}
+
+		return cmd_args.getFlag("help") ? 0 : 1;
+	}
+
+	/*
+		Basic initialization
+	*/
+
+	// Initialize default settings
+	set_default_settings();
+
+	// Initialize sockets
+	sockets_init();
+	atexit(sockets_cleanup);
+
+	// Initialize random seed
+	srand(time(0));
+	mysrand(time(0));
+
+	/*
+		Check parameters
+	*/
+
+	u16 port = 30000;
+	if(cmd_args.exists("port") && cmd_args.getU16("port") != 0)
+		port = cmd_args.getU16("port");
+
+	Address address(0,0,0,0, port);
+	try{
+		if(cmd_args.exists("address"))
+			address.Resolve(cmd_args.get("address").c_str());
+		else
+			address.setAddress(127,0,0,1);
+	}
+	catch(ResolveError &e)
+	{
+		dstream<<"Couldn't resolve address"<<std::endl;
+		return 1;
+	}
+
+	u32 bot_count = 10;
+	if(cmd_args.exists("bots"))
+		bot_count = cmd_args.getU16("bots");
+
+	float run_time = 60;
+	if(cmd_args.exists("time"))
+		run_time = cmd_args.getFloat("time");
+
+	std::string name = "bot";
+	if(cmd_args.exists("name"))
+		name = cmd_args.get("name");
+
+	float connect_interval = 0.1;
+	if(cmd_args.exists("connect-interval"))
+		connect_interval = cmd_args.getFloat("connect-interval");
+
+	/*
+		Run bots
+	*/
+
+	dstream<<DTIME<<"Connecting "<<bot_count<<" bots to ";
+	address.print(&dstream);
+	dstream<<std::endl;
+
+	core::array<Bot*> bots;
+	float connect_timer = 0;
+	float print_timer = 0;
+	float time = 0;
+	u32 last_time_ms = porting::getTimeMs();
+
+	while(kill == false && (run_time <= 0 || time < run_time))
+	{
+		sleep_ms(10);
+
+		u32 time_ms = porting::getTimeMs();
+		float dtime = (float)(time_ms - last_time_ms) / 1000.0;
+		last_time_ms = time_ms;
+		time += dtime;
+
+		/*
+			Add bots one at a time, like players joining
+		*/
+		connect_timer -= dtime;
+		while(bots.size() < bot_count && connect_timer <= 0.0)
+		{
+			connect_timer += connect_interval;
+
+			std::ostringstream os;
+			os<<name<<bots.size();
+			std::string password;
+			if(cmd_args.exists("password"))
+				password = translatePassword(os.str(),
+						narrow_to_wide(cmd_args.get("password")));
+
+			Bot *bot = new Bot(os.str(), password);
+			bot->connect(address);
+			bots.push_back(bot);
+		}
+
+		for(u32 i=0; i<bots.size(); i++)
+			bots[i]->step(dtime);
+
+		print_timer -= dtime;
+		if(print_timer <= 0.0)
+		{
+			print_timer = 10.0;
+			print_stats(bots, time);
+		}
+	}
+
+	/*
+		Print results
+	*/
+
+	dstream<<std::endl;
+	dstream<<"Results after "<<time<<"s:"<<std::endl;
+	print_stats(bots, time);
+	dstream<<"name, init time (s), avg rtt (ms), max rtt (ms), blocks, "
+			<<"block diffs, KiB in, KiB out"<<std::endl;
+	for(u32 i=0; i<bots.size(); i++)
+	{
+		BotStats &stats = bots[i]->getStats();
+		dstream<<bots[i]->getName()<<", "
+				<<stats.init_time<<", "
+				<<(stats.getAvgRtt() * 1000)<<", "
+				<<(stats.rtt_max * 1000)<<", "
+				<<stats.blocks_received<<", "
+				<<stats.blockdiffs_received<<", "
+				<<(stats.bytes_received / 1024)<<", "
+				<<(stats.bytes_sent / 1024)
+				<<(bots[i]->isDisconnected() ? " (disconnected)" : "")
+				<<std::endl;
+	}
+
+	for(u32 i=0; i<bots.size(); i++)
+		delete bots[i];
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	debugstreams_deinit();
+
+	return 0;
+}
+
+//END
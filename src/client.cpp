@@ -156,9 +156,18 @@ void * MeshUpdateThread::Thread()
 		scene::SMesh *mesh_new = NULL;
 		mesh_new = makeMapBlockMesh(q->data);
 
+		// A block of air can be seen through from anywhere
+		u16 face_connectivity = FACE_CONNECTIVITY_ALL;
+		if(q->data->m_air_only == false)
+		{
+			face_connectivity = get_face_connectivity(
+					q->data->m_vmanip, q->data->m_blockpos);
+		}
+
 		MeshUpdateResult r;
 		r.p = q->p;
 		r.mesh = mesh_new;
+		r.face_connectivity = face_connectivity;
 		r.ack_block_to_server = q->ack_block_to_server;
 
 		/*dstream<<"MeshUpdateThread: Processed "
@@ -175,6 +184,57 @@ void * MeshUpdateThread::Thread()
 	return NULL;
 }
 
+/*
+	BlockDecodeThread
+*/
+
+void * BlockDecodeThread::Thread()
+{
+	ThreadStarted();
+
+	DSTACK(__FUNCTION_NAME);
+	
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	while(getRun())
+	{
+		if(m_queue_in.size() == 0)
+		{
+			sleep_ms(3);
+			continue;
+		}
+
+		QueuedBlockData q = m_queue_in.pop_front();
+
+		ScopeProfiler sp(&g_profiler, "block decode");
+
+		DecodedBlock r;
+		r.p = q.p;
+		r.block = new MapBlock(m_map, q.p);
+		try
+		{
+			r.block->deSerialize(q.data, q.datasize, q.ser_version,
+					m_decompressor);
+		}
+		catch(SerializationError &e)
+		{
+			dstream<<"WARNING: BlockDecodeThread: Invalid data for block ("
+					<<q.p.X<<","<<q.p.Y<<","<<q.p.Z<<"): "
+					<<e.what()<<std::endl;
+			delete r.block;
+			r.block = NULL;
+		}
+
+		delete[] q.data;
+
+		m_queue_out.push_back(r);
+	}
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	return NULL;
+}
+
 Client::Client(
 		IrrlichtDevice *device,
 		const char *playername,
@@ -188,11 +248,13 @@ Client::Client(
 		device->getSceneManager()
 	),
 	m_con(PROTOCOL_ID, 512, CONNECTION_TIMEOUT, this),
+	m_block_decode_thread(&m_env.getMap()),
 	m_device(device),
 	camera_position(0,0,0),
 	camera_direction(0,0,1),
 	m_server_ser_ver(SER_FMT_VER_INVALID),
 	m_inventory_updated(false),
+	m_inventory_requested(false),
 	m_time_of_day(0),
 	m_map_seed(0),
 	m_password(password),
@@ -209,6 +271,7 @@ Client::Client(
 	//m_con_mutex.Init();
 
 	m_mesh_update_thread.Start();
+	m_block_decode_thread.Start();
 
 	/*
 		Add local player
@@ -235,8 +298,23 @@ Client::~Client()
 	}
 
 	m_mesh_update_thread.setRun(false);
-	while(m_mesh_update_thread.IsRunning())
+	m_block_decode_thread.setRun(false);
+	while(m_mesh_update_thread.IsRunning()
+			|| m_block_decode_thread.IsRunning())
 		sleep_ms(100);
+
+	// Delete blocks that were never decoded or added to the map
+	while(m_block_decode_thread.m_queue_in.size() > 0)
+	{
+		QueuedBlockData q = m_block_decode_thread.m_queue_in.pop_front();
+		delete[] q.data;
+	}
+	while(m_block_decode_thread.m_queue_out.size() > 0)
+	{
+		DecodedBlock r = m_block_decode_thread.m_queue_out.pop_front();
+		if(r.block)
+			delete r.block;
+	}
 }
 
 void Client::connect(Address address)
@@ -280,6 +358,11 @@ void Client::step(float dtime)
 		// 0ms
 		ReceiveAll();
 	}
+
+	/*
+		Add received blocks that have been decoded
+	*/
+	addDecodedBlocks();
 	
 	{
 		//TimeTaker timer("m_con_mutex + m_con.RunTimeouts()", m_device);
@@ -431,7 +514,7 @@ void Client::step(float dtime)
 			snprintf((char*)&data[23], PASSWORD_SIZE, "%s", m_password.c_str());
 			
 			// This should be incremented in each version
-			writeU16(&data[51], 1);
+			writeU16(&data[51], 4);
 
 			// Send as unreliable
 			Send(0, data, false);
@@ -455,6 +538,8 @@ void Client::step(float dtime)
 		core::list<v3s16> deleted_blocks;
 		m_env.getMap().timerUpdate(map_timer_and_unload_dtime,
 				g_settings.getFloat("client_unload_unused_data_timeout"),
+				Map::blockCountForMemory(
+				g_settings.getU16("client_map_memory_limit")),
 				&deleted_blocks);
 				
 		/*if(deleted_blocks.size() > 0)
@@ -616,6 +701,7 @@ void Client::step(float dtime)
 			if(block)
 			{
 				block->replaceMesh(r.mesh);
+				block->setFaceConnectivity(r.face_connectivity);
 			}
 			if(r.ack_block_to_server)
 			{
@@ -849,6 +935,61 @@ void Client::ProcessData(u8 *data, u32 datasize, u16 sender_peer_id)
 		
 		addNode(p, n);
 	}
+	else if(command == TOCLIENT_NODECHANGES)
+	{
+		if(datasize < 4)
+			return;
+
+		u16 count = readU16(&data[2]);
+		u32 nodesize = MapNode::serializedLength(ser_version);
+
+		v3s16 p;
+		MapNode n;
+		u32 start = 4;
+		for(u16 i=0; i<count; i++)
+		{
+			if(datasize < start + 1)
+				return;
+			u8 flags = readU8(&data[start]);
+			start += 1;
+
+			if(flags & 0x02)
+			{
+				if(datasize < start + 3)
+					return;
+				p.X += (s8)data[start+0];
+				p.Y += (s8)data[start+1];
+				p.Z += (s8)data[start+2];
+				start += 3;
+			}
+			else
+			{
+				if(datasize < start + 6)
+					return;
+				p = readV3S16(&data[start]);
+				start += 6;
+			}
+
+			if(flags & 0x01)
+			{
+				// This will clear the cracking animation after digging
+				((ClientMap&)m_env.getMap()).clearTempMod(p);
+
+				removeNode(p);
+				continue;
+			}
+
+			if((flags & 0x04) == 0)
+			{
+				if(datasize < start + nodesize)
+					return;
+				n.deSerialize(&data[start], ser_version);
+				start += nodesize;
+			}
+
+			addNode(p, n);
+		}
+	}
 	else if(command == TOCLIENT_BLOCKDATA)
 	{
 		// Ignore too small packet
@@ -865,60 +1006,60 @@ void Client::ProcessData(u8 *data, u32 datasize, u16 sender_peer_id)
 		/*dstream<<DTIME<<"Client: Thread: BLOCKDATA for ("
 				<<p.X<<","<<p.Y<<","<<p.Z<<")"<<std::endl;*/
 		
-		std::string datastring((char*)&data[8], datasize-8);
-		std::istringstream istr(datastring, std::ios_base::binary);
-		
-		MapSector *sector;
-		MapBlock *block;
-		
-		v2s16 p2d(p.X, p.Z);
-		sector = m_env.getMap().emergeSector(p2d);
-		
-		assert(sector->getPos() == p2d);
-
-		//TimeTaker timer("MapBlock deSerialize");
-		// 0ms
-		
-		block = sector->getBlockNoCreateNoEx(p.Y);
-		if(block)
-		{
-			/*
-				Update an existing block
-			*/
-			//dstream<<"Updating"<<std::endl;
-			block->deSerialize(istr, ser_version);
-		}
+		/*
+			Decode the block in m_block_decode_thread.
+			It is added to the map in addDecodedBlocks().
+		*/
+		QueuedBlockData q;
+		q.p = p;
+		q.datasize = datasize-8;
+		q.data = new u8[q.datasize];
+		memcpy(q.data, &data[8], q.datasize);
+		q.ser_version = ser_version;
+		m_block_decode_thread.m_queue_in.push_back(q);
+
+		core::map<v3s16, u16>::Node *n = m_blocks_decoding.find(p);
+		if(n)
+			n->setValue(n->getValue() + 1);
 		else
+			m_blocks_decoding.insert(p, 1);
+	}
+	else if(command == TOCLIENT_BLOCKDIFF)
+	{
+		if(datasize < 10)
+			return;
+
+		v3s16 p = readV3S16(&data[2]);
+		u16 count = readU16(&data[8]);
+		u32 nodesize = MapNode::serializedLength(ser_version);
+
+		u32 start = 10;
+		for(u16 i=0; i<count; i++)
 		{
-			/*
-				Create a new block
-			*/
-			//dstream<<"Creating new"<<std::endl;
-			block = new MapBlock(&m_env.getMap(), p);
-			block->deSerialize(istr, ser_version);
-			sector->insertBlock(block);
-
-			//DEBUG
-			/*NodeMod mod;
-			mod.type = NODEMOD_CHANGECONTENT;
-			mod.param = CONTENT_MESE;
-			block->setTempMod(v3s16(8,10,8), mod);
-			block->setTempMod(v3s16(8,9,8), mod);
-			block->setTempMod(v3s16(8,8,8), mod);
-			block->setTempMod(v3s16(8,7,8), mod);
-			block->setTempMod(v3s16(8,6,8), mod);*/
+			if(datasize < start + 7)
+				return;
+			u8 type = readU8(&data[start]);
+			v3s16 nodepos = readV3S16(&data[start+1]);
+			start += 7;
+			if(type == 0)
+			{
+				if(datasize < start + nodesize)
+					return;
+				MapNode n;
+				n.deSerialize(&data[start], ser_version);
+				start += nodesize;
+				addNode(nodepos, n);
+			}
+			else
+			{
+				removeNode(nodepos);
+			}
 		}
 
-#if 0
 		/*
-			Acknowledge block
-		*/
-		/*
-			[0] u16 command
-			[2] u8 count
-			[3] v3s16 pos_0
-			[3+6] v3s16 pos_1
-			...
+			Acknowledge block.
+			Meshes are updated by addNode() and removeNode(), so there
+			is nothing to wait for.
 		*/
 		u32 replysize = 2+1+6;
 		SharedBuffer<u8> reply(replysize);
@@ -927,20 +1068,6 @@ void Client::ProcessData(u8 *data, u32 datasize, u16 sender_peer_id)
 		writeV3S16(&reply[3], p);
 		// Send as reliable
 		m_con.Send(PEER_ID_SERVER, 1, reply, true);
-#endif
-
-		/*
-			Update Mesh of this block and blocks at x-, y- and z-.
-			Environment should not be locked as it interlocks with the
-			main thread, from which is will want to retrieve textures.
-		*/
-
-		//m_env.getClientMap().updateMeshes(block->getPos(), getDayNightRatio());
-		/*
-			Add it to mesh update queue and set it to be acknowledged after update.
-		*/
-		//std::cerr<<"Adding mesh update task for received block"<<std::endl;
-		addUpdateMeshTaskWithEdge(p, true);
 	}
 	else if(command == TOCLIENT_PLAYERPOS)
 	{
@@ -1183,12 +1310,104 @@ void Client::ProcessData(u8 *data, u32 datasize, u16 sender_peer_id)
 			player->inventory.deSerialize(is);
 			//t1.stop();
 
+			m_inventory_list_versions.clear();
 			m_inventory_updated = true;
 
 			//dstream<<"Client got player inventory:"<<std::endl;
 			//player->inventory.print(dstream);
 		}
 	}
+	else if(command == TOCLIENT_INVENTORY_DIFF)
+	{
+		if(datasize < 4)
+			return;
+
+		std::string datastring((char*)&data[2], datasize-2);
+		std::istringstream is(datastring, std::ios_base::binary);
+
+		Player *player = m_env.getLocalPlayer();
+		assert(player != NULL);
+
+		u8 buf[12];
+		is.read((char*)buf, 2);
+		u16 list_count = readU16(buf);
+
+		bool mismatch = false;
+
+		for(u16 i=0; i<list_count; i++)
+		{
+			std::string name = deSerializeString(is);
+			is.read((char*)buf, 12);
+			if(is.gcount() != 12)
+				throw SerializationError("TOCLIENT_INVENTORY_DIFF: "
+						"unexpected end of data");
+			u32 base_version = readU32(&buf[0]);
+			u32 version = readU32(&buf[4]);
+			u16 size = readU16(&buf[8]);
+			u16 slot_count = readU16(&buf[10]);
+
+			InventoryList *list = NULL;
+			if(base_version == 0)
+			{
+				list = player->inventory.addList(name, size);
+				list->clearItems();
+			}
+			else
+			{
+				core::map<std::string, u32>::Node *n =
+						m_inventory_list_versions.find(name);
+				list = player->inventory.getList(name);
+				if(n == NULL || n->getValue() != base_version
+						|| list == NULL || list->getSize() != size)
+				{
+					// Not based on what we have; skip it
+					list = NULL;
+					mismatch = true;
+				}
+			}
+
+			for(u16 j=0; j<slot_count; j++)
+			{
+				is.read((char*)buf, 2);
+				u16 index = readU16(buf);
+				std::string itemstring = deSerializeString(is);
+				if(list == NULL || index >= list->getSize())
+					continue;
+				InventoryItem *item = NULL;
+				if(itemstring != "")
+				{
+					std::istringstream itemis(itemstring,
+							std::ios_base::binary);
+					item = InventoryItem::deSerialize(itemis);
+				}
+				delete list->changeItem(index, item);
+			}
+
+			if(list != NULL)
+			{
+				m_inventory_list_versions.remove(name);
+				m_inventory_list_versions.insert(name, version);
+			}
+		}
+
+		m_inventory_updated = true;
+
+		if(mismatch == false)
+		{
+			m_inventory_requested = false;
+		}
+		else if(m_inventory_requested == false)
+		{
+			dstream<<"Client: Inventory out of sync, requesting it"
+					<<std::endl;
+
+			SharedBuffer<u8> reply(2);
+			writeU16(&reply[0], TOSERVER_REQUEST_INVENTORY);
+			// Send as reliable
+			m_con.Send(PEER_ID_SERVER, 0, reply, true);
+			m_inventory_requested = true;
+		}
+	}
 	//DEBUG
 	else if(command == TOCLIENT_OBJECTDATA)
 	//else if(0)
@@ -1927,10 +2146,76 @@ void Client::sendPlayerItem(u16 item)
 	Send(0, data, true);
 }
 
+void Client::addDecodedBlocks()
+{
+	DSTACK(__FUNCTION_NAME);
+
+	while(m_block_decode_thread.m_queue_out.size() > 0)
+	{
+		DecodedBlock r = m_block_decode_thread.m_queue_out.pop_front();
+		v3s16 p = r.p;
+
+		core::map<v3s16, u16>::Node *n = m_blocks_decoding.find(p);
+		assert(n);
+		if(n->getValue() > 1)
+			n->setValue(n->getValue() - 1);
+		else
+			m_blocks_decoding.remove(p);
+
+		// Invalid data; the server will send the block again
+		if(r.block == NULL)
+			continue;
+
+		v2s16 p2d(p.X, p.Z);
+		MapSector *sector = m_env.getMap().emergeSector(p2d);
+		
+		assert(sector->getPos() == p2d);
+
+		MapBlock *block = sector->getBlockNoCreateNoEx(p.Y);
+		if(block)
+		{
+			/*
+				Update an existing block, keeping its mesh until the
+				new one is made
+			*/
+			block->takeContents(r.block);
+			delete r.block;
+		}
+		else
+		{
+			/*
+				Add the new block
+			*/
+			sector->insertBlock(r.block);
+		}
+
+		/*
+			Add it to mesh update queue and set it to be acknowledged
+			after update.
+		*/
+		addUpdateMeshTaskWithEdge(p, true);
+	}
+}
+
+void Client::waitForBlockDecode(v3s16 blockpos)
+{
+	while(m_blocks_decoding.find(blockpos) != NULL)
+	{
+		if(m_block_decode_thread.m_queue_out.size() == 0)
+		{
+			sleep_ms(1);
+			continue;
+		}
+		addDecodedBlocks();
+	}
+}
+
 void Client::removeNode(v3s16 p)
 {
 	//JMutexAutoLock envlock(m_env_mutex); //bulk comment-out
 	
+	waitForBlockDecode(getNodeBlockPos(p));
+
 	core::map<v3s16, MapBlock*> modified_blocks;
 
 	try
@@ -1958,6 +2243,8 @@ void Client::addNode(v3s16 p, MapNode n)
 
 	TimeTaker timer1("Client::addNode()");
 
+	waitForBlockDecode(getNodeBlockPos(p));
+
 	core::map<v3s16, MapBlock*> modified_blocks;
 
 	try
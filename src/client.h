@@ -29,6 +29,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <ostream>
 #include "clientobject.h"
 #include "utility.h" // For IntervalLimiter
+#include "mapblock_visibility.h" // For FACE_CONNECTIVITY_ALL
 
 struct MeshMakeData;
 
@@ -84,11 +85,13 @@ struct MeshUpdateResult
 {
 	v3s16 p;
 	scene::SMesh *mesh;
+	u16 face_connectivity;
 	bool ack_block_to_server;
 
 	MeshUpdateResult():
 		p(-1338,-1338,-1338),
 		mesh(NULL),
+		face_connectivity(FACE_CONNECTIVITY_ALL),
 		ack_block_to_server(false)
 	{
 	}
@@ -109,6 +112,51 @@ class MeshUpdateThread : public SimpleThread
 	MutexedQueue<MeshUpdateResult> m_queue_out;
 };
 
+struct QueuedBlockData
+{
+	v3s16 p;
+	/*
+		The block as in TOCLIENT_BLOCKDATA, without the header.
+		Allocated with new[] and deleted by the thread; SharedBuffer
+		can't be used because its reference count isn't thread-safe.
+	*/
+	u8 *data;
+	u32 datasize;
+	u8 ser_version;
+};
+
+struct DecodedBlock
+{
+	v3s16 p;
+	// NULL if the data was invalid
+	MapBlock *block;
+};
+
+/*
+	Deserializes received blocks into new MapBlocks, which are then
+	added to the map by the main thread.
+*/
+class BlockDecodeThread : public SimpleThread
+{
+public:
+
+	BlockDecodeThread(Map *map):
+		m_map(map)
+	{
+	}
+
+	void * Thread();
+
+	MutexedQueue<QueuedBlockData> m_queue_in;
+
+	MutexedQueue<DecodedBlock> m_queue_out;
+
+private:
+	// Only used as the parent of the new blocks
+	Map *m_map;
+	ZlibDecompressor m_decompressor;
+};
+
 enum ClientEventType
 {
 	CE_NONE,
@@ -321,6 +369,12 @@ class Client : public con::PeerHandler, public InventoryManager
 	// Send the item number 'item' as player item to the server
 	void sendPlayerItem(u16 item);
 	
+	// Adds the blocks decoded by m_block_decode_thread to the map
+	void addDecodedBlocks();
+	// Waits until the block is not being decoded anymore, so that
+	// changes to it are not overwritten by older data
+	void waitForBlockDecode(v3s16 blockpos);
+	
 	float m_packetcounter_timer;
 	float m_connection_reinit_timer;
 	float m_avg_rtt_timer;
@@ -334,6 +388,10 @@ class Client : public con::PeerHandler, public InventoryManager
 	
 	con::Connection m_con;
 
+	BlockDecodeThread m_block_decode_thread;
+	// Number of times each block is queued in m_block_decode_thread
+	core::map<v3s16, u16> m_blocks_decoding;
+
 	IrrlichtDevice *m_device;
 
 	v3f camera_position;
@@ -344,6 +402,10 @@ class Client : public con::PeerHandler, public InventoryManager
 
 	// This is behind m_env_mutex.
 	bool m_inventory_updated;
+	// Versions of the inventory lists received with TOCLIENT_INVENTORY_DIFF
+	core::map<std::string, u32> m_inventory_list_versions;
+	// TOSERVER_REQUEST_INVENTORY has been sent and not answered yet
+	bool m_inventory_requested;
 
 	core::map<v3s16, bool> m_active_blocks;
 
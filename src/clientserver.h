@@ -167,6 +167,74 @@ enum ToClientCommand
 		u16 peer id
 		string serialized item
 	*/
+
+	TOCLIENT_BLOCKDIFF = 0x37,
+	/*
+		Sent instead of TOCLIENT_BLOCKDATA when the client has an
+		older version of the block. The changes are applied in order
+		like TOCLIENT_ADDNODE and TOCLIENT_REMOVENODE, and the block
+		is acknowledged with TOSERVER_GOTBLOCKS.
+		Sent only to clients with network protocol version >= 2.
+
+		u16 command
+		v3s16 blockpos
+		u16 count of changes
+		for each change {
+			u8 type (0=add node, 1=remove node)
+			v3s16 node position
+			if type is 0:
+				serialized MapNode
+		}
+	*/
+
+	TOCLIENT_NODECHANGES = 0x38,
+	/*
+		Node changes collected during a server step, applied in order
+		like TOCLIENT_ADDNODE and TOCLIENT_REMOVENODE.
+		Sent only to clients with network protocol version >= 3.
+
+		u16 command
+		u16 count of changes
+		for each change {
+			u8 flags
+				0x01: remove node (otherwise add node)
+				0x02: position is relative to the previous change
+				0x04: node is the same as in the previous added node
+			if flags & 0x02:
+				s8[3] position difference
+			else:
+				v3s16 node position
+			if adding node and not flags & 0x04:
+				serialized MapNode
+		}
+	*/
+
+	TOCLIENT_INVENTORY_DIFF = 0x39,
+	/*
+		Sent instead of TOCLIENT_INVENTORY. Contains the slots of the
+		lists that have changed since they were last sent.
+		Each list has a version number that is increased every time it
+		is sent. If the client doesn't have base_version of a list, it
+		ignores the list and requests the whole inventory with
+		TOSERVER_REQUEST_INVENTORY.
+		Sent only to clients with network protocol version >= 4.
+
+		u16 command
+		u16 count of lists
+		for each list {
+			u16 length of name
+			string name
+			u32 base_version (0 = all slots are included)
+			u32 version
+			u16 list size
+			u16 count of slots
+			for each slot {
+				u16 index
+				u16 length of item string (0 = empty slot)
+				string item (as serialized by InventoryItem::serialize)
+			}
+		}
+	*/
 };
 
 enum ToServerCommand
@@ -180,6 +248,12 @@ enum ToServerCommand
 		[3] u8[20] player_name
 		[23] u8[28] password (new in some version)
 		[51] u16 client network protocol version (new in some version)
+
+		Network protocol versions:
+		1: Initial
+		2: TOCLIENT_BLOCKDIFF
+		3: TOCLIENT_NODECHANGES
+		4: TOCLIENT_INVENTORY_DIFF
 	*/
 
 	TOSERVER_INIT2 = 0x11,
@@ -316,6 +390,14 @@ enum ToServerCommand
 		[2] u16 item
 	*/
 
+	TOSERVER_REQUEST_INVENTORY=0x38,
+	/*
+		Sent when a TOCLIENT_INVENTORY_DIFF doesn't match the inventory
+		of the client. The server answers by sending all slots.
+
+		[0] u16 TOSERVER_REQUEST_INVENTORY
+	*/
+
 };
 
 inline SharedBuffer<u8> makePacket_TOCLIENT_TIME_OF_DAY(u16 time)
@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "collision.h"
 #include "mapblock.h"
 #include "map.h"
+#include "debug.h"
+#include "porting.h"
 
 collisionMoveResult collisionMoveSimple(Map *map, f32 pos_max_d,
 		const core::aabbox3d<f32> &box_0,
@@ -78,7 +80,8 @@ collisionMoveResult collisionMoveSimple(Map *map, f32 pos_max_d,
 	{
 		try{
 			// Object collides into walkable nodes
-			MapNode n = map->getNode(v3s16(x,y,z));
+			// This is called from many threads by CollisionMoveThreads
+			MapNode n = map->getNodeNoCache(v3s16(x,y,z));
 			if(content_features(n).walkable == false)
 				continue;
 		}
@@ -237,4 +240,165 @@ collisionMoveResult collisionMovePrecise(Map *map, f32 pos_max_d,
 	return final_result;
 }
 
+void collisionMove(Map *map, CollisionMove &move)
+{
+	if(move.precise)
+		move.result = collisionMovePrecise(map, move.pos_max_d,
+				move.box, move.dtime, move.pos, move.speed);
+	else
+		move.result = collisionMoveSimple(map, move.pos_max_d,
+				move.box, move.dtime, move.pos, move.speed);
+}
+
+/*
+	CollisionMoveThreads
+*/
+
+// Number of moves taken at a time by a thread
+#define COLLISION_MOVE_CHUNK 16
+// If there are less moves than this, threads are not used
+#define COLLISION_MOVE_THREADING_MIN 64
+
+class CollisionMoveThread : public SimpleThread
+{
+	CollisionMoveThreads *m_threads;
+
+public:
+
+	CollisionMoveThread(CollisionMoveThreads *threads):
+		SimpleThread(),
+		m_threads(threads)
+	{
+	}
+
+	void * Thread()
+	{
+		ThreadStarted();
+
+		DSTACK(__FUNCTION_NAME);
+
+		BEGIN_DEBUG_EXCEPTION_HANDLER
 
+		for(;;)
+		{
+			// Sleep until moveMany() has something to do
+			m_threads->waitForWork();
+			if(getRun() == false)
+				break;
+
+			while(m_threads->doMoves());
+
+			m_threads->workDone();
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return NULL;
+	}
+};
+
+CollisionMoveThreads::CollisionMoveThreads(u32 thread_count):
+	m_map(NULL),
+	m_moves(NULL),
+	m_next(0)
+{
+	m_mutex.Init();
+	m_work.Init();
+	m_done.Init();
+
+	// The calling thread does moves too
+	for(u32 i=1; i<thread_count; i++)
+	{
+		CollisionMoveThread *thread = new CollisionMoveThread(this);
+		thread->Start();
+		m_threads.push_back(thread);
+	}
+}
+
+CollisionMoveThreads::~CollisionMoveThreads()
+{
+	// Wake the threads up to notice that they should stop
+	for(u32 i=0; i<m_threads.size(); i++)
+		m_threads[i]->setRun(false);
+	for(u32 i=0; i<m_threads.size(); i++)
+		m_work.Post();
+	for(u32 i=0; i<m_threads.size(); i++)
+	{
+		m_threads[i]->stop();
+		delete m_threads[i];
+	}
+}
+
+void CollisionMoveThreads::moveMany(Map *map,
+		core::array<CollisionMove> &moves)
+{
+	if(m_threads.size() == 0 || moves.size() < COLLISION_MOVE_THREADING_MIN)
+	{
+		for(u32 i=0; i<moves.size(); i++)
+			collisionMove(map, moves[i]);
+		return;
+	}
+
+	{
+		JMutexAutoLock lock(m_mutex);
+		m_map = map;
+		m_moves = &moves;
+		m_next = 0;
+	}
+
+	/*
+		Every wakeup is followed by one workDone(), so after as many
+		workDone()s as there were wakeups no thread is doing moves
+		anymore
+	*/
+	for(u32 i=0; i<m_threads.size(); i++)
+		m_work.Post();
+
+	while(doMoves());
+
+	for(u32 i=0; i<m_threads.size(); i++)
+		m_done.Wait();
+
+	{
+		JMutexAutoLock lock(m_mutex);
+		m_map = NULL;
+		m_moves = NULL;
+	}
+}
+
+void CollisionMoveThreads::waitForWork()
+{
+	m_work.Wait();
+}
+
+void CollisionMoveThreads::workDone()
+{
+	m_done.Post();
+}
+
+bool CollisionMoveThreads::doMoves()
+{
+	Map *map;
+	CollisionMove *moves;
+	u32 first;
+	u32 last;
+	{
+		JMutexAutoLock lock(m_mutex);
+		if(m_moves == NULL || m_next >= m_moves->size())
+			return false;
+		map = m_map;
+		moves = m_moves->pointer();
+		first = m_next;
+		last = first + COLLISION_MOVE_CHUNK;
+		if(last > m_moves->size())
+			last = m_moves->size();
+		m_next = last;
+	}
+
+	// Every move only modifies itself, so the result doesn't depend
+	// on which thread does it
+	for(u32 i=first; i<last; i++)
+		collisionMove(map, moves[i]);
+
+	return true;
+}
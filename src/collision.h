@@ -21,6 +21,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define COLLISION_HEADER
 
 #include "common_irrlicht.h"
+#include "utility.h"
+#include <jsemaphore.h>
 
 class Map;
 
@@ -43,6 +45,69 @@ collisionMoveResult collisionMovePrecise(Map *map, f32 pos_max_d,
 		const core::aabbox3d<f32> &box_0,
 		f32 dtime, v3f &pos_f, v3f &speed_f);
 
+/*
+	A move of an object, which can be done later or in another thread.
+*/
+struct CollisionMove
+{
+	core::aabbox3d<f32> box;
+	f32 pos_max_d;
+	f32 dtime;
+	// Use collisionMovePrecise() instead of collisionMoveSimple()
+	bool precise;
+	// These are modified by the move
+	v3f pos;
+	v3f speed;
+	collisionMoveResult result;
+
+	CollisionMove():
+		pos_max_d(0),
+		dtime(0),
+		precise(false)
+	{}
+};
+
+void collisionMove(Map *map, CollisionMove &move);
+
+class CollisionMoveThread;
+
+/*
+	Does many moves at a time with thread_count threads, the calling
+	thread included. The map must not be modified while moveMany() is
+	running.
+*/
+class CollisionMoveThreads
+{
+public:
+	CollisionMoveThreads(u32 thread_count);
+	~CollisionMoveThreads();
+
+	void moveMany(Map *map, core::array<CollisionMove> &moves);
+
+	/*
+		Used by the threads
+	*/
+	// Does the next few moves; returns false if there were none left.
+	bool doMoves();
+	// Blocks until moveMany() wakes the thread up
+	void waitForWork();
+	// Tells moveMany() that the thread has done its moves
+	void workDone();
+
+private:
+	core::array<CollisionMoveThread*> m_threads;
+	// Posted once for each thread by moveMany()
+	JSemaphore m_work;
+	// Posted by each thread that was woken up, when it's done
+	JSemaphore m_done;
+	// Protects the following
+	JMutex m_mutex;
+	Map *m_map;
+	core::array<CollisionMove> *m_moves;
+	// Index of the first move not taken yet
+	u32 m_next;
+};
+
 enum CollisionType
 {
 	COLLISION_FALL
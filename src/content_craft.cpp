@@ -24,29 +24,43 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapnode.h" // For content_t
 
 /*
-	items: actually *items[9]
-	return value: allocates a new item, or returns NULL.
+	Recipes, by their item combination key (see
+	getItemSpecCombinationKey()). The values are the results that are
+	cloned when crafting.
 */
-InventoryItem *craft_get_result(InventoryItem **items)
+static core::map<std::string, InventoryItem*> g_craft_results;
+
+static void craft_register(const ItemSpec *specs, InventoryItem *result)
+{
+	std::string key = getItemSpecCombinationKey(specs);
+	assert(key != "");
+
+	// The first matching recipe used to win, so keep the first one
+	if(g_craft_results.find(key) != NULL)
+	{
+		dstream<<"WARNING: craft_register(): Duplicate recipe for "
+				<<result->getName()<<std::endl;
+		delete result;
+		return;
+	}
+
+	g_craft_results.insert(key, result);
+}
+
+void craft_init()
 {
 	// Wood
 	{
 		ItemSpec specs[9];
 		specs[0] = ItemSpec(ITEM_MATERIAL, CONTENT_TREE);
-		if(checkItemCombination(items, specs))
-		{
-			return new MaterialItem(CONTENT_WOOD, 4);
-		}
+		craft_register(specs, new MaterialItem(CONTENT_WOOD, 4));
 	}
 
 	// Stick
 	{
 		ItemSpec specs[9];
 		specs[0] = ItemSpec(ITEM_MATERIAL, CONTENT_WOOD);
-		if(checkItemCombination(items, specs))
-		{
-			return new CraftItem("Stick", 4);
-		}
+		craft_register(specs, new CraftItem("Stick", 4));
 	}
 
 	// Fence
@@ -58,10 +72,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[6] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[8] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new MaterialItem(CONTENT_FENCE, 2);
-		}
+		craft_register(specs, new MaterialItem(CONTENT_FENCE, 2));
 	}
 
 	// Sign
@@ -74,11 +85,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[4] = ItemSpec(ITEM_MATERIAL, CONTENT_WOOD);
 		specs[5] = ItemSpec(ITEM_MATERIAL, CONTENT_WOOD);
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			//return new MapBlockObjectItem("Sign");
-			return new MaterialItem(CONTENT_SIGN_WALL, 1);
-		}
+		craft_register(specs, new MaterialItem(CONTENT_SIGN_WALL, 1));
 	}
 
 	// Torch
@@ -86,10 +93,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		ItemSpec specs[9];
 		specs[0] = ItemSpec(ITEM_CRAFT, "lump_of_coal");
 		specs[3] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new MaterialItem(CONTENT_TORCH, 4);
-		}
+		craft_register(specs, new MaterialItem(CONTENT_TORCH, 4));
 	}
 
 	// Wooden pick
@@ -100,10 +104,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[2] = ItemSpec(ITEM_MATERIAL, CONTENT_WOOD);
 		specs[4] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new ToolItem("WPick", 0);
-		}
+		craft_register(specs, new ToolItem("WPick", 0));
 	}
 
 	// Stone pick
@@ -114,10 +115,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[2] = ItemSpec(ITEM_MATERIAL, CONTENT_COBBLE);
 		specs[4] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new ToolItem("STPick", 0);
-		}
+		craft_register(specs, new ToolItem("STPick", 0));
 	}
 
 	// Steel pick
@@ -128,10 +126,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[2] = ItemSpec(ITEM_CRAFT, "steel_ingot");
 		specs[4] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new ToolItem("SteelPick", 0);
-		}
+		craft_register(specs, new ToolItem("SteelPick", 0));
 	}
 
 	// Mese pick
@@ -142,10 +137,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[2] = ItemSpec(ITEM_MATERIAL, CONTENT_MESE);
 		specs[4] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new ToolItem("MesePick", 0);
-		}
+		craft_register(specs, new ToolItem("MesePick", 0));
 	}
 
 	// Wooden shovel
@@ -154,10 +146,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[1] = ItemSpec(ITEM_MATERIAL, CONTENT_WOOD);
 		specs[4] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new ToolItem("WShovel", 0);
-		}
+		craft_register(specs, new ToolItem("WShovel", 0));
 	}
 
 	// Stone shovel
@@ -166,10 +155,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[1] = ItemSpec(ITEM_MATERIAL, CONTENT_COBBLE);
 		specs[4] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new ToolItem("STShovel", 0);
-		}
+		craft_register(specs, new ToolItem("STShovel", 0));
 	}
 
 	// Steel shovel
@@ -178,10 +164,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[1] = ItemSpec(ITEM_CRAFT, "steel_ingot");
 		specs[4] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new ToolItem("SteelShovel", 0);
-		}
+		craft_register(specs, new ToolItem("SteelShovel", 0));
 	}
 
 	// Wooden axe
@@ -192,10 +175,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[3] = ItemSpec(ITEM_MATERIAL, CONTENT_WOOD);
 		specs[4] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new ToolItem("WAxe", 0);
-		}
+		craft_register(specs, new ToolItem("WAxe", 0));
 	}
 
 	// Stone axe
@@ -206,10 +186,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[3] = ItemSpec(ITEM_MATERIAL, CONTENT_COBBLE);
 		specs[4] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new ToolItem("STAxe", 0);
-		}
+		craft_register(specs, new ToolItem("STAxe", 0));
 	}
 
 	// Steel axe
@@ -220,10 +197,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[3] = ItemSpec(ITEM_CRAFT, "steel_ingot");
 		specs[4] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new ToolItem("SteelAxe", 0);
-		}
+		craft_register(specs, new ToolItem("SteelAxe", 0));
 	}
 
 	// Wooden sword
@@ -232,10 +206,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[1] = ItemSpec(ITEM_MATERIAL, CONTENT_WOOD);
 		specs[4] = ItemSpec(ITEM_MATERIAL, CONTENT_WOOD);
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new ToolItem("WSword", 0);
-		}
+		craft_register(specs, new ToolItem("WSword", 0));
 	}
 
 	// Stone sword
@@ -244,10 +215,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[1] = ItemSpec(ITEM_MATERIAL, CONTENT_COBBLE);
 		specs[4] = ItemSpec(ITEM_MATERIAL, CONTENT_COBBLE);
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new ToolItem("STSword", 0);
-		}
+		craft_register(specs, new ToolItem("STSword", 0));
 	}
 
 	// Steel sword
@@ -256,10 +224,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[1] = ItemSpec(ITEM_CRAFT, "steel_ingot");
 		specs[4] = ItemSpec(ITEM_CRAFT, "steel_ingot");
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new ToolItem("SteelSword", 0);
-		}
+		craft_register(specs, new ToolItem("SteelSword", 0));
 	}
 
 	// Rail
@@ -274,10 +239,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[6] = ItemSpec(ITEM_CRAFT, "steel_ingot");
 		specs[7] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[8] = ItemSpec(ITEM_CRAFT, "steel_ingot");
-		if(checkItemCombination(items, specs))
-		{
-			return new MaterialItem(CONTENT_RAIL, 15);
-		}
+		craft_register(specs, new MaterialItem(CONTENT_RAIL, 15));
 	}
 
 	// Chest
@@ -291,10 +253,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[6] = ItemSpec(ITEM_MATERIAL, CONTENT_WOOD);
 		specs[7] = ItemSpec(ITEM_MATERIAL, CONTENT_WOOD);
 		specs[8] = ItemSpec(ITEM_MATERIAL, CONTENT_WOOD);
-		if(checkItemCombination(items, specs))
-		{
-			return new MaterialItem(CONTENT_CHEST, 1);
-		}
+		craft_register(specs, new MaterialItem(CONTENT_CHEST, 1));
 	}
 
 	// Furnace
@@ -308,10 +267,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[6] = ItemSpec(ITEM_MATERIAL, CONTENT_COBBLE);
 		specs[7] = ItemSpec(ITEM_MATERIAL, CONTENT_COBBLE);
 		specs[8] = ItemSpec(ITEM_MATERIAL, CONTENT_COBBLE);
-		if(checkItemCombination(items, specs))
-		{
-			return new MaterialItem(CONTENT_FURNACE, 1);
-		}
+		craft_register(specs, new MaterialItem(CONTENT_FURNACE, 1));
 	}
 
 	// Steel block
@@ -326,10 +282,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[6] = ItemSpec(ITEM_CRAFT, "steel_ingot");
 		specs[7] = ItemSpec(ITEM_CRAFT, "steel_ingot");
 		specs[8] = ItemSpec(ITEM_CRAFT, "steel_ingot");
-		if(checkItemCombination(items, specs))
-		{
-			return new MaterialItem(CONTENT_STEEL, 1);
-		}
+		craft_register(specs, new MaterialItem(CONTENT_STEEL, 1));
 	}
 
 	// Sandstone
@@ -339,10 +292,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[4] = ItemSpec(ITEM_MATERIAL, CONTENT_SAND);
 		specs[6] = ItemSpec(ITEM_MATERIAL, CONTENT_SAND);
 		specs[7] = ItemSpec(ITEM_MATERIAL, CONTENT_SAND);
-		if(checkItemCombination(items, specs))
-		{
-			return new MaterialItem(CONTENT_SANDSTONE, 1);
-		}
+		craft_register(specs, new MaterialItem(CONTENT_SANDSTONE, 1));
 	}
 
 	// Clay
@@ -352,10 +302,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[4] = ItemSpec(ITEM_CRAFT, "lump_of_clay");
 		specs[6] = ItemSpec(ITEM_CRAFT, "lump_of_clay");
 		specs[7] = ItemSpec(ITEM_CRAFT, "lump_of_clay");
-		if(checkItemCombination(items, specs))
-		{
-			return new MaterialItem(CONTENT_CLAY, 1);
-		}
+		craft_register(specs, new MaterialItem(CONTENT_CLAY, 1));
 	}
 
 	// Brick
@@ -365,10 +312,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[4] = ItemSpec(ITEM_CRAFT, "clay_brick");
 		specs[6] = ItemSpec(ITEM_CRAFT, "clay_brick");
 		specs[7] = ItemSpec(ITEM_CRAFT, "clay_brick");
-		if(checkItemCombination(items, specs))
-		{
-			return new MaterialItem(CONTENT_BRICK, 1);
-		}
+		craft_register(specs, new MaterialItem(CONTENT_BRICK, 1));
 	}
 
 	// Paper
@@ -377,10 +321,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[3] = ItemSpec(ITEM_MATERIAL, CONTENT_PAPYRUS);
 		specs[4] = ItemSpec(ITEM_MATERIAL, CONTENT_PAPYRUS);
 		specs[5] = ItemSpec(ITEM_MATERIAL, CONTENT_PAPYRUS);
-		if(checkItemCombination(items, specs))
-		{
-			return new CraftItem("paper", 1);
-		}
+		craft_register(specs, new CraftItem("paper", 1));
 	}
 
 	// Book
@@ -389,10 +330,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[1] = ItemSpec(ITEM_CRAFT, "paper");
 		specs[4] = ItemSpec(ITEM_CRAFT, "paper");
 		specs[7] = ItemSpec(ITEM_CRAFT, "paper");
-		if(checkItemCombination(items, specs))
-		{
-			return new CraftItem("book", 1);
-		}
+		craft_register(specs, new CraftItem("book", 1));
 	}
 
 	// Book shelf
@@ -407,10 +345,7 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[6] = ItemSpec(ITEM_MATERIAL, CONTENT_WOOD);
 		specs[7] = ItemSpec(ITEM_MATERIAL, CONTENT_WOOD);
 		specs[8] = ItemSpec(ITEM_MATERIAL, CONTENT_WOOD);
-		if(checkItemCombination(items, specs))
-		{
-			return new MaterialItem(CONTENT_BOOKSHELF, 1);
-		}
+		craft_register(specs, new MaterialItem(CONTENT_BOOKSHELF, 1));
 	}
 
 	// Ladder
@@ -423,13 +358,26 @@ InventoryItem *craft_get_result(InventoryItem **items)
 		specs[5] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[6] = ItemSpec(ITEM_CRAFT, "Stick");
 		specs[8] = ItemSpec(ITEM_CRAFT, "Stick");
-		if(checkItemCombination(items, specs))
-		{
-			return new MaterialItem(CONTENT_LADDER, 1);
-		}
+		craft_register(specs, new MaterialItem(CONTENT_LADDER, 1));
 	}
+}
 
-	return NULL;
+/*
+	items: actually *items[9]
+	return value: allocates a new item, or returns NULL.
+*/
+InventoryItem *craft_get_result(InventoryItem **items)
+{
+	std::string key = getItemCombinationKey(items);
+	if(key == "")
+		return NULL;
+	
+	core::map<std::string, InventoryItem*>::Node *n
+			= g_craft_results.find(key);
+	if(n == NULL)
+		return NULL;
+	
+	return n->getValue()->clone();
 }
 
 void craft_set_creative_inventory(Player *player)
@@ -23,6 +23,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 class InventoryItem;
 class Player;
 
+/*
+	Registers the recipes. Call once at startup.
+*/
+void craft_init();
+
 /*
 	items: actually *items[9]
 	return value: allocates a new item, or returns NULL.
@@ -240,8 +240,33 @@ bool FurnaceNodeMetadata::step(float dtime)
 		if(m_fuel_time < m_fuel_totaltime)
 		{
 			//dstream<<"Furnace is active"<<std::endl;
-			m_fuel_time += dtime;
-			m_src_time += dtime;
+			/*
+				Take all the following steps in which only the counters
+				change at once, so that catching up a long dtime (eg. when
+				the block is activated) doesn't loop through every step.
+			*/
+			bool cooking = (m_src_totaltime > 0.001 && src_item);
+			u32 steps = 1;
+			if(m_step_accumulator > interval)
+				steps += ceil(m_step_accumulator / interval) - 1;
+			u32 fuel_steps = ceil((m_fuel_totaltime - m_fuel_time) / interval);
+			if(fuel_steps < steps)
+				steps = fuel_steps;
+			if(cooking)
+			{
+				u32 src_steps = 1;
+				if(m_src_totaltime - m_src_time > interval)
+					src_steps = ceil((m_src_totaltime - m_src_time) / interval);
+				if(src_steps < steps)
+					steps = src_steps;
+			}
+			m_step_accumulator -= (steps - 1) * interval;
+			m_fuel_time += steps * dtime;
+			// If not cooking, m_src_time was reset above on every step
+			if(cooking)
+				m_src_time += steps * dtime;
+			else
+				m_src_time += dtime;
 			if(m_src_time >= m_src_totaltime && m_src_totaltime > 0.001
 					&& src_item)
 			{
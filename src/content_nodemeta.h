@@ -76,6 +76,7 @@ class FurnaceNodeMetadata : public NodeMetadata
 	virtual Inventory* getInventory() {return m_inventory;}
 	virtual void inventoryModified();
 	virtual bool step(float dtime);
+	virtual bool needsStep() {return true;}
 	virtual std::string getInventoryDrawSpecString();
 
 private:
@@ -116,17 +116,16 @@ ServerActiveObject* ItemSAO::create(ServerEnvironment *env, u16 id, v3f pos,
 	return new ItemSAO(env, id, pos, inventorystring);
 }
 
-void ItemSAO::step(float dtime, bool send_recommended)
+bool ItemSAO::stepBeforeMove(float dtime, bool send_recommended,
+		CollisionMove &move)
 {
 	assert(m_env);
 
 	const float interval = 0.2;
 	if(m_move_interval.step(dtime, interval)==false)
-		return;
+		return false;
 	dtime = interval;
 	
-	core::aabbox3d<f32> box(-BS/3.,0.0,-BS/3., BS/3.,BS*2./3.,BS/3.);
-	collisionMoveResult moveresult;
 	// Apply gravity
 	m_speed_f += v3f(0, -dtime*9.81*BS, 0);
 	// Maximum movement without glitches
@@ -134,10 +133,19 @@ void ItemSAO::step(float dtime, bool send_recommended)
 	// Limit speed
 	if(m_speed_f.getLength()*dtime > pos_max_d)
 		m_speed_f *= pos_max_d / (m_speed_f.getLength()*dtime);
-	v3f pos_f = getBasePosition();
-	v3f pos_f_old = pos_f;
-	moveresult = collisionMoveSimple(&m_env->getMap(), pos_max_d,
-			box, dtime, pos_f, m_speed_f);
+
+	move.box = core::aabbox3d<f32>(-BS/3.,0.0,-BS/3., BS/3.,BS*2./3.,BS/3.);
+	move.pos_max_d = pos_max_d;
+	move.dtime = dtime;
+	move.pos = getBasePosition();
+	move.speed = m_speed_f;
+	return true;
+}
+
+void ItemSAO::stepAfterMove(bool send_recommended, const CollisionMove &move)
+{
+	m_speed_f = move.speed;
+	v3f pos_f = move.pos;
 	
 	if(send_recommended == false)
 		return;
@@ -265,14 +273,15 @@ ServerActiveObject* RatSAO::create(ServerEnvironment *env, u16 id, v3f pos,
 	return new RatSAO(env, id, pos);
 }
 
-void RatSAO::step(float dtime, bool send_recommended)
+bool RatSAO::stepBeforeMove(float dtime, bool send_recommended,
+		CollisionMove &move)
 {
 	assert(m_env);
 
 	if(m_is_active == false)
 	{
 		if(m_inactive_interval.step(dtime, 0.5)==false)
-			return;
+			return false;
 	}
 
 	/*
@@ -352,18 +361,25 @@ void RatSAO::step(float dtime, bool send_recommended)
 		Move it, with collision detection
 	*/
 
-	core::aabbox3d<f32> box(-BS/3.,0.0,-BS/3., BS/3.,BS*2./3.,BS/3.);
-	collisionMoveResult moveresult;
 	// Maximum movement without glitches
 	f32 pos_max_d = BS*0.25;
 	// Limit speed
 	if(m_speed_f.getLength()*dtime > pos_max_d)
 		m_speed_f *= pos_max_d / (m_speed_f.getLength()*dtime);
-	v3f pos_f = getBasePosition();
-	v3f pos_f_old = pos_f;
-	moveresult = collisionMoveSimple(&m_env->getMap(), pos_max_d,
-			box, dtime, pos_f, m_speed_f);
-	m_touching_ground = moveresult.touching_ground;
+
+	move.box = core::aabbox3d<f32>(-BS/3.,0.0,-BS/3., BS/3.,BS*2./3.,BS/3.);
+	move.pos_max_d = pos_max_d;
+	move.dtime = dtime;
+	move.pos = getBasePosition();
+	move.speed = m_speed_f;
+	return true;
+}
+
+void RatSAO::stepAfterMove(bool send_recommended, const CollisionMove &move)
+{
+	m_speed_f = move.speed;
+	m_touching_ground = move.result.touching_ground;
+	v3f pos_f = move.pos;
 	
 	setBasePosition(pos_f);
 
@@ -453,6 +469,7 @@ Oerkki1SAO::Oerkki1SAO(ServerEnvironment *env, u16 id, v3f pos):
 	m_touching_ground = false;
 	m_hp = 20;
 	m_after_jump_timer = 0;
+	m_speed_before_step = v3f(0,0,0);
 }
 
 ServerActiveObject* Oerkki1SAO::create(ServerEnvironment *env, u16 id, v3f pos,
@@ -471,14 +488,15 @@ ServerActiveObject* Oerkki1SAO::create(ServerEnvironment *env, u16 id, v3f pos,
 	return o;
 }
 
-void Oerkki1SAO::step(float dtime, bool send_recommended)
+bool Oerkki1SAO::stepBeforeMove(float dtime, bool send_recommended,
+		CollisionMove &move)
 {
 	assert(m_env);
 
 	if(m_is_active == false)
 	{
 		if(m_inactive_interval.step(dtime, 0.5)==false)
-			return;
+			return false;
 	}
 
 	/*
@@ -490,12 +508,12 @@ void Oerkki1SAO::step(float dtime, bool send_recommended)
 	{
 		// Die
 		m_removed = true;
-		return;
+		return false;
 	}
 
 	m_after_jump_timer -= dtime;
 
-	v3f old_speed = m_speed_f;
+	m_speed_before_step = m_speed_f;
 
 	// Apply gravity
 	m_speed_f.Y -= dtime*9.81*BS;
@@ -598,23 +616,32 @@ void Oerkki1SAO::step(float dtime, bool send_recommended)
 		Move it, with collision detection
 	*/
 
-	core::aabbox3d<f32> box(-BS/3.,0.0,-BS/3., BS/3.,BS*5./3.,BS/3.);
-	collisionMoveResult moveresult;
 	// Maximum movement without glitches
 	f32 pos_max_d = BS*0.25;
 	/*// Limit speed
 	if(m_speed_f.getLength()*dtime > pos_max_d)
 		m_speed_f *= pos_max_d / (m_speed_f.getLength()*dtime);*/
-	v3f pos_f = getBasePosition();
-	v3f pos_f_old = pos_f;
-	moveresult = collisionMovePrecise(&m_env->getMap(), pos_max_d,
-			box, dtime, pos_f, m_speed_f);
-	m_touching_ground = moveresult.touching_ground;
+
+	move.box = core::aabbox3d<f32>(-BS/3.,0.0,-BS/3., BS/3.,BS*5./3.,BS/3.);
+	move.pos_max_d = pos_max_d;
+	move.dtime = dtime;
+	move.precise = true;
+	move.pos = getBasePosition();
+	move.speed = m_speed_f;
+	return true;
+}
+
+void Oerkki1SAO::stepAfterMove(bool send_recommended,
+		const CollisionMove &move)
+{
+	m_speed_f = move.speed;
+	m_touching_ground = move.result.touching_ground;
+	v3f pos_f = move.pos;
 	
 	// Do collision damage
 	float tolerance = BS*12;
 	float factor = BS*0.5;
-	v3f speed_diff = old_speed - m_speed_f;
+	v3f speed_diff = m_speed_before_step - m_speed_f;
 	// Increase effect in X and Z
 	speed_diff.X *= 2;
 	speed_diff.Z *= 2;
@@ -742,14 +769,15 @@ ServerActiveObject* FireflySAO::create(ServerEnvironment *env, u16 id, v3f pos,
 	return new FireflySAO(env, id, pos);
 }
 
-void FireflySAO::step(float dtime, bool send_recommended)
+bool FireflySAO::stepBeforeMove(float dtime, bool send_recommended,
+		CollisionMove &move)
 {
 	assert(m_env);
 
 	if(m_is_active == false)
 	{
 		if(m_inactive_interval.step(dtime, 0.5)==false)
-			return;
+			return false;
 	}
 
 	/*
@@ -821,18 +849,26 @@ void FireflySAO::step(float dtime, bool send_recommended)
 		Move it, with collision detection
 	*/
 
-	core::aabbox3d<f32> box(-BS/3.,-BS*2/3.0,-BS/3., BS/3.,BS*4./3.,BS/3.);
-	collisionMoveResult moveresult;
 	// Maximum movement without glitches
 	f32 pos_max_d = BS*0.25;
 	// Limit speed
 	if(m_speed_f.getLength()*dtime > pos_max_d)
 		m_speed_f *= pos_max_d / (m_speed_f.getLength()*dtime);
-	v3f pos_f = getBasePosition();
-	v3f pos_f_old = pos_f;
-	moveresult = collisionMoveSimple(&m_env->getMap(), pos_max_d,
-			box, dtime, pos_f, m_speed_f);
-	m_touching_ground = moveresult.touching_ground;
+
+	move.box = core::aabbox3d<f32>(-BS/3.,-BS*2/3.0,-BS/3., BS/3.,BS*4./3.,BS/3.);
+	move.pos_max_d = pos_max_d;
+	move.dtime = dtime;
+	move.pos = getBasePosition();
+	move.speed = m_speed_f;
+	return true;
+}
+
+void FireflySAO::stepAfterMove(bool send_recommended,
+		const CollisionMove &move)
+{
+	m_speed_f = move.speed;
+	m_touching_ground = move.result.touching_ground;
+	v3f pos_f = move.pos;
 	
 	setBasePosition(pos_f);
 
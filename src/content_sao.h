@@ -46,7 +46,9 @@ class ItemSAO : public ServerActiveObject
 		{return ACTIVEOBJECT_TYPE_ITEM;}
 	static ServerActiveObject* create(ServerEnvironment *env, u16 id, v3f pos,
 			const std::string &data);
-	void step(float dtime, bool send_recommended);
+	bool stepBeforeMove(float dtime, bool send_recommended,
+			CollisionMove &move);
+	void stepAfterMove(bool send_recommended, const CollisionMove &move);
 	std::string getClientInitializationData();
 	std::string getStaticData();
 	InventoryItem* createInventoryItem();
@@ -67,7 +69,9 @@ class RatSAO : public ServerActiveObject
 		{return ACTIVEOBJECT_TYPE_RAT;}
 	static ServerActiveObject* create(ServerEnvironment *env, u16 id, v3f pos,
 			const std::string &data);
-	void step(float dtime, bool send_recommended);
+	bool stepBeforeMove(float dtime, bool send_recommended,
+			CollisionMove &move);
+	void stepAfterMove(bool send_recommended, const CollisionMove &move);
 	std::string getClientInitializationData();
 	std::string getStaticData();
 	InventoryItem* createPickedUpItem();
@@ -92,7 +96,9 @@ class Oerkki1SAO : public ServerActiveObject
 		{return ACTIVEOBJECT_TYPE_OERKKI1;}
 	static ServerActiveObject* create(ServerEnvironment *env, u16 id, v3f pos,
 			const std::string &data);
-	void step(float dtime, bool send_recommended);
+	bool stepBeforeMove(float dtime, bool send_recommended,
+			CollisionMove &move);
+	void stepAfterMove(bool send_recommended, const CollisionMove &move);
 	std::string getClientInitializationData();
 	std::string getStaticData();
 	InventoryItem* createPickedUpItem(){return NULL;}
@@ -112,6 +118,8 @@ class Oerkki1SAO : public ServerActiveObject
 	bool m_touching_ground;
 	u8 m_hp;
 	float m_after_jump_timer;
+	// For calculating collision damage
+	v3f m_speed_before_step;
 };
 
 class FireflySAO : public ServerActiveObject
@@ -122,7 +130,9 @@ class FireflySAO : public ServerActiveObject
 		{return ACTIVEOBJECT_TYPE_FIREFLY;}
 	static ServerActiveObject* create(ServerEnvironment *env, u16 id, v3f pos,
 			const std::string &data);
-	void step(float dtime, bool send_recommended);
+	bool stepBeforeMove(float dtime, bool send_recommended,
+			CollisionMove &move);
+	void stepAfterMove(bool send_recommended, const CollisionMove &move);
 	std::string getClientInitializationData();
 	std::string getStaticData();
 	InventoryItem* createPickedUpItem();
@@ -90,7 +90,8 @@ DebugStack::DebugStack(threadid_t id)
 	threadid = id;
 	stack_i = 0;
 	stack_max_i = 0;
-	memset(stack, 0, DEBUG_STACK_SIZE*DEBUG_STACK_TEXT_SIZE);
+	memset(stack, 0, sizeof(stack));
+	memset(text, 0, sizeof(text));
 }
 
 void DebugStack::print(FILE *file, bool everything)
@@ -98,18 +99,25 @@ void DebugStack::print(FILE *file, bool everything)
 	fprintf(file, "DEBUG STACK FOR THREAD %lx:\n",
 			(unsigned long)threadid);
 
+	// Read once; the thread may still be running
+	int current_i = stack_i;
+
 	for(int i=0; i<stack_max_i; i++)
 	{
-		if(i == stack_i && everything == false)
+		if(i == current_i && everything == false)
 			continue;
+		
+		const char *entry = stack[i];
+		if(entry == NULL)
+			entry = "";
 
-		if(i < stack_i)
-			fprintf(file, "#%d  %s\n", i, stack[i]);
+		if(i < current_i)
+			fprintf(file, "#%d  %s\n", i, entry);
 		else
-			fprintf(file, "(Leftover data: #%d  %s)\n", i, stack[i]);
+			fprintf(file, "(Leftover data: #%d  %s)\n", i, entry);
 	}
 
-	if(stack_i == DEBUG_STACK_SIZE)
+	if(current_i == DEBUG_STACK_SIZE)
 		fprintf(file, "Probably overflown.\n");
 }
 
@@ -117,6 +125,8 @@ void DebugStack::print(FILE *file, bool everything)
 core::map<threadid_t, DebugStack*> g_debug_stacks;
 JMutex g_debug_stacks_mutex;
 
+__THREAD_LOCAL DebugStack *g_debug_stack = NULL;
+
 void debug_stacks_init()
 {
 	g_debug_stacks_mutex.Init();
@@ -134,6 +144,10 @@ void debug_stacks_print()
 	{
 		DebugStack *stack = i.getNode()->getValue();
 
+		// Skip threads that are not inside any DSTACK at the moment
+		if(stack->stack_i == 0)
+			continue;
+
 		for(int i=0; i<DEBUGSTREAM_COUNT; i++)
 		{
 			if(g_debugstreams[i] != NULL)
@@ -142,59 +156,35 @@ void debug_stacks_print()
 	}
 }
 
-DebugStacker::DebugStacker(const char *text)
+DebugStack * debug_stack_create()
 {
 	threadid_t threadid = get_current_thread_id();
 
 	JMutexAutoLock lock(g_debug_stacks_mutex);
 
+	/*
+		Stacks are not deleted when threads end. If a thread id is
+		reused, the old stack is reset and taken over by the new thread.
+	*/
+	DebugStack *stack = NULL;
 	core::map<threadid_t, DebugStack*>::Node *n;
 	n = g_debug_stacks.find(threadid);
 	if(n != NULL)
 	{
-		m_stack = n->getValue();
+		stack = n->getValue();
+		stack->stack_i = 0;
+		stack->stack_max_i = 0;
 	}
 	else
 	{
 		/*DEBUGPRINT("Creating new debug stack for thread %x\n",
 				(unsigned int)threadid);*/
-		m_stack = new DebugStack(threadid);
-		g_debug_stacks.insert(threadid, m_stack);
+		stack = new DebugStack(threadid);
+		g_debug_stacks.insert(threadid, stack);
 	}
 
-	if(m_stack->stack_i >= DEBUG_STACK_SIZE)
-	{
-		m_overflowed = true;
-	}
-	else
-	{
-		m_overflowed = false;
-
-		snprintf(m_stack->stack[m_stack->stack_i],
-				DEBUG_STACK_TEXT_SIZE, "%s", text);
-		m_stack->stack_i++;
-		if(m_stack->stack_i > m_stack->stack_max_i)
-			m_stack->stack_max_i = m_stack->stack_i;
-	}
-}
-
-DebugStacker::~DebugStacker()
-{
-	JMutexAutoLock lock(g_debug_stacks_mutex);
-	
-	if(m_overflowed == true)
-		return;
-	
-	m_stack->stack_i--;
-
-	if(m_stack->stack_i == 0)
-	{
-		threadid_t threadid = m_stack->threadid;
-		/*DEBUGPRINT("Deleting debug stack for thread %x\n",
-				(unsigned int)threadid);*/
-		delete m_stack;
-		g_debug_stacks.remove(threadid);
-	}
+	g_debug_stack = stack;
+	return stack;
 }
 
 
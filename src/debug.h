@@ -141,13 +141,23 @@ __NORETURN extern void assert_fail(
 #define DEBUG_STACK_SIZE 50
 #define DEBUG_STACK_TEXT_SIZE 300
 
+/*
+	Every thread has its own stack, found through a thread-local pointer,
+	so pushing and popping does not need any locking. The entries point
+	to static strings (usually __FUNCTION_NAME); DSTACKF copies its text
+	into the per-entry buffer.
+
+	The stacks are registered in g_debug_stacks when a thread first uses
+	DSTACK, so that they can be printed when something goes wrong.
+*/
 struct DebugStack
 {
 	DebugStack(threadid_t id);
 	void print(FILE *file, bool everything);
 	
 	threadid_t threadid;
-	char stack[DEBUG_STACK_SIZE][DEBUG_STACK_TEXT_SIZE];
+	const char *stack[DEBUG_STACK_SIZE];
+	char text[DEBUG_STACK_SIZE][DEBUG_STACK_TEXT_SIZE];
 	int stack_i; // Points to the lowest empty position
 	int stack_max_i; // Highest i that was seen
 };
@@ -158,11 +168,45 @@ extern JMutex g_debug_stacks_mutex;
 extern void debug_stacks_init();
 extern void debug_stacks_print();
 
+// Registers a stack for the current thread
+extern DebugStack * debug_stack_create();
+
+extern __THREAD_LOCAL DebugStack *g_debug_stack;
+
 class DebugStacker
 {
 public:
-	DebugStacker(const char *text);
-	~DebugStacker();
+	// If copy is true, text is copied instead of referenced
+	DebugStacker(const char *text, bool copy=false)
+	{
+		m_stack = g_debug_stack;
+		if(m_stack == NULL)
+			m_stack = debug_stack_create();
+
+		int i = m_stack->stack_i;
+		if(i >= DEBUG_STACK_SIZE)
+		{
+			m_overflowed = true;
+			return;
+		}
+		m_overflowed = false;
+
+		if(copy)
+		{
+			snprintf(m_stack->text[i], DEBUG_STACK_TEXT_SIZE, "%s", text);
+			text = m_stack->text[i];
+		}
+		m_stack->stack[i] = text;
+		m_stack->stack_i = i + 1;
+		if(m_stack->stack_i > m_stack->stack_max_i)
+			m_stack->stack_max_i = m_stack->stack_i;
+	}
+
+	~DebugStacker()
+	{
+		if(m_overflowed == false)
+			m_stack->stack_i--;
+	}
 
 private:
 	DebugStack *m_stack;
@@ -176,7 +220,7 @@ class DebugStacker
 	char __buf[DEBUG_STACK_TEXT_SIZE];\
 	snprintf(__buf,\
 			DEBUG_STACK_TEXT_SIZE, __VA_ARGS__);\
-	DebugStacker __debug_stacker(__buf);
+	DebugStacker __debug_stacker(__buf, true);
 
 /*
 	Packet counter
@@ -57,6 +57,7 @@ void set_default_settings()
 	g_settings.setDefault("address", "");
 	g_settings.setDefault("random_input", "false");
 	g_settings.setDefault("client_unload_unused_data_timeout", "600");
+	g_settings.setDefault("client_map_memory_limit", "256");
 	g_settings.setDefault("enable_fog", "true");
 	g_settings.setDefault("new_style_water", "false");
 	g_settings.setDefault("new_style_leaves", "true");
@@ -96,7 +97,11 @@ void set_default_settings()
 	g_settings.setDefault("time_send_interval", "20");
 	g_settings.setDefault("time_speed", "96");
 	g_settings.setDefault("server_unload_unused_data_timeout", "60");
+	g_settings.setDefault("server_map_memory_limit", "512");
 	g_settings.setDefault("server_map_save_interval", "60");
+	g_settings.setDefault("lighting_update_blocks_per_step", "8");
+	g_settings.setDefault("active_object_move_threads", "0");
+	g_settings.setDefault("network_compression_level", "3");
 	g_settings.setDefault("full_block_send_enable_min_time_from_building", "2.0");
 	//g_settings.setDefault("dungeon_rarity", "0.025");
 }
@@ -269,10 +269,16 @@ ServerEnvironment::ServerEnvironment(ServerMap *map, Server *server):
 	m_game_time(0),
 	m_game_time_fraction_counter(0)
 {
+	u32 thread_count = g_settings.getU16("active_object_move_threads");
+	if(thread_count == 0)
+		thread_count = MYMIN(porting::getNumberOfProcessors(), (u32)4);
+	m_collision_move_threads = new CollisionMoveThreads(thread_count);
 }
 
 ServerEnvironment::~ServerEnvironment()
 {
+	delete m_collision_move_threads;
+
 	// Clear active block list.
 	// This makes the next one delete all active objects.
 	m_active_blocks.clear();
@@ -289,69 +295,18 @@ void ServerEnvironment::serializePlayers(const std::string &savedir)
 	std::string players_path = savedir + "/players";
 	fs::CreateDir(players_path);
 
-	core::map<Player*, bool> saved_players;
-
-	std::vector<fs::DirListNode> player_files = fs::GetDirListing(players_path);
-	for(u32 i=0; i<player_files.size(); i++)
-	{
-		if(player_files[i].dir)
-			continue;
-		
-		// Full path to this file
-		std::string path = players_path + "/" + player_files[i].name;
-
-		//dstream<<"Checking player file "<<path<<std::endl;
-
-		// Load player to see what is its name
-		ServerRemotePlayer testplayer;
-		{
-			// Open file and deserialize
-			std::ifstream is(path.c_str(), std::ios_base::binary);
-			if(is.good() == false)
-			{
-				dstream<<"Failed to read "<<path<<std::endl;
-				continue;
-			}
-			testplayer.deSerialize(is);
-		}
-
-		//dstream<<"Loaded test player with name "<<testplayer.getName()<<std::endl;
-		
-		// Search for the player
-		std::string playername = testplayer.getName();
-		Player *player = getPlayer(playername.c_str());
-		if(player == NULL)
-		{
-			dstream<<"Didn't find matching player, ignoring file "<<path<<std::endl;
-			continue;
-		}
-
-		//dstream<<"Found matching player, overwriting."<<std::endl;
-
-		// OK, found. Save player there.
-		{
-			// Open file and serialize
-			std::ofstream os(path.c_str(), std::ios_base::binary);
-			if(os.good() == false)
-			{
-				dstream<<"Failed to overwrite "<<path<<std::endl;
-				continue;
-			}
-			player->serialize(os);
-			saved_players.insert(player, true);
-		}
-	}
+	u32 saved_count = 0;
 
 	for(core::list<Player*>::Iterator i = m_players.begin();
 			i != m_players.end(); i++)
 	{
 		Player *player = *i;
-		if(saved_players.find(player) != NULL)
-		{
-			/*dstream<<"Player "<<player->getName()
-					<<" was already saved."<<std::endl;*/
+		
+		// Connected players can change at any time, others only
+		// when they are flagged as modified
+		if(player->peer_id == 0 && player->isModified() == false)
 			continue;
-		}
+
 		std::string playername = player->getName();
 		// Don't save unnamed player
 		if(playername == "")
@@ -359,26 +314,38 @@ void ServerEnvironment::serializePlayers(const std::string &savedir)
 			//dstream<<"Not saving unnamed player."<<std::endl;
 			continue;
 		}
+
 		/*
-			Find a sane filename
+			Look up the file of the player or find a sane filename
 		*/
-		if(string_allowed(playername, PLAYERNAME_ALLOWED_CHARS) == false)
-			playername = "player";
-		std::string path = players_path + "/" + playername;
-		bool found = false;
-		for(u32 i=0; i<1000; i++)
+		std::string path;
+		core::map<std::string, std::string>::Node *n =
+				m_player_files.find(playername);
+		if(n != NULL)
 		{
-			if(fs::PathExists(path) == false)
-			{
-				found = true;
-				break;
-			}
-			path = players_path + "/" + playername + itos(i);
+			path = n->getValue();
 		}
-		if(found == false)
+		else
 		{
-			dstream<<"WARNING: Didn't find free file for player"<<std::endl;
-			continue;
+			std::string filename = playername;
+			if(string_allowed(filename, PLAYERNAME_ALLOWED_CHARS) == false)
+				filename = "player";
+			path = players_path + "/" + filename;
+			bool found = false;
+			for(u32 i=0; i<1000; i++)
+			{
+				if(fs::PathExists(path) == false)
+				{
+					found = true;
+					break;
+				}
+				path = players_path + "/" + filename + itos(i);
+			}
+			if(found == false)
+			{
+				dstream<<"WARNING: Didn't find free file for player"<<std::endl;
+				continue;
+			}
 		}
 
 		{
@@ -392,19 +359,20 @@ void ServerEnvironment::serializePlayers(const std::string &savedir)
 				continue;
 			}
 			player->serialize(os);
-			saved_players.insert(player, true);
 		}
+
+		m_player_files[playername] = path;
+		player->setModified(false);
+		saved_count++;
 	}
 
-	//dstream<<"Saved "<<saved_players.size()<<" players."<<std::endl;
+	//dstream<<"Saved "<<saved_count<<" players."<<std::endl;
 }
 
 void ServerEnvironment::deSerializePlayers(const std::string &savedir)
 {
 	std::string players_path = savedir + "/players";
 
-	core::map<Player*, bool> saved_players;
-
 	std::vector<fs::DirListNode> player_files = fs::GetDirListing(players_path);
 	for(u32 i=0; i<player_files.size(); i++)
 	{
@@ -414,46 +382,52 @@ void ServerEnvironment::deSerializePlayers(const std::string &savedir)
 		// Full path to this file
 		std::string path = players_path + "/" + player_files[i].name;
 
-		dstream<<"Checking player file "<<path<<std::endl;
+		dstream<<"Reading player file "<<path<<std::endl;
 
-		// Load player to see what is its name
-		ServerRemotePlayer testplayer;
+		// Load the file into a new player to see what is its name
+		ServerRemotePlayer *loaded = new ServerRemotePlayer();
 		{
 			// Open file and deserialize
 			std::ifstream is(path.c_str(), std::ios_base::binary);
 			if(is.good() == false)
 			{
 				dstream<<"Failed to read "<<path<<std::endl;
+				delete loaded;
+				continue;
+			}
+			try{
+				loaded->deSerialize(is);
+			}catch(SerializationError &e){
+				dstream<<"Failed to read "<<path<<": "<<e.what()<<std::endl;
+				delete loaded;
 				continue;
 			}
-			testplayer.deSerialize(is);
 		}
 
-		if(!string_allowed(testplayer.getName(), PLAYERNAME_ALLOWED_CHARS))
+		std::string playername = loaded->getName();
+
+		if(!string_allowed(playername, PLAYERNAME_ALLOWED_CHARS))
 		{
 			dstream<<"Not loading player with invalid name: "
-					<<testplayer.getName()<<std::endl;
+					<<playername<<std::endl;
 		}
 
-		dstream<<"Loaded test player with name "<<testplayer.getName()
-				<<std::endl;
+		dstream<<"Loaded player with name "<<playername<<std::endl;
+		
+		m_player_files[playername] = path;
 		
-		// Search for the player
-		std::string playername = testplayer.getName();
+		// If the player already exists, load the data into it
 		Player *player = getPlayer(playername.c_str());
-		bool newplayer = false;
 		if(player == NULL)
 		{
 			dstream<<"Is a new player"<<std::endl;
-			player = new ServerRemotePlayer();
-			newplayer = true;
+			loaded->setModified(false);
+			addPlayer(loaded);
+			continue;
 		}
 
-		// Load player
+		delete loaded;
 		{
-			dstream<<"Reading player "<<testplayer.getName()<<" from "
-					<<path<<std::endl;
-			// Open file and deserialize
 			std::ifstream is(path.c_str(), std::ios_base::binary);
 			if(is.good() == false)
 			{
@@ -462,9 +436,7 @@ void ServerEnvironment::deSerializePlayers(const std::string &savedir)
 			}
 			player->deSerialize(is);
 		}
-
-		if(newplayer)
-			addPlayer(player);
+		player->setModified(false);
 	}
 }
 
@@ -613,6 +585,10 @@ void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
 	// TODO: Do something
 	// TODO: Implement usage of ActiveBlockModifier
 	
+	// Nothing to do if there is no mud
+	if(block->getContents().contains(CONTENT_MUD) == false)
+		return;
+
 	// Here's a quick demonstration
 	v3s16 p0;
 	for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
@@ -846,6 +822,14 @@ void ServerEnvironment::step(float dtime)
 				searching loop to keep things fast.
 			*/
 			// TODO: Implement usage of ActiveBlockModifier
+
+			// Skip blocks that have nothing the loop below acts on
+			const MapBlockContents &contents = block->getContents();
+			if(contents.contains(CONTENT_MUD) == false
+					&& contents.contains(CONTENT_GRASS) == false
+					&& contents.contains(CONTENT_TREE) == false
+					&& contents.contains(CONTENT_JUNGLETREE) == false)
+				continue;
 			
 			// Find out how many objects the block contains
 			u32 active_object_count = block->m_static_objects.m_active.size();
@@ -942,6 +926,15 @@ void ServerEnvironment::step(float dtime)
 			send_recommended = true;
 		}
 
+		/*
+			Objects are stepped in three phases. The moves of the
+			objects only read the map, so they can be done in many
+			threads; everything else is done one object at a time.
+		*/
+		core::array<ServerActiveObject*> stepped_objects;
+		core::array<ServerActiveObject*> moved_objects;
+		core::array<CollisionMove> moves;
+
 		for(core::map<u16, ServerActiveObject*>::Iterator
 				i = m_active_objects.getIterator();
 				i.atEnd()==false; i++)
@@ -950,8 +943,29 @@ void ServerEnvironment::step(float dtime)
 			// Don't step if is to be removed or stored statically
 			if(obj->m_removed || obj->m_pending_deactivation)
 				continue;
-			// Step object
-			obj->step(dtime, send_recommended);
+			// Step object up to moving it
+			stepped_objects.push_back(obj);
+			CollisionMove move;
+			if(obj->stepBeforeMove(dtime, send_recommended, move))
+			{
+				moved_objects.push_back(obj);
+				moves.push_back(move);
+			}
+		}
+
+		m_collision_move_threads->moveMany(m_map, moves);
+
+		u32 move_i = 0;
+		for(u32 i=0; i<stepped_objects.size(); i++)
+		{
+			ServerActiveObject* obj = stepped_objects[i];
+			// Step the rest of the object
+			if(move_i < moved_objects.size()
+					&& moved_objects[move_i] == obj)
+			{
+				obj->stepAfterMove(send_recommended, moves[move_i]);
+				move_i++;
+			}
 			// Read messages from object
 			while(obj->m_messages_out.size() > 0)
 			{
@@ -37,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <ostream>
 #include "utility.h"
 #include "activeobject.h"
+#include "collision.h"
 
 class Server;
 class ActiveBlockModifier;
@@ -146,6 +147,12 @@ class ServerEnvironment : public Environment
 
 	void step(f32 dtime);
 	
+	// Blocks near players
+	core::map<v3s16, bool> & getActiveBlocks()
+	{
+		return m_active_blocks.m_list;
+	}
+	
 	/*
 		Save players
 	*/
@@ -260,6 +267,8 @@ class ServerEnvironment : public Environment
 	Server *m_server;
 	// Active object list
 	core::map<u16, ServerActiveObject*> m_active_objects;
+	// Does the moves of active objects
+	CollisionMoveThreads *m_collision_move_threads;
 	// Outgoing network message buffer for active objects
 	Queue<ActiveObjectMessage> m_active_object_messages;
 	// Some timers
@@ -276,6 +285,9 @@ class ServerEnvironment : public Environment
 	u32 m_game_time;
 	// A helper variable for incrementing the latter
 	float m_game_time_fraction_counter;
+	// Player name -> file in the players directory.
+	// Filled when players are loaded or first saved.
+	core::map<std::string, std::string> m_player_files;
 };
 
 /*
@@ -285,12 +285,34 @@ MapBlockObject * MapBlockObjectItem::createObject
 	Inventory
 */
 
+/*
+	Lists are created in both the client and the server thread.
+	The mutex is initialized before main() is entered.
+*/
+static JMutex g_list_id_mutex;
+static u32 g_next_list_id = 1;
+
+static struct ListIdMutexInit
+{
+	ListIdMutexInit()
+	{
+		g_list_id_mutex.Init();
+	}
+} g_list_id_mutex_init;
+
+static u32 get_new_list_id()
+{
+	JMutexAutoLock lock(g_list_id_mutex);
+	return g_next_list_id++;
+}
+
 InventoryList::InventoryList(std::string name, u32 size)
 {
 	m_name = name;
 	m_size = size;
+	m_modification_count = 0;
+	m_id = get_new_list_id();
 	clearItems();
-	//m_dirty = false;
 }
 
 InventoryList::~InventoryList()
@@ -317,7 +339,7 @@ void InventoryList::clearItems()
 		m_items.push_back(NULL);
 	}
 
-	//setDirty(true);
+	setModified();
 }
 
 void InventoryList::serialize(std::ostream &os) const
@@ -395,6 +417,8 @@ InventoryList::InventoryList(const InventoryList &other)
 		Do this so that the items get cloned. Otherwise the pointers
 		in the array will just get copied.
 	*/
+	m_modification_count = 0;
+	m_id = get_new_list_id();
 	*this = other;
 }
 
@@ -411,7 +435,7 @@ InventoryList & InventoryList::operator = (const InventoryList &other)
 			m_items[i] = item->clone();
 		}
 	}
-	//setDirty(true);
+	setModified();
 
 	return *this;
 }
@@ -463,7 +487,7 @@ InventoryItem * InventoryList::changeItem(u32 i, InventoryItem *newitem)
 
 	InventoryItem *olditem = m_items[i];
 	m_items[i] = newitem;
-	//setDirty(true);
+	setModified();
 	return olditem;
 }
 
@@ -517,7 +541,7 @@ InventoryItem * InventoryList::addItem(u32 i, InventoryItem *newitem)
 	if(newitem == NULL)
 		return NULL;
 	
-	//setDirty(true);
+	setModified();
 	
 	// If it is an empty position, it's an easy job.
 	InventoryItem *to_item = getItem(i);
@@ -576,7 +600,7 @@ InventoryItem * InventoryList::takeItem(u32 i, u32 count)
 	if(count == 0)
 		return NULL;
 	
-	//setDirty(true);
+	setModified();
 
 	InventoryItem *item = getItem(i);
 	// If it is an empty position, return NULL
@@ -1003,5 +1027,78 @@ bool checkItemCombination(InventoryItem const * const *items, const ItemSpec *sp
 
 	return true;
 }
+
+/*
+	cells: names of the things in the 3x3 grid, "" for empty
+*/
+static std::string getCombinationKey(const std::string *cells)
+{
+	u16 min_x = 100;
+	u16 max_x = 100;
+	u16 min_y = 100;
+	u16 max_y = 100;
+	for(u16 y=0; y<3; y++)
+	for(u16 x=0; x<3; x++)
+	{
+		if(cells[y*3 + x] == "")
+			continue;
+		if(min_x == 100 || x < min_x)
+			min_x = x;
+		if(min_y == 100 || y < min_y)
+			min_y = y;
+		if(max_x == 100 || x > max_x)
+			max_x = x;
+		if(max_y == 100 || y > max_y)
+			max_y = y;
+	}
+	if(min_x == 100)
+		return "";
+	
+	/*
+		Size, followed by the cells of the used area
+	*/
+	std::ostringstream os(std::ios_base::binary);
+	os<<(max_x - min_x + 1)<<"x"<<(max_y - min_y + 1);
+	for(u16 y=min_y; y<=max_y; y++)
+	for(u16 x=min_x; x<=max_x; x++)
+		os<<"|"<<cells[y*3 + x];
+	return os.str();
+}
+
+std::string getItemCombinationKey(const InventoryItem * const*items)
+{
+	std::string cells[9];
+	for(u16 i=0; i<9; i++)
+	{
+		const InventoryItem *item = items[i];
+		if(item == NULL)
+			continue;
+		std::string itemname = item->getName();
+		if(itemname == "MaterialItem")
+			cells[i] = "M" + itos(((MaterialItem*)item)->getMaterial());
+		else if(itemname == "CraftItem")
+			cells[i] = "C" + ((CraftItem*)item)->getSubName();
+		else
+			cells[i] = "?" + itemname;
+	}
+	return getCombinationKey(cells);
+}
+
+std::string getItemSpecCombinationKey(const ItemSpec *specs)
+{
+	std::string cells[9];
+	for(u16 i=0; i<9; i++)
+	{
+		const ItemSpec &spec = specs[i];
+		if(spec.type == ITEM_MATERIAL)
+			cells[i] = "M" + itos(spec.num);
+		else if(spec.type == ITEM_CRAFT)
+			cells[i] = "C" + spec.name;
+		else if(spec.type != ITEM_NONE)
+			// Not supported yet
+			assert(0);
+	}
+	return getCombinationKey(cells);
+}
 	
 //END
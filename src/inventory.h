@@ -468,8 +468,19 @@ class InventoryList
 	u32 getUsedSlots();
 	u32 getFreeSlots();
 
-	/*bool getDirty(){ return m_dirty; }
-	void setDirty(bool dirty=true){ m_dirty = dirty; }*/
+	/*
+		Counts the modifications of the list, so that it can be found
+		out whether it has changed since some point. Items that are
+		modified in place through getItem() have to be reported with
+		setModified().
+	*/
+	u32 getModificationCount(){ return m_modification_count; }
+	void setModified(){ m_modification_count++; }
+	/*
+		Never the same for two lists created during the run of the
+		program, unlike the address of the list.
+	*/
+	u32 getId(){ return m_id; }
 	
 	// Get pointer to item
 	const InventoryItem * getItem(u32 i) const;
@@ -506,7 +517,8 @@ class InventoryList
 	core::array<InventoryItem*> m_items;
 	u32 m_size;
 	std::string m_name;
-	//bool m_dirty;
+	u32 m_modification_count;
+	u32 m_id;
 };
 
 class Inventory
@@ -527,6 +539,15 @@ class Inventory
 	InventoryList * getList(const std::string &name);
 	const InventoryList * getList(const std::string &name) const;
 	bool deleteList(const std::string &name);
+	// For going through all the lists
+	u32 getListCount() const
+	{
+		return m_lists.size();
+	}
+	InventoryList * getListByIndex(u32 i)
+	{
+		return m_lists[i];
+	}
 	// A shorthand for adding items.
 	// Returns NULL if the item was fully added, leftover otherwise.
 	InventoryItem * addItem(const std::string &listname, InventoryItem *newitem)
@@ -695,5 +716,17 @@ struct ItemSpec
 */
 bool checkItemCombination(const InventoryItem * const*items, const ItemSpec *specs);
 
+/*
+	Keys that identify an item combination regardless of where it is
+	in the 3x3 grid. The key of items is the same as the key of specs if
+	checkItemCombination() would return true for them.
+	Empty grids give "".
+
+	items: a pointer to an array of 9 pointers to items
+	specs: a pointer to an array of 9 ItemSpecs
+*/
+std::string getItemCombinationKey(const InventoryItem * const*items);
+std::string getItemSpecCombinationKey(const ItemSpec *specs);
+
 #endif
 
@@ -0,0 +1,63 @@
+/*
+
+    This file is a part of the JThread package, which contains some object-
+    oriented thread wrappers for different thread implementations.
+
+    Copyright (c) 2000-2006  Jori Liesenborgs (jori.liesenborgs@gmail.com)
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+
+*/
+
+#ifndef JSEMAPHORE_H
+
+#define JSEMAPHORE_H
+
+#if (defined(WIN32) || defined(_WIN32_WCE))
+	#include <winsock2.h>
+	#include <windows.h>
+#else // using pthread
+	#include <semaphore.h>
+#endif // WIN32
+
+#define ERR_JSEMAPHORE_ALREADYINIT					-1
+#define ERR_JSEMAPHORE_NOTINIT						-2
+#define ERR_JSEMAPHORE_CANTCREATESEMAPHORE				-3
+
+class JSemaphore
+{
+public:
+	JSemaphore();
+	~JSemaphore();
+	int Init(unsigned int initialvalue = 0);
+	// Increments the value, waking up a waiting thread
+	int Post();
+	// Waits until the value is above zero, then decrements it
+	int Wait();
+	bool IsInitialized() 						{ return initialized; }
+private:
+#if (defined(WIN32) || defined(_WIN32_WCE))
+	HANDLE semaphore;
+#else // pthread semaphore
+	sem_t semaphore;
+#endif // WIN32
+	bool initialized;
+};
+
+#endif // JSEMAPHORE_H
@@ -0,0 +1,71 @@
+/*
+
+    This file is a part of the JThread package, which contains some object-
+    oriented thread wrappers for different thread implementations.
+
+    Copyright (c) 2000-2006  Jori Liesenborgs (jori.liesenborgs@gmail.com)
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "jsemaphore.h"
+#include <errno.h>
+
+JSemaphore::JSemaphore()
+{
+	initialized = false;
+}
+
+JSemaphore::~JSemaphore()
+{
+	if (initialized)
+		sem_destroy(&semaphore);
+}
+
+int JSemaphore::Init(unsigned int initialvalue)
+{
+	if (initialized)
+		return ERR_JSEMAPHORE_ALREADYINIT;
+	
+	if (sem_init(&semaphore,0,initialvalue) != 0)
+		return ERR_JSEMAPHORE_CANTCREATESEMAPHORE;
+	initialized = true;
+	return 0;	
+}
+
+int JSemaphore::Post()
+{
+	if (!initialized)
+		return ERR_JSEMAPHORE_NOTINIT;
+		
+	sem_post(&semaphore);
+	return 0;
+}
+
+int JSemaphore::Wait()
+{
+	if (!initialized)
+		return ERR_JSEMAPHORE_NOTINIT;
+	
+	// Retry if interrupted by a signal
+	while (sem_wait(&semaphore) != 0 && errno == EINTR)
+		;
+	return 0;
+}
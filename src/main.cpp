@@ -344,9 +344,6 @@ TODO: Flowing water to actually contain flow direction information
 
 TODO: Consider smoothening cave floors after generating them
 
-TODO: Fix make_tree, make_* to use seed-position-consistent pseudorandom
-	  - delta also
-
 Misc. stuff:
 ------------
 TODO: Make sure server handles removing grass when a block is placed (etc)
@@ -427,6 +424,7 @@ Doing currently:
 #include "config.h"
 #include "guiMainMenu.h"
 #include "mineral.h"
+#include "content_craft.h"
 #include "materials.h"
 #include "game.h"
 #include "keycode.h"
@@ -1254,6 +1252,8 @@ int main(int argc, char *argv[])
 	
 	// Initial call with g_texturesource not set.
 	init_mapnode();
+	// Doesn't need textures; the dedicated server needs it too
+	craft_init();
 
 	/*
 		Run unit tests
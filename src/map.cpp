@@ -28,6 +28,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "porting.h"
 #include "mapgen.h"
 #include "nodemetadata.h"
+#include "mapblock_visibility.h"
 
 extern "C" {
 	#include "sqlite3.h"
@@ -43,7 +44,11 @@ extern "C" {
 
 Map::Map(std::ostream &dout):
 	m_dout(dout),
-	m_sector_cache(NULL)
+	m_sector_cache(NULL),
+	m_usage_time(0),
+	m_lru_first(NULL),
+	m_lru_last(NULL),
+	m_lru_count(0)
 {
 	/*m_sector_mutex.Init();
 	assert(m_sector_mutex.IsInitialized());*/
@@ -140,6 +145,10 @@ MapBlock * Map::getBlockNoCreate(v3s16 p3d)
 
 bool Map::isNodeUnderground(v3s16 p)
 {
+	s16 y;
+	if(getSunlightHeight(v2s16(p.X, p.Z), y) && y > p.Y)
+		return true;
+
 	v3s16 blockpos = getNodeBlockPos(p);
 	try{
 		MapBlock * block = getBlockNoCreate(blockpos);
@@ -180,13 +189,31 @@ MapNode Map::getNode(v3s16 p)
 	return block->getNodeNoCheck(relpos);
 }
 
+MapNode Map::getNodeNoCache(v3s16 p)
+{
+	v3s16 blockpos = getNodeBlockPos(p);
+	core::map<v2s16, MapSector*>::Node *n =
+			m_sectors.find(v2s16(blockpos.X, blockpos.Z));
+	if(n == NULL)
+		throw InvalidPositionException();
+	MapBlock *block = n->getValue()->getBlockNoCreateNoExNoCache(blockpos.Y);
+	if(block == NULL)
+		throw InvalidPositionException();
+	v3s16 relpos = p - blockpos*MAP_BLOCKSIZE;
+	return block->getNodeNoCheck(relpos);
+}
+
 // throws InvalidPositionException if not found
 void Map::setNode(v3s16 p, MapNode & n)
 {
 	v3s16 blockpos = getNodeBlockPos(p);
 	MapBlock *block = getBlockNoCreate(blockpos);
 	v3s16 relpos = p - blockpos*MAP_BLOCKSIZE;
+	bool content_changes =
+			(n.getContent() != block->getNodeNoCheck(relpos).getContent());
 	block->setNodeNoCheck(relpos, n);
+	if(content_changes)
+		updateSunlightHeight(p);
 }
 
 
@@ -603,18 +630,19 @@ s16 Map::propagateSunlight(v3s16 start,
 		core::map<v3s16, MapBlock*> & modified_blocks)
 {
 	s16 y = start.Y;
+	v3s16 blockpos;
+	MapBlock *block = NULL;
 	for(; ; y--)
 	{
 		v3s16 pos(start.X, y, start.Z);
 
-		v3s16 blockpos = getNodeBlockPos(pos);
-		MapBlock *block;
-		try{
-			block = getBlockNoCreate(blockpos);
-		}
-		catch(InvalidPositionException &e)
+		// Look up the block only when going to the next one
+		if(block == NULL || getNodeBlockPos(pos) != blockpos)
 		{
-			break;
+			blockpos = getNodeBlockPos(pos);
+			block = getBlockNoCreateNoEx(blockpos);
+			if(block == NULL)
+				break;
 		}
 
 		v3s16 relpos = pos - blockpos*MAP_BLOCKSIZE;
@@ -646,7 +674,8 @@ s16 Map::propagateSunlight(v3s16 start,
 
 void Map::updateLighting(enum LightBank bank,
 		core::map<v3s16, MapBlock*> & a_blocks,
-		core::map<v3s16, MapBlock*> & modified_blocks)
+		core::map<v3s16, MapBlock*> & modified_blocks,
+		u32 max_blocks, core::map<v3s16, bool> *unfinished_blocks)
 {
 	/*m_dout<<DTIME<<"Map::updateLighting(): "
 			<<a_blocks.size()<<" blocks."<<std::endl;*/
@@ -745,6 +774,14 @@ void Map::updateLighting(enum LightBank bank,
 			// Bottom sunlight is not valid; get the block and loop to it
 
 			pos.Y--;
+
+			// Leave the rest for later if enough has been done
+			if(max_blocks != 0 && blocks_to_update.size() >= max_blocks
+					&& unfinished_blocks != NULL)
+			{
+				unfinished_blocks->insert(pos, true);
+				break;
+			}
 			try{
 				block = getBlockNoCreate(pos);
 			}
@@ -842,12 +879,8 @@ void Map::updateLighting(enum LightBank bank,
 		}
 
 		{
-			//TimeTaker timer("unSpreadLight");
-			vmanip.unspreadLight(bank, unlight_from, light_sources);
-		}
-		{
-			//TimeTaker timer("spreadLight");
-			vmanip.spreadLight(bank, light_sources);
+			//TimeTaker timer("updateLight");
+			vmanip.updateLight(bank, unlight_from, light_sources);
 		}
 		{
 			//TimeTaker timer("blitBack");
@@ -861,9 +894,11 @@ void Map::updateLighting(enum LightBank bank,
 }
 
 void Map::updateLighting(core::map<v3s16, MapBlock*> & a_blocks,
-		core::map<v3s16, MapBlock*> & modified_blocks)
+		core::map<v3s16, MapBlock*> & modified_blocks,
+		u32 max_blocks, core::map<v3s16, bool> *unfinished_blocks)
 {
-	updateLighting(LIGHTBANK_DAY, a_blocks, modified_blocks);
+	updateLighting(LIGHTBANK_DAY, a_blocks, modified_blocks,
+			max_blocks, unfinished_blocks);
 	updateLighting(LIGHTBANK_NIGHT, a_blocks, modified_blocks);
 
 	/*
@@ -878,6 +913,31 @@ void Map::updateLighting(core::map<v3s16, MapBlock*> & a_blocks,
 	}
 }
 
+/*
+	Returns true if sunlight comes down to the node at p.
+
+	If something is known to be above it in the sunlight heights, it
+	doesn't. Otherwise, if there is a node at top and it doesn't have
+	sunlight, there has not been any sunlight going down. Otherwise
+	there probably is.
+*/
+static bool is_node_under_sunlight(Map *map, v3s16 p)
+{
+	s16 y;
+	if(map->getSunlightHeight(v2s16(p.X, p.Z), y) && y > p.Y)
+		return false;
+
+	try{
+		MapNode topnode = map->getNode(p + v3s16(0,1,0));
+		if(topnode.getLight(LIGHTBANK_DAY) != LIGHT_SUN)
+			return false;
+	}
+	catch(InvalidPositionException &e)
+	{
+	}
+	return true;
+}
+
 /*
 */
 void Map::addNodeAndUpdate(v3s16 p, MapNode n,
@@ -894,28 +954,11 @@ void Map::addNodeAndUpdate(v3s16 p, MapNode n,
 		Else discontinue.
 	*/
 
-	v3s16 toppos = p + v3s16(0,1,0);
 	v3s16 bottompos = p + v3s16(0,-1,0);
 
-	bool node_under_sunlight = true;
+	bool node_under_sunlight = is_node_under_sunlight(this, p);
 	core::map<v3s16, bool> light_sources;
 
-	/*
-		If there is a node at top and it doesn't have sunlight,
-		there has not been any sunlight going down.
-
-		Otherwise there probably is.
-	*/
-	try{
-		MapNode topnode = getNode(toppos);
-
-		if(topnode.getLight(LIGHTBANK_DAY) != LIGHT_SUN)
-			node_under_sunlight = false;
-	}
-	catch(InvalidPositionException &e)
-	{
-	}
-
 #if 0
 	/*
 		If the new node is solid and there is grass below, change it to mud
@@ -1106,27 +1149,11 @@ void Map::removeNodeAndUpdate(v3s16 p,
 	m_dout<<DTIME<<"Map::removeNodeAndUpdate(): p=("
 			<<p.X<<","<<p.Y<<","<<p.Z<<")"<<std::endl;*/
 
-	bool node_under_sunlight = true;
-
-	v3s16 toppos = p + v3s16(0,1,0);
+	bool node_under_sunlight = is_node_under_sunlight(this, p);
 
 	// Node will be replaced with this
 	content_t replace_material = CONTENT_AIR;
 
-	/*
-		If there is a node at top and it doesn't have sunlight,
-		there will be no sunlight going down.
-	*/
-	try{
-		MapNode topnode = getNode(toppos);
-
-		if(topnode.getLight(LIGHTBANK_DAY) != LIGHT_SUN)
-			node_under_sunlight = false;
-	}
-	catch(InvalidPositionException &e)
-	{
-	}
-
 	core::map<v3s16, bool> light_sources;
 
 	enum LightBank banks[] =
@@ -1271,6 +1298,277 @@ void Map::removeNodeAndUpdate(v3s16 p,
 	}
 }
 
+/*
+	Gives an approximate light to a node at p, from its neighbors and
+	from the sunlight coming from above. Used until the lighting of the
+	block has been properly updated.
+*/
+static void set_provisional_light(Map *map, v3s16 p, MapNode &n,
+		bool node_under_sunlight)
+{
+	enum LightBank banks[] =
+	{
+		LIGHTBANK_DAY,
+		LIGHTBANK_NIGHT
+	};
+	for(s32 i=0; i<2; i++)
+	{
+		enum LightBank bank = banks[i];
+		u8 light = 0;
+		if(content_features(n).light_propagates)
+		{
+			try{
+				v3s16 n2p = map->getBrightestNeighbour(bank, p);
+				light = diminish_light(map->getNode(n2p).getLight(bank));
+			}
+			catch(InvalidPositionException &e)
+			{
+			}
+		}
+		n.setLight(bank, light);
+	}
+	if(node_under_sunlight && content_features(n).sunlight_propagates)
+		n.setLight(LIGHTBANK_DAY, LIGHT_SUN);
+}
+
+void Map::addNodeAndQueueLighting(v3s16 p, MapNode n,
+		core::map<v3s16, MapBlock*> &modified_blocks)
+{
+	v3s16 blockpos = getNodeBlockPos(p);
+	MapBlock *block = getBlockNoCreate(blockpos);
+
+	bool node_under_sunlight = is_node_under_sunlight(this, p);
+
+	set_provisional_light(this, p, n, node_under_sunlight);
+
+	setNode(p, n);
+
+	NodeMetadata *meta_proto = content_features(n).initial_metadata;
+	if(meta_proto)
+	{
+		NodeMetadata *meta = meta_proto->clone();
+		setNodeMetadata(p, meta);
+	}
+
+	modified_blocks.insert(blockpos, block);
+	m_lighting_update_queue.insert(blockpos, true);
+
+	v3s16 dirs[7] = {
+		v3s16(0,0,0), // self
+		v3s16(0,0,1), // back
+		v3s16(0,1,0), // top
+		v3s16(1,0,0), // right
+		v3s16(0,0,-1), // front
+		v3s16(0,-1,0), // bottom
+		v3s16(-1,0,0), // left
+	};
+	for(u16 i=0; i<7; i++)
+	{
+		v3s16 p2 = p + dirs[i];
+		MapNode n2 = getNodeNoEx(p2);
+		if(content_liquid(n2.getContent()) || n2.getContent() == CONTENT_AIR)
+			m_transforming_liquid.push_back(p2);
+	}
+}
+
+void Map::removeNodeAndQueueLighting(v3s16 p,
+		core::map<v3s16, MapBlock*> &modified_blocks)
+{
+	v3s16 blockpos = getNodeBlockPos(p);
+	MapBlock *block = getBlockNoCreate(blockpos);
+
+	bool node_under_sunlight = is_node_under_sunlight(this, p);
+
+	removeNodeMetadata(p);
+
+	MapNode n;
+	n.setContent(CONTENT_AIR);
+	setNode(p, n);
+
+	/*
+		The light is taken from the neighbors after the node has been
+		removed, so that a removed light source doesn't light it.
+	*/
+	set_provisional_light(this, p, n, node_under_sunlight);
+	setNode(p, n);
+
+	modified_blocks.insert(blockpos, block);
+	m_lighting_update_queue.insert(blockpos, true);
+
+	v3s16 dirs[7] = {
+		v3s16(0,0,1), // back
+		v3s16(0,1,0), // top
+		v3s16(1,0,0), // right
+		v3s16(0,0,-1), // front
+		v3s16(0,-1,0), // bottom
+		v3s16(-1,0,0), // left
+		v3s16(0,0,0), // self
+	};
+	for(u16 i=0; i<7; i++)
+	{
+		v3s16 p2 = p + dirs[i];
+		MapNode n2 = getNodeNoEx(p2);
+		if(content_liquid(n2.getContent()) || n2.getContent() == CONTENT_AIR)
+			m_transforming_liquid.push_back(p2);
+	}
+}
+
+/*
+	Hash of the light of the nodes of a block, for finding out whether
+	the light changed
+*/
+static u32 get_block_light_hash(MapBlock *block)
+{
+	u32 hash = 2166136261U;
+	for(s16 z=0; z<MAP_BLOCKSIZE; z++)
+	for(s16 y=0; y<MAP_BLOCKSIZE; y++)
+	for(s16 x=0; x<MAP_BLOCKSIZE; x++)
+	{
+		hash ^= block->getNodeNoEx(v3s16(x,y,z)).param1;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+u32 Map::updateQueuedLighting(u32 max_blocks,
+		core::map<v3s16, MapBlock*> &modified_blocks)
+{
+	DSTACK(__FUNCTION_NAME);
+
+	if(m_lighting_update_queue.size() == 0)
+		return 0;
+
+	/*
+		Take blocks from the queue. They are updated together, so edits
+		next to each other only cause one update.
+	*/
+	core::map<v3s16, MapBlock*> blocks;
+	core::list<v3s16> taken;
+	for(core::map<v3s16, bool>::Iterator
+			i = m_lighting_update_queue.getIterator();
+			i.atEnd() == false; i++)
+	{
+		if(max_blocks != 0 && taken.size() >= max_blocks)
+			break;
+		v3s16 p = i.getNode()->getKey();
+		taken.push_back(p);
+		MapBlock *block = getBlockNoCreateNoEx(p);
+		if(block == NULL || block->isDummy())
+			continue;
+		blocks.insert(p, block);
+	}
+	for(core::list<v3s16>::Iterator i = taken.begin();
+			i != taken.end(); i++)
+	{
+		m_lighting_update_queue.remove(*i);
+	}
+
+	if(blocks.size() == 0)
+		return m_lighting_update_queue.size();
+
+	/*
+		Remember the light of the blocks that are likely to be changed,
+		so that the blocks whose light doesn't change can be left out
+		of modified_blocks
+	*/
+	core::map<v3s16, u32> light_hashes;
+	for(core::map<v3s16, MapBlock*>::Iterator
+			i = blocks.getIterator();
+			i.atEnd() == false; i++)
+	{
+		v3s16 p = i.getNode()->getKey();
+		for(s16 z=-1; z<=1; z++)
+		for(s16 y=-1; y<=1; y++)
+		for(s16 x=-1; x<=1; x++)
+		{
+			v3s16 p2 = p + v3s16(x,y,z);
+			if(light_hashes.find(p2) != NULL)
+				continue;
+			MapBlock *block = getBlockNoCreateNoEx(p2);
+			if(block == NULL || block->isDummy())
+				continue;
+			light_hashes.insert(p2, get_block_light_hash(block));
+		}
+	}
+
+	/*
+		Sunlight that would go down further than max_blocks is left for
+		the next call
+	*/
+	core::map<v3s16, MapBlock*> lighting_modified_blocks;
+	core::map<v3s16, bool> unfinished_blocks;
+	updateLighting(blocks, lighting_modified_blocks,
+			max_blocks, &unfinished_blocks);
+	for(core::map<v3s16, bool>::Iterator
+			i = unfinished_blocks.getIterator();
+			i.atEnd() == false; i++)
+	{
+		m_lighting_update_queue.insert(i.getNode()->getKey(), true);
+	}
+
+	/*
+		updateLighting() only spreads light that comes in from outside
+		the updated blocks, so spread the light of light sources in
+		them too.
+	*/
+	core::map<v3s16, bool> light_sources;
+	for(core::map<v3s16, MapBlock*>::Iterator
+			i = lighting_modified_blocks.getIterator();
+			i.atEnd() == false; i++)
+	{
+		MapBlock *block = i.getNode()->getValue();
+		v3s16 relpos = block->getPosRelative();
+		for(s16 z=0; z<MAP_BLOCKSIZE; z++)
+		for(s16 y=0; y<MAP_BLOCKSIZE; y++)
+		for(s16 x=0; x<MAP_BLOCKSIZE; x++)
+		{
+			MapNode n = block->getNodeNoEx(v3s16(x,y,z));
+			if(content_features(n).light_source != 0)
+				light_sources.insert(relpos + v3s16(x,y,z), true);
+		}
+	}
+	if(light_sources.size() != 0)
+	{
+		spreadLight(LIGHTBANK_DAY, light_sources, lighting_modified_blocks);
+		spreadLight(LIGHTBANK_NIGHT, light_sources, lighting_modified_blocks);
+		for(core::map<v3s16, MapBlock*>::Iterator
+				i = lighting_modified_blocks.getIterator();
+				i.atEnd() == false; i++)
+		{
+			i.getNode()->getValue()->updateDayNightDiff();
+		}
+	}
+
+	for(core::map<v3s16, MapBlock*>::Iterator
+			i = lighting_modified_blocks.getIterator();
+			i.atEnd() == false; i++)
+	{
+		v3s16 p = i.getNode()->getKey();
+		MapBlock *block = i.getNode()->getValue();
+		core::map<v3s16, u32>::Node *n = light_hashes.find(p);
+		if(n != NULL && n->getValue() == get_block_light_hash(block))
+			continue;
+		modified_blocks.insert(p, block);
+	}
+
+	return m_lighting_update_queue.size();
+}
+
+bool Map::isLightingQueued(v3s16 blockpos)
+{
+	if(m_lighting_update_queue.size() == 0)
+		return false;
+	if(m_lighting_update_queue.find(blockpos) != NULL)
+		return true;
+	for(u16 i=0; i<6; i++)
+	{
+		if(m_lighting_update_queue.find(blockpos + g_6dirs[i]) != NULL)
+			return true;
+	}
+	return false;
+}
+
+
 bool Map::addNodeWithEvent(v3s16 p, MapNode n)
 {
 	MapEditEvent event;
@@ -1389,65 +1687,80 @@ bool Map::dayNightDiffed(v3s16 blockpos)
 	Updates usage timers
 */
 void Map::timerUpdate(float dtime, float unload_timeout,
-		core::list<v3s16> *unloaded_blocks)
+		u32 max_loaded_blocks,
+		core::list<v3s16> *unloaded_blocks,
+		core::map<v3s16, bool> *keep_blocks)
 {
 	bool save_before_unloading = (mapType() == MAPTYPE_SERVER);
 	
-	core::list<v2s16> sector_deletion_queue;
+	m_usage_time += dtime;
+
+	core::map<v2s16, bool> emptied_sectors;
 	u32 deleted_blocks_count = 0;
 	u32 saved_blocks_count = 0;
 
-	core::map<v2s16, MapSector*>::Iterator si;
-
-	si = m_sectors.getIterator();
-	for(; si.atEnd() == false; si++)
+	/*
+		Go through the blocks starting from the least recently used one
+		until one is found that can stay loaded. Blocks that are to be
+		kept are moved to the other end, so every block is looked at
+		at most once.
+	*/
+	u32 blocks_to_check = m_lru_count;
+	while(m_lru_first != NULL && blocks_to_check > 0)
 	{
-		MapSector *sector = si.getNode()->getValue();
-
-		bool all_blocks_deleted = true;
-
-		core::list<MapBlock*> blocks;
-		sector->getBlocks(blocks);
-		for(core::list<MapBlock*>::Iterator i = blocks.begin();
-				i != blocks.end(); i++)
-		{
-			MapBlock *block = (*i);
-			
-			block->incrementUsageTimer(dtime);
-			
-			if(block->getUsageTimer() > unload_timeout)
-			{
-				v3s16 p = block->getPos();
+		blocks_to_check--;
 
-				// Save if modified
-				if(block->getModified() != MOD_STATE_CLEAN
-						&& save_before_unloading)
-				{
-					saveBlock(block);
-					saved_blocks_count++;
-				}
+		MapBlock *block = m_lru_first;
 
-				// Delete from memory
-				sector->deleteBlock(block);
+		bool timed_out =
+				(m_usage_time - block->getUsageTime() > unload_timeout);
+		bool over_limit =
+				(max_loaded_blocks != 0 && m_lru_count > max_loaded_blocks);
+		if(timed_out == false && over_limit == false)
+			break;
 
-				if(unloaded_blocks)
-					unloaded_blocks->push_back(p);
+		v3s16 p = block->getPos();
 
-				deleted_blocks_count++;
-			}
-			else
-			{
-				all_blocks_deleted = false;
-			}
+		// Blocks waiting for a lighting update are kept too, because
+		// their lighting would be left incomplete on disk
+		if((keep_blocks != NULL && keep_blocks->find(p) != NULL)
+				|| m_lighting_update_queue.find(p) != NULL)
+		{
+			touchBlock(block);
+			continue;
 		}
 
-		if(all_blocks_deleted)
+		// Save if modified
+		if(block->getModified() != MOD_STATE_CLEAN
+				&& save_before_unloading)
 		{
-			sector_deletion_queue.push_back(si.getNode()->getKey());
+			saveBlock(block);
+			saved_blocks_count++;
 		}
+
+		// Delete from memory
+		v2s16 p2d(p.X, p.Z);
+		MapSector *sector = getSectorNoGenerateNoEx(p2d);
+		assert(sector);
+		sector->deleteBlock(block);
+
+		if(sector->getBlockCount() == 0)
+			emptied_sectors.insert(p2d, true);
+
+		if(unloaded_blocks)
+			unloaded_blocks->push_back(p);
+
+		deleted_blocks_count++;
 	}
 	
 	// Finally delete the empty sectors
+	core::list<v2s16> sector_deletion_queue;
+	for(core::map<v2s16, bool>::Iterator
+			i = emptied_sectors.getIterator();
+			i.atEnd() == false; i++)
+	{
+		sector_deletion_queue.push_back(i.getNode()->getKey());
+	}
 	deleteSectors(sector_deletion_queue);
 	
 	if(deleted_blocks_count != 0)
@@ -1457,10 +1770,63 @@ void Map::timerUpdate(float dtime, float unload_timeout,
 				<<" blocks from memory";
 		if(save_before_unloading)
 			dstream<<", of which "<<saved_blocks_count<<" were written";
-		dstream<<"."<<std::endl;
+		dstream<<", "<<m_lru_count<<" blocks left."<<std::endl;
 	}
 }
 
+u32 Map::blockCountForMemory(u32 megabytes)
+{
+	u32 block_size = sizeof(MapBlock)
+			+ MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE*sizeof(MapNode);
+	return (u64)megabytes * 1024 * 1024 / block_size;
+}
+
+void Map::touchBlock(MapBlock *block)
+{
+	block->m_usage_time = m_usage_time;
+
+	if(block->m_lru_linked == false || block == m_lru_last)
+		return;
+	
+	unlinkBlock(block);
+	linkBlock(block);
+}
+
+void Map::linkBlock(MapBlock *block)
+{
+	assert(block->m_lru_linked == false);
+
+	block->m_usage_time = m_usage_time;
+	block->m_lru_prev = m_lru_last;
+	block->m_lru_next = NULL;
+	if(m_lru_last != NULL)
+		m_lru_last->m_lru_next = block;
+	else
+		m_lru_first = block;
+	m_lru_last = block;
+	block->m_lru_linked = true;
+	m_lru_count++;
+}
+
+void Map::unlinkBlock(MapBlock *block)
+{
+	if(block->m_lru_linked == false)
+		return;
+	
+	if(block->m_lru_prev != NULL)
+		block->m_lru_prev->m_lru_next = block->m_lru_next;
+	else
+		m_lru_first = block->m_lru_next;
+	if(block->m_lru_next != NULL)
+		block->m_lru_next->m_lru_prev = block->m_lru_prev;
+	else
+		m_lru_last = block->m_lru_prev;
+	block->m_lru_prev = NULL;
+	block->m_lru_next = NULL;
+	block->m_lru_linked = false;
+	m_lru_count--;
+}
+
 void Map::deleteSectors(core::list<v2s16> &list)
 {
 	core::list<v2s16>::Iterator j;
@@ -2035,6 +2401,11 @@ void ServerMap::initBlockMake(mapgen::BlockMakeData *data, v3s16 blockpos)
 			ServerMapSector *sector = createSector(sectorpos);
 			assert(sector);
 
+			mapgen::SectorGroundLevels ground_levels;
+			getSectorGroundLevels(sector, ground_levels);
+			if(x == 0 && z == 0)
+				data->ground_levels = ground_levels;
+
 			for(s16 y=-1; y<=1; y++)
 			{
 				v3s16 p(blockpos.X+x, blockpos.Y+y, blockpos.Z+z);
@@ -2051,7 +2422,8 @@ void ServerMap::initBlockMake(mapgen::BlockMakeData *data, v3s16 blockpos)
 
 						Refer to the map generator heuristics.
 					*/
-					bool ug = mapgen::block_is_underground(data->seed, p);
+					bool ug = mapgen::block_is_underground(
+							ground_levels.minimum, p);
 					block->setIsUnderground(ug);
 				}
 
@@ -2127,6 +2499,21 @@ MapBlock* ServerMap::finishBlockMake(mapgen::BlockMakeData *data,
 		m_transforming_liquid.push_back(p);
 	}
 	
+	/*
+		Update sunlight heights of the sectors from the changed blocks
+		before lighting uses them
+	*/
+	for(core::map<v3s16, MapBlock*>::Iterator i = changed_blocks.getIterator();
+			i.atEnd() == false; i++)
+	{
+		MapBlock *block = i.getNode()->getValue();
+		v3s16 p = block->getPos();
+		ServerMapSector *sector =
+				(ServerMapSector*)getSectorNoGenerateNoEx(v2s16(p.X, p.Z));
+		assert(sector);
+		sector->updateSunlightHeights(block);
+	}
+
 	/*
 		Get central block
 	*/
@@ -2327,6 +2714,10 @@ ServerMapSector * ServerMap::createSector(v2s16 p2d)
 	*/
 	
 	sector = new ServerMapSector(this, p2d);
+
+	// The sector has no blocks anywhere yet, so all of them will be
+	// seen by the sunlight heights
+	sector->initSunlightHeights();
 	
 	// Sector position on map in nodes
 	v2s16 nodepos2d = p2d * MAP_BLOCKSIZE;
@@ -2339,6 +2730,16 @@ ServerMapSector * ServerMap::createSector(v2s16 p2d)
 	return sector;
 }
 
+void ServerMap::getSectorGroundLevels(ServerMapSector *sector,
+		mapgen::SectorGroundLevels &levels)
+{
+	if(sector->getGroundLevels(levels))
+		return;
+	
+	mapgen::find_sector_ground_levels(m_seed, sector->getPos(), levels);
+	sector->setGroundLevels(levels);
+}
+
 /*
 	This is a quick-hand function for calling makeBlock().
 */
@@ -2743,6 +3144,21 @@ s16 ServerMap::findGroundLevel(v2s16 p2d)
 plan_b:
 #endif
 
+	/*
+		Use the sunlight height if the ground there is loaded and
+		open to the sky
+	*/
+	s16 y;
+	if(getSunlightHeight(p2d, y) && y != SUNLIGHT_HEIGHT_NONE)
+	{
+		MapNode n = getNodeNoEx(v3s16(p2d.X, y, p2d.Y));
+		MapNode n_above = getNodeNoEx(v3s16(p2d.X, y+1, p2d.Y));
+		if(content_features(n).walkable
+				&& n_above.getContent() != CONTENT_IGNORE
+				&& n_above.getLight(LIGHTBANK_DAY) == LIGHT_SUN)
+			return y;
+	}
+
 	/*
 		Determine from map generator noise functions
 	*/
@@ -2754,6 +3170,24 @@ s16 ServerMap::findGroundLevel(v2s16 p2d)
 	//return (s16)level;
 }
 
+bool ServerMap::getSunlightHeight(v2s16 p2d, s16 &y)
+{
+	ServerMapSector *sector = (ServerMapSector*)getSectorNoGenerateNoEx(
+			getNodeSectorPos(p2d));
+	if(sector == NULL)
+		return false;
+	return sector->getSunlightHeight(p2d, y);
+}
+
+void ServerMap::updateSunlightHeight(v3s16 p)
+{
+	ServerMapSector *sector = (ServerMapSector*)getSectorNoGenerateNoEx(
+			getNodeSectorPos(v2s16(p.X, p.Z)));
+	if(sector == NULL)
+		return;
+	sector->updateSunlightHeight(p);
+}
+
 void ServerMap::createDirs(std::string path)
 {
 	if(fs::CreateAllDirs(path) == false)
@@ -2847,6 +3281,16 @@ void ServerMap::save(bool only_changed)
 	if(only_changed == false)
 		dstream<<DTIME<<"ServerMap: Saving whole map, this can take time."
 				<<std::endl;
+
+	/*
+		Finish queued lighting updates so that no approximate light is
+		saved. The server has usually done this already so that it
+		could send the blocks again.
+	*/
+	{
+		core::map<v3s16, MapBlock*> modified_blocks;
+		updateQueuedLighting(0, modified_blocks);
+	}
 	
 	if(only_changed == false || m_map_metadata_changed)
 	{
@@ -3192,6 +3636,14 @@ void ServerMap::saveBlock(MapBlock *block)
 
 	// We just wrote it to the disk so clear modified flag
 	block->resetModified();
+
+	/*
+		Write sector metadata too if it has changed, so that it isn't
+		lost if the sector is unloaded
+	*/
+	ServerMapSector *sector = (ServerMapSector*)getSectorNoGenerateNoEx(p2d);
+	if(sector != NULL && sector->differs_from_disk)
+		saveSectorMeta(sector);
 }
 
 void ServerMap::loadBlock(std::string sectordir, std::string blockfile, MapSector *sector, bool save_after_load)
@@ -3242,6 +3694,9 @@ void ServerMap::loadBlock(std::string sectordir, std::string blockfile, MapSecto
 		// If it's a new block, insert it to the map
 		if(created_new)
 			sector->insertBlock(block);
+
+		assert(sector->getId() == MAPSECTOR_SERVER);
+		((ServerMapSector*)sector)->updateSunlightHeights(block);
 		
 		/*
 			Save blocks loaded in old format in new format
@@ -3436,21 +3891,70 @@ void ClientMap::OnRegisterSceneNode()
 	ISceneNode::OnRegisterSceneNode();
 }
 
-void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
+/*
+	Gives the face connectivities of the blocks of a ClientMap to
+	find_visible_blocks()
+*/
+class ClientMapConnectivitySource : public BlockConnectivitySource
 {
-	//m_dout<<DTIME<<"Rendering map..."<<std::endl;
-	DSTACK(__FUNCTION_NAME);
+public:
+	ClientMapConnectivitySource(Map *map):
+		m_map(map)
+	{
+	}
+	bool getFaceConnectivity(v3s16 blockpos, u16 &connectivity)
+	{
+		MapBlock *block = m_map->getBlockNoCreateNoEx(blockpos);
+		if(block == NULL)
+			return false;
+		connectivity = block->getFaceConnectivity();
+		return true;
+	}
+private:
+	Map *m_map;
+};
+
+void ClientMap::updateDrawList(v3f camera_position, v3f camera_direction)
+{
+	ScopeProfiler sp(&g_profiler, "ClientMap: update draw list");
+
+	m_drawlist.clear();
 
-	bool is_transparent_pass = pass == scene::ESNRP_TRANSPARENT;
-	
 	/*
-		This is called two times per frame, reset on the non-transparent one
+		When everything is drawn, take all the blocks there are
 	*/
-	if(pass == scene::ESNRP_SOLID)
+	if(m_control.range_all)
 	{
-		m_last_drawn_sectors.clear();
+		core::map<v2s16, MapSector*>::Iterator si;
+		si = m_sectors.getIterator();
+		for(; si.atEnd() == false; si++)
+		{
+			MapSector *sector = si.getNode()->getValue();
+			core::list< MapBlock * > sectorblocks;
+			sector->getBlocks(sectorblocks);
+			core::list< MapBlock * >::Iterator i;
+			for(i=sectorblocks.begin(); i!=sectorblocks.end(); i++)
+				m_drawlist.push_back((*i)->getPos());
+		}
+		return;
 	}
 
+	/*
+		Otherwise only go through the blocks that can be seen from
+		the camera, leaving out the ones hidden behind solid blocks
+	*/
+	ClientMapConnectivitySource source(this);
+	find_visible_blocks(&source, camera_position, camera_direction,
+			m_control.wanted_range, m_drawlist);
+}
+
+void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
+{
+	//m_dout<<DTIME<<"Rendering map..."<<std::endl;
+	DSTACK(__FUNCTION_NAME);
+
+	bool is_transparent_pass = pass == scene::ESNRP_TRANSPARENT;
+	
 	/*
 		Get time for measuring timeout.
 		
@@ -3466,30 +3970,24 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 	v3f camera_direction = m_camera_direction;
 	m_camera_mutex.Unlock();
 
+	// In nodes; isBlockInSight() takes it so
+	float range = 100000;
+	if(m_control.range_all == false)
+		range = m_control.wanted_range;
+
+	/*
+		This is called two times per frame, reset on the non-transparent one
+	*/
+	if(pass == scene::ESNRP_SOLID)
+	{
+		m_last_drawn_sectors.clear();
+		updateDrawList(camera_position, camera_direction);
+	}
+
 	/*
-		Get all blocks and draw all visible ones
+		Draw all visible blocks
 	*/
 
-	v3s16 cam_pos_nodes(
-			camera_position.X / BS,
-			camera_position.Y / BS,
-			camera_position.Z / BS);
-
-	v3s16 box_nodes_d = m_control.wanted_range * v3s16(1,1,1);
-
-	v3s16 p_nodes_min = cam_pos_nodes - box_nodes_d;
-	v3s16 p_nodes_max = cam_pos_nodes + box_nodes_d;
-
-	// Take a fair amount as we will be dropping more out later
-	v3s16 p_blocks_min(
-			p_nodes_min.X / MAP_BLOCKSIZE - 2,
-			p_nodes_min.Y / MAP_BLOCKSIZE - 2,
-			p_nodes_min.Z / MAP_BLOCKSIZE - 2);
-	v3s16 p_blocks_max(
-			p_nodes_max.X / MAP_BLOCKSIZE + 1,
-			p_nodes_max.Y / MAP_BLOCKSIZE + 1,
-			p_nodes_max.Z / MAP_BLOCKSIZE + 1);
-	
 	u32 vertex_count = 0;
 	
 	// For limiting number of mesh updates per frame
@@ -3499,9 +3997,7 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 	u32 blocks_drawn = 0;
 
 	int timecheck_counter = 0;
-	core::map<v2s16, MapSector*>::Iterator si;
-	si = m_sectors.getIterator();
-	for(; si.atEnd() == false; si++)
+	for(u32 bi=0; bi<m_drawlist.size(); bi++)
 	{
 		{
 			timecheck_counter++;
@@ -3519,155 +4015,125 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 			}
 		}
 
-		MapSector *sector = si.getNode()->getValue();
-		v2s16 sp = sector->getPos();
-		
-		if(m_control.range_all == false)
-		{
-			if(sp.X < p_blocks_min.X
-			|| sp.X > p_blocks_max.X
-			|| sp.Y < p_blocks_min.Z
-			|| sp.Y > p_blocks_max.Z)
-				continue;
-		}
+		MapBlock *block = getBlockNoCreateNoEx(m_drawlist[bi]);
+		// The block may have been unloaded after the solid pass
+		if(block == NULL)
+			continue;
 
-		core::list< MapBlock * > sectorblocks;
-		sector->getBlocks(sectorblocks);
-		
 		/*
-			Draw blocks
+			Compare block position to camera position, skip
+			if not seen on display
 		*/
 		
-		u32 sector_blocks_drawn = 0;
-
-		core::list< MapBlock * >::Iterator i;
-		for(i=sectorblocks.begin(); i!=sectorblocks.end(); i++)
+		float d = 0.0;
+		if(isBlockInSight(block->getPos(), camera_position,
+				camera_direction, range, &d) == false)
 		{
-			MapBlock *block = *i;
-
-			/*
-				Compare block position to camera position, skip
-				if not seen on display
-			*/
-			
-			float range = 100000 * BS;
-			if(m_control.range_all == false)
-				range = m_control.wanted_range * BS;
-			
-			float d = 0.0;
-			if(isBlockInSight(block->getPos(), camera_position,
-					camera_direction, range, &d) == false)
-			{
-				continue;
-			}
-
-			// Okay, this block will be drawn. Reset usage timer.
-			block->resetUsageTimer();
-			
-			// This is ugly (spherical distance limit?)
-			/*if(m_control.range_all == false &&
-					d - 0.5*BS*MAP_BLOCKSIZE > range)
-				continue;*/
+			continue;
+		}
+		// Okay, this block will be drawn. Reset usage timer.
+		block->resetUsageTimer();
+		
+		// This is ugly (spherical distance limit?)
+		/*if(m_control.range_all == false &&
+				d - 0.5*BS*MAP_BLOCKSIZE > range)
+			continue;*/
 
 #if 1
-			/*
-				Update expired mesh (used for day/night change)
+		/*
+			Update expired mesh (used for day/night change)
 
-				It doesn't work exactly like it should now with the
-				tasked mesh update but whatever.
-			*/
+			It doesn't work exactly like it should now with the
+			tasked mesh update but whatever.
+		*/
 
-			bool mesh_expired = false;
-			
-			{
-				JMutexAutoLock lock(block->mesh_mutex);
+		bool mesh_expired = false;
+		
+		{
+			JMutexAutoLock lock(block->mesh_mutex);
 
-				mesh_expired = block->getMeshExpired();
+			mesh_expired = block->getMeshExpired();
 
-				// Mesh has not been expired and there is no mesh:
-				// block has no content
-				if(block->mesh == NULL && mesh_expired == false)
-					continue;
-			}
+			// Mesh has not been expired and there is no mesh:
+			// block has no content
+			if(block->mesh == NULL && mesh_expired == false)
+				continue;
+		}
 
-			f32 faraway = BS*50;
-			//f32 faraway = m_control.wanted_range * BS;
-			
-			/*
-				This has to be done with the mesh_mutex unlocked
-			*/
-			// Pretty random but this should work somewhat nicely
-			if(mesh_expired && (
-					(mesh_update_count < 3
-						&& (d < faraway || mesh_update_count < 2)
-					)
-					|| 
-					(m_control.range_all && mesh_update_count < 20)
+		f32 faraway = BS*50;
+		//f32 faraway = m_control.wanted_range * BS;
+		
+		/*
+			This has to be done with the mesh_mutex unlocked
+		*/
+		// Pretty random but this should work somewhat nicely
+		if(mesh_expired && (
+				(mesh_update_count < 3
+					&& (d < faraway || mesh_update_count < 2)
 				)
+				|| 
+				(m_control.range_all && mesh_update_count < 20)
 			)
-			/*if(mesh_expired && mesh_update_count < 6
-					&& (d < faraway || mesh_update_count < 3))*/
-			{
-				mesh_update_count++;
+		)
+		/*if(mesh_expired && mesh_update_count < 6
+				&& (d < faraway || mesh_update_count < 3))*/
+		{
+			mesh_update_count++;
 
-				// Mesh has been expired: generate new mesh
-				//block->updateMesh(daynight_ratio);
-				m_client->addUpdateMeshTask(block->getPos());
+			// Mesh has been expired: generate new mesh
+			//block->updateMesh(daynight_ratio);
+			m_client->addUpdateMeshTask(block->getPos());
 
-				mesh_expired = false;
-			}
-			
+			mesh_expired = false;
+		}
+		
 #endif
-			/*
-				Draw the faces of the block
-			*/
-			{
-				JMutexAutoLock lock(block->mesh_mutex);
+		/*
+			Draw the faces of the block
+		*/
+		{
+			JMutexAutoLock lock(block->mesh_mutex);
 
-				scene::SMesh *mesh = block->mesh;
+			scene::SMesh *mesh = block->mesh;
 
-				if(mesh == NULL)
-					continue;
-				
-				blocks_would_have_drawn++;
-				if(blocks_drawn >= m_control.wanted_max_blocks
-						&& m_control.range_all == false
-						&& d > m_control.wanted_min_range * BS)
-					continue;
+			if(mesh == NULL)
+				continue;
+			
+			blocks_would_have_drawn++;
+			if(blocks_drawn >= m_control.wanted_max_blocks
+					&& m_control.range_all == false
+					&& d > m_control.wanted_min_range * BS)
+				continue;
+
+			blocks_drawn++;
 
-				blocks_drawn++;
-				sector_blocks_drawn++;
+			v3s16 p = block->getPos();
+			m_last_drawn_sectors[v2s16(p.X, p.Z)] = true;
 
-				u32 c = mesh->getMeshBufferCount();
+			u32 c = mesh->getMeshBufferCount();
 
-				for(u32 i=0; i<c; i++)
+			for(u32 i=0; i<c; i++)
+			{
+				scene::IMeshBuffer *buf = mesh->getMeshBuffer(i);
+				const video::SMaterial& material = buf->getMaterial();
+				video::IMaterialRenderer* rnd =
+						driver->getMaterialRenderer(material.MaterialType);
+				bool transparent = (rnd && rnd->isTransparent());
+				// Render transparent on transparent pass and likewise.
+				if(transparent == is_transparent_pass)
 				{
-					scene::IMeshBuffer *buf = mesh->getMeshBuffer(i);
-					const video::SMaterial& material = buf->getMaterial();
-					video::IMaterialRenderer* rnd =
-							driver->getMaterialRenderer(material.MaterialType);
-					bool transparent = (rnd && rnd->isTransparent());
-					// Render transparent on transparent pass and likewise.
-					if(transparent == is_transparent_pass)
-					{
-						/*
-							This *shouldn't* hurt too much because Irrlicht
-							doesn't change opengl textures if the old
-							material is set again.
-						*/
-						driver->setMaterial(buf->getMaterial());
-						driver->drawMeshBuffer(buf);
-						vertex_count += buf->getVertexCount();
-					}
+					/*
+						This *shouldn't* hurt too much because Irrlicht
+						doesn't change opengl textures if the old
+						material is set again.
+					*/
+					driver->setMaterial(buf->getMaterial());
+					driver->drawMeshBuffer(buf);
+					vertex_count += buf->getVertexCount();
 				}
 			}
-		} // foreach sectorblocks
-
-		if(sector_blocks_drawn != 0)
-		{
-			m_last_drawn_sectors[sp] = true;
 		}
-	}
+	} // foreach m_drawlist
 	
 	m_control.blocks_drawn = blocks_drawn;
 	m_control.blocks_would_have_drawn = blocks_would_have_drawn;
@@ -3899,6 +4365,31 @@ MapVoxelManipulator::~MapVoxelManipulator()
 
 void MapVoxelManipulator::emerge(VoxelArea a, s32 caller_id)
 {
+	/*
+		Light spreading calls this for the neighbors of every node it
+		visits, and the blocks are nearly always loaded already. An area
+		no larger than a block touches only the blocks of its corners,
+		and the nodes of a loaded block never have VOXELFLAG_NOT_LOADED,
+		so checking the corners is enough to skip the rest.
+	*/
+	v3s16 extent = a.getExtent();
+	if(m_area.contains(a) && extent.X <= MAP_BLOCKSIZE
+			&& extent.Y <= MAP_BLOCKSIZE && extent.Z <= MAP_BLOCKSIZE)
+	{
+		const v3s16 &p0 = a.MinEdge;
+		const v3s16 &p1 = a.MaxEdge;
+		if(((m_flags[m_area.index(p0.X,p0.Y,p0.Z)]
+				| m_flags[m_area.index(p1.X,p0.Y,p0.Z)]
+				| m_flags[m_area.index(p0.X,p1.Y,p0.Z)]
+				| m_flags[m_area.index(p1.X,p1.Y,p0.Z)]
+				| m_flags[m_area.index(p0.X,p0.Y,p1.Z)]
+				| m_flags[m_area.index(p1.X,p0.Y,p1.Z)]
+				| m_flags[m_area.index(p0.X,p1.Y,p1.Z)]
+				| m_flags[m_area.index(p1.X,p1.Y,p1.Z)])
+				& VOXELFLAG_NOT_LOADED) == 0)
+			return;
+	}
+
 	TimeTaker timer1("emerge", &emerge_time);
 
 	// Units of these are MapBlocks
@@ -152,8 +152,20 @@ class Map /*: public NodeContainer*/
 	// Returns NULL if not found
 	MapBlock * getBlockNoCreateNoEx(v3s16 p);
 	
-	// Returns InvalidPositionException if not found
+	/*
+		Returns true if something is known to keep sunlight from
+		reaching the node at p
+	*/
 	bool isNodeUnderground(v3s16 p);
+
+	/*
+		Gets the y of the highest node in the node column p2d that
+		doesn't let sunlight through. See ServerMapSector.
+		Returns false if it is not known.
+	*/
+	virtual bool getSunlightHeight(v2s16 p2d, s16 &y){ return false; }
+	// Called when the content of the node at p has been changed
+	virtual void updateSunlightHeight(v3s16 p){}
 	
 	bool isValidPosition(v3s16 p);
 	
@@ -166,6 +178,13 @@ class Map /*: public NodeContainer*/
 	// Returns a CONTENT_IGNORE node if not found
 	MapNode getNodeNoEx(v3s16 p);
 
+	/*
+		Like getNode(), but doesn't use the sector and block caches.
+		This can be called from many threads at once as long as the
+		map isn't modified at the same time.
+	*/
+	MapNode getNodeNoCache(v3s16 p);
+
 	void unspreadLight(enum LightBank bank,
 			core::map<v3s16, u8> & from_nodes,
 			core::map<v3s16, bool> & light_sources,
@@ -189,12 +208,21 @@ class Map /*: public NodeContainer*/
 	s16 propagateSunlight(v3s16 start,
 			core::map<v3s16, MapBlock*> & modified_blocks);
 	
+	/*
+		If max_blocks is not 0, sunlight is not followed further down
+		than that many blocks in total; the blocks it should still be
+		followed to are put in unfinished_blocks.
+	*/
 	void updateLighting(enum LightBank bank,
 			core::map<v3s16, MapBlock*>  & a_blocks,
-			core::map<v3s16, MapBlock*> & modified_blocks);
+			core::map<v3s16, MapBlock*> & modified_blocks,
+			u32 max_blocks=0,
+			core::map<v3s16, bool> *unfinished_blocks=NULL);
 			
 	void updateLighting(core::map<v3s16, MapBlock*>  & a_blocks,
-			core::map<v3s16, MapBlock*> & modified_blocks);
+			core::map<v3s16, MapBlock*> & modified_blocks,
+			u32 max_blocks=0,
+			core::map<v3s16, bool> *unfinished_blocks=NULL);
 			
 	/*
 		These handle lighting but not faces.
@@ -204,6 +232,32 @@ class Map /*: public NodeContainer*/
 	void removeNodeAndUpdate(v3s16 p,
 			core::map<v3s16, MapBlock*> &modified_blocks);
 
+	/*
+		These set the node right away with approximate lighting and
+		queue its block for updateQueuedLighting(), so that edits that
+		change the light of large areas don't take long.
+	*/
+	void addNodeAndQueueLighting(v3s16 p, MapNode n,
+			core::map<v3s16, MapBlock*> &modified_blocks);
+	void removeNodeAndQueueLighting(v3s16 p,
+			core::map<v3s16, MapBlock*> &modified_blocks);
+	/*
+		Updates the lighting of queued blocks, relighting at most about
+		max_blocks blocks. Sunlight that would go further down is left
+		in the queue for the next call. With max_blocks=0 all of the
+		queue is done.
+		Blocks whose light actually changed are added to modified_blocks.
+		Returns the number of blocks left in the queue.
+	*/
+	u32 updateQueuedLighting(u32 max_blocks,
+			core::map<v3s16, MapBlock*> &modified_blocks);
+	/*
+		Returns true if the lighting of the block or one of its
+		neighbors is waiting for an update, so the light of the block
+		may still change.
+	*/
+	bool isLightingQueued(v3s16 blockpos);
+
 	/*
 		Wrappers for the latter ones.
 		These emit events.
@@ -228,11 +282,36 @@ class Map /*: public NodeContainer*/
 	virtual void saveBlock(MapBlock *block){};
 
 	/*
-		Updates usage timers and unloads unused blocks and sectors.
+		Advances the usage time and unloads blocks that have not been
+		used for unload_timeout, and the least recently used ones if more
+		than max_loaded_blocks (0 = no limit) are loaded. Blocks in
+		keep_blocks are never unloaded. Sectors left empty are deleted.
 		Saves modified blocks before unloading on MAPTYPE_SERVER.
+
+		Only goes through the blocks that are unloaded, in the order of
+		last use.
 	*/
 	void timerUpdate(float dtime, float unload_timeout,
-			core::list<v3s16> *unloaded_blocks=NULL);
+			u32 max_loaded_blocks=0,
+			core::list<v3s16> *unloaded_blocks=NULL,
+			core::map<v3s16, bool> *keep_blocks=NULL);
+	
+	// Approximate number of blocks that fit in the given amount of
+	// memory; for converting a memory limit to max_loaded_blocks
+	static u32 blockCountForMemory(u32 megabytes);
+
+	/*
+		The list of loaded blocks in the order of last use.
+		MapSector links and unlinks its blocks.
+	*/
+	// Moves block to the most recently used end
+	void touchBlock(MapBlock *block);
+	void linkBlock(MapBlock *block);
+	void unlinkBlock(MapBlock *block);
+	u32 getLoadedBlockCount()
+	{
+		return m_lru_count;
+	}
 		
 	// Deletes sectors and their blocks from memory
 	// Takes cache into account
@@ -288,6 +367,19 @@ class Map /*: public NodeContainer*/
 
 	// Queued transforming water nodes
 	UniqueQueue<v3s16> m_transforming_liquid;
+
+	// Blocks waiting for a lighting update
+	core::map<v3s16, bool> m_lighting_update_queue;
+
+	/*
+		Incremented in timerUpdate(); used as the usage time of blocks.
+		A double so that small dtimes still count after a long uptime.
+	*/
+	double m_usage_time;
+	// Least recently used and most recently used loaded blocks
+	MapBlock *m_lru_first;
+	MapBlock *m_lru_last;
+	u32 m_lru_count;
 };
 
 /*
@@ -318,6 +410,13 @@ class ServerMap : public Map
 	*/
 	ServerMapSector * createSector(v2s16 p);
 
+	/*
+		Gets the ground levels of a sector for the map generator.
+		They are searched from noise only if the sector doesn't have them.
+	*/
+	void getSectorGroundLevels(ServerMapSector *sector,
+			mapgen::SectorGroundLevels &levels);
+
 	/*
 		Blocks are generated by using these and makeBlock().
 	*/
@@ -349,6 +448,9 @@ class ServerMap : public Map
 	// Helper for placing objects on ground level
 	s16 findGroundLevel(v2s16 p2d);
 
+	bool getSunlightHeight(v2s16 p2d, s16 &y);
+	void updateSunlightHeight(v3s16 p);
+
 	/*
 		Misc. helper functions for fiddling with directory and file
 		names when saving
@@ -373,9 +475,8 @@ class ServerMap : public Map
 	
 	// The sector mutex should be locked when calling most of these
 	
-	// This only saves sector-specific data such as the heightmap
-	// (no MapBlocks)
-	// DEPRECATED? Sectors have no metadata anymore.
+	// This only saves sector-specific data such as the ground levels
+	// and the sunlight heights (no MapBlocks)
 	void saveSectorMeta(ServerMapSector *sector);
 	MapSector* loadSectorMeta(std::string dirname, bool save_after_load);
 	bool loadSectorMeta(v2s16 p2d);
@@ -569,6 +670,13 @@ class ClientMap : public Map, public scene::ISceneNode
 	JMutex m_camera_mutex;
 	
 	core::map<v2s16, bool> m_last_drawn_sectors;
+
+	/*
+		Blocks that are drawn, found on the solid pass and used again
+		on the transparent pass
+	*/
+	void updateDrawList(v3f camera_position, v3f camera_direction);
+	core::array<v3s16> m_drawlist;
 };
 
 #endif
@@ -24,6 +24,96 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "light.h"
 #include <sstream>
 
+/*
+	MapBlockContents
+*/
+
+MapBlockContents::MapBlockContents()
+{
+	clear();
+}
+
+void MapBlockContents::clear()
+{
+	m_types.clear();
+	m_last_type = 0;
+	m_air_count = 0;
+	m_solid_count = 0;
+	m_liquid_count = 0;
+	m_light_source_count = 0;
+}
+
+void MapBlockContents::rebuild(MapNode *nodes, u32 count)
+{
+	clear();
+	for(u32 i=0; i<count; i++)
+		add(nodes[i].getContent());
+}
+
+void MapBlockContents::add(content_t c)
+{
+	addToKinds(c, 1);
+
+	if(m_last_type < m_types.size() && m_types[m_last_type].content == c)
+	{
+		m_types[m_last_type].count++;
+		return;
+	}
+	for(u32 i=0; i<m_types.size(); i++)
+	{
+		if(m_types[i].content == c)
+		{
+			m_types[i].count++;
+			m_last_type = i;
+			return;
+		}
+	}
+	ContentCount t;
+	t.content = c;
+	t.count = 1;
+	m_types.push_back(t);
+	m_last_type = m_types.size() - 1;
+}
+
+void MapBlockContents::remove(content_t c)
+{
+	for(u32 i=0; i<m_types.size(); i++)
+	{
+		if(m_types[i].content != c)
+			continue;
+		addToKinds(c, -1);
+		m_types[i].count--;
+		if(m_types[i].count == 0)
+			m_types.erase(i);
+		return;
+	}
+	// Not found; the counts have gone wrong somewhere
+	assert(0);
+}
+
+u32 MapBlockContents::count(content_t c) const
+{
+	for(u32 i=0; i<m_types.size(); i++)
+	{
+		if(m_types[i].content == c)
+			return m_types[i].count;
+	}
+	return 0;
+}
+
+void MapBlockContents::addToKinds(content_t c, s32 a)
+{
+	if(c == CONTENT_AIR)
+		m_air_count += a;
+	ContentFeatures &f = content_features(c);
+	if(f.walkable)
+		m_solid_count += a;
+	if(f.liquid_type != LIQUID_NONE)
+		m_liquid_count += a;
+	if(f.light_source != 0)
+		m_light_source_count += a;
+}
+
 /*
 	MapBlock
 */
@@ -38,7 +128,11 @@ MapBlock::MapBlock(Map *parent, v3s16 pos, bool dummy):
 		m_generated(false),
 		m_objects(this),
 		m_timestamp(BLOCK_TIMESTAMP_UNDEFINED),
-		m_usage_timer(0)
+		m_usage_time(0),
+		m_lru_prev(NULL),
+		m_lru_next(NULL),
+		m_lru_linked(false),
+		m_version(0)
 {
 	data = NULL;
 	if(dummy == false)
@@ -48,6 +142,7 @@ MapBlock::MapBlock(Map *parent, v3s16 pos, bool dummy):
 
 #ifndef SERVER
 	m_mesh_expired = false;
+	m_face_connectivity = FACE_CONNECTIVITY_ALL;
 	mesh_mutex.Init();
 	mesh = NULL;
 	m_temp_mods_mutex.Init();
@@ -107,7 +202,9 @@ void MapBlock::setNodeParent(v3s16 p, MapNode & n)
 	{
 		if(data == NULL)
 			throw InvalidPositionException();
-		data[p.Z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + p.Y*MAP_BLOCKSIZE + p.X] = n;
+		MapNode &n_old = data[p.Z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + p.Y*MAP_BLOCKSIZE + p.X];
+		m_contents.replace(n_old.getContent(), n.getContent());
+		n_old = n;
 	}
 }
 
@@ -239,13 +336,19 @@ bool MapBlock::propagateSunlight(core::map<v3s16, bool> & light_sources,
 #if 1
 			bool no_sunlight = false;
 			bool no_top_block = false;
+			// Check if a node above the block is known to stop sunlight
+			s16 sunlight_height;
+			bool roofed = (m_parent->getSunlightHeight(
+					v2s16(pos_relative.X + x, pos_relative.Z + z),
+					sunlight_height)
+					&& sunlight_height >= pos_relative.Y + MAP_BLOCKSIZE);
 			// Check if node above block has sunlight
 			try{
 				MapNode n = getNodeParent(v3s16(x, MAP_BLOCKSIZE, z));
 				if(n.getContent() == CONTENT_IGNORE)
 				{
-					// Trust heuristics
-					no_sunlight = is_underground;
+					// Trust sunlight heights and heuristics
+					no_sunlight = roofed || is_underground;
 				}
 				else if(n.getLight(LIGHTBANK_DAY) != LIGHT_SUN)
 				{
@@ -257,8 +360,9 @@ bool MapBlock::propagateSunlight(core::map<v3s16, bool> & light_sources,
 				no_top_block = true;
 				
 				// NOTE: This makes over-ground roofed places sunlighted
+				//       unless they are in the sunlight heights
 				// Assume sunlight, unless is_underground==true
-				if(is_underground)
+				if(is_underground || roofed)
 				{
 					no_sunlight = true;
 				}
@@ -424,6 +528,31 @@ void MapBlock::copyTo(VoxelManipulator &dst)
 			getPosRelative(), data_size);
 }
 
+void MapBlock::copyTo(VoxelManipulator &dst, const VoxelArea &area)
+{
+	v3s16 data_size(MAP_BLOCKSIZE, MAP_BLOCKSIZE, MAP_BLOCKSIZE);
+	VoxelArea data_area(v3s16(0,0,0), data_size - v3s16(1,1,1));
+	
+	// Clip area to this block
+	v3s16 relpos = getPosRelative();
+	v3s16 minp(
+		MYMAX(area.MinEdge.X, relpos.X),
+		MYMAX(area.MinEdge.Y, relpos.Y),
+		MYMAX(area.MinEdge.Z, relpos.Z)
+	);
+	v3s16 maxp(
+		MYMIN(area.MaxEdge.X, relpos.X + MAP_BLOCKSIZE - 1),
+		MYMIN(area.MaxEdge.Y, relpos.Y + MAP_BLOCKSIZE - 1),
+		MYMIN(area.MaxEdge.Z, relpos.Z + MAP_BLOCKSIZE - 1)
+	);
+	if(minp.X > maxp.X || minp.Y > maxp.Y || minp.Z > maxp.Z)
+		return;
+
+	// Copy from data to VoxelManipulator
+	dst.copyFrom(data, data_area, minp - relpos,
+			minp, maxp - minp + v3s16(1,1,1));
+}
+
 void MapBlock::copyFrom(VoxelManipulator &dst)
 {
 	v3s16 data_size(MAP_BLOCKSIZE, MAP_BLOCKSIZE, MAP_BLOCKSIZE);
@@ -432,6 +561,50 @@ void MapBlock::copyFrom(VoxelManipulator &dst)
 	// Copy from VoxelManipulator to data
 	dst.copyTo(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
+
+	m_contents.rebuild(data, MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE);
+}
+
+void MapBlock::resetUsageTimer()
+{
+	if(m_parent != NULL)
+		m_parent->touchBlock(this);
+}
+
+void MapBlock::recordChange(v3s16 p, bool remove, MapNode n,
+		u32 new_version)
+{
+	MapBlockChange change;
+	change.prev_version = m_version;
+	change.p = p;
+	change.remove = remove;
+	change.n = n;
+	m_change_journal.push_back(change);
+
+	if(m_change_journal.size() > MAPBLOCK_CHANGE_JOURNAL_SIZE)
+		m_change_journal.erase(m_change_journal.begin());
+
+	m_version = new_version;
+}
+
+bool MapBlock::getChangesSince(u32 version,
+		core::list<MapBlockChange> &dest)
+{
+	if(version == m_version)
+		return true;
+	
+	core::list<MapBlockChange>::Iterator i;
+	for(i = m_change_journal.begin(); i != m_change_journal.end(); i++)
+	{
+		if(i->prev_version == version)
+			break;
+	}
+	if(i == m_change_journal.end())
+		return false;
+	
+	for(; i != m_change_journal.end(); i++)
+		dest.push_back(*i);
+	return true;
 }
 
 void MapBlock::stepObjects(float dtime, bool server, u32 daynight_ratio)
@@ -453,6 +626,15 @@ void MapBlock::updateDayNightDiff()
 		return;
 	}
 
+	/*
+		If the whole thing is just air, it doesn't differ
+	*/
+	if(m_contents.isOnly(CONTENT_AIR))
+	{
+		m_day_night_differs = false;
+		return;
+	}
+
 	bool differs = false;
 
 	/*
@@ -468,26 +650,6 @@ void MapBlock::updateDayNightDiff()
 		}
 	}
 
-	/*
-		If some lighting values differ, check if the whole thing is
-		just air. If it is, differ = false
-	*/
-	if(differs)
-	{
-		bool only_air = true;
-		for(u32 i=0; i<MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE; i++)
-		{
-			MapNode &n = data[i];
-			if(n.getContent() != CONTENT_AIR)
-			{
-				only_air = false;
-				break;
-			}
-		}
-		if(only_air)
-			differs = false;
-	}
-
 	// Set member variable
 	m_day_night_differs = differs;
 }
@@ -522,6 +684,64 @@ s16 MapBlock::getGroundLevel(v2s16 p2d)
 	Serialization
 */
 
+/*
+	From version 11 on, the nodes of a block are stored with each
+	parameter in a separate part of the buffer, which compresses better.
+	The buffers are nodecount*3 bytes.
+*/
+static void serialize_nodes_sorted(MapNode *nodes, u8 *dest, u8 version)
+{
+	u32 nodecount = MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE;
+	for(u32 i=0; i<nodecount; i++)
+	{
+		u8 buf[3];
+		nodes[i].serialize(buf, version);
+		dest[i] = buf[0];
+		dest[i+nodecount] = buf[1];
+		dest[i+nodecount*2] = buf[2];
+	}
+}
+
+static void deSerialize_nodes_sorted(MapNode *nodes, const u8 *source,
+		u8 version)
+{
+	u32 nodecount = MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE;
+	for(u32 i=0; i<nodecount; i++)
+	{
+		u8 buf[3];
+		buf[0] = source[i];
+		buf[1] = source[i+nodecount];
+		buf[2] = source[i+nodecount*2];
+		nodes[i].deSerialize(buf, version);
+	}
+}
+
+u8 MapBlock::getSerializationFlags(u8 version)
+{
+	u8 flags = 0;
+	if(is_underground)
+		flags |= 0x01;
+	if(m_day_night_differs)
+		flags |= 0x02;
+	if(m_lighting_expired)
+		flags |= 0x04;
+	if(version >= 18)
+	{
+		if(m_generated == false)
+			flags |= 0x08;
+	}
+	return flags;
+}
+
+void MapBlock::setSerializationFlags(u8 flags, u8 version)
+{
+	is_underground = (flags & 0x01) ? true : false;
+	m_day_night_differs = (flags & 0x02) ? true : false;
+	m_lighting_expired = (flags & 0x04) ? true : false;
+	if(version >= 18)
+		m_generated = (flags & 0x08) ? false : true;
+}
+
 void MapBlock::serialize(std::ostream &os, u8 version)
 {
 	if(!ser_ver_supported(version))
@@ -592,18 +812,7 @@ void MapBlock::serialize(std::ostream &os, u8 version)
 	else
 	{
 		// First byte
-		u8 flags = 0;
-		if(is_underground)
-			flags |= 0x01;
-		if(m_day_night_differs)
-			flags |= 0x02;
-		if(m_lighting_expired)
-			flags |= 0x04;
-		if(version >= 18)
-		{
-			if(m_generated == false)
-				flags |= 0x08;
-		}
+		u8 flags = getSerializationFlags(version);
 		os.write((char*)&flags, 1);
 
 		u32 nodecount = MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE;
@@ -612,21 +821,9 @@ void MapBlock::serialize(std::ostream &os, u8 version)
 			Get data
 		*/
 
-		// Serialize nodes
-		SharedBuffer<u8> databuf_nodelist(nodecount*3);
-		for(u32 i=0; i<nodecount; i++)
-		{
-			data[i].serialize(&databuf_nodelist[i*3], version);
-		}
-		
-		// Create buffer with different parameters sorted
+		// Serialize nodes with different parameters sorted
 		SharedBuffer<u8> databuf(nodecount*3);
-		for(u32 i=0; i<nodecount; i++)
-		{
-			databuf[i] = databuf_nodelist[i*3];
-			databuf[i+nodecount] = databuf_nodelist[i*3+1];
-			databuf[i+nodecount*2] = databuf_nodelist[i*3+2];
-		}
+		serialize_nodes_sorted(data, *databuf, version);
 
 		/*
 			Compress data to output stream
@@ -701,6 +898,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version)
 						("MapBlock::deSerialize: no enough input data");
 			data[i].deSerialize(*d, version);
 		}
+		m_contents.rebuild(data, nodecount);
 	}
 	else if(version <= 10)
 	{
@@ -751,6 +949,8 @@ void MapBlock::deSerialize(std::istream &is, u8 version)
 				data[i].param2 = s[i];
 			}
 		}
+
+		m_contents.rebuild(data, nodecount);
 	}
 	// All other versions (newest)
 	else
@@ -759,11 +959,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version)
 
 		u8 flags;
 		is.read((char*)&flags, 1);
-		is_underground = (flags & 0x01) ? true : false;
-		m_day_night_differs = (flags & 0x02) ? true : false;
-		m_lighting_expired = (flags & 0x04) ? true : false;
-		if(version >= 18)
-			m_generated = (flags & 0x08) ? false : true;
+		setSerializationFlags(flags, version);
 
 		// Uncompress data
 		std::ostringstream os(std::ios_base::binary);
@@ -775,14 +971,8 @@ void MapBlock::deSerialize(std::istream &is, u8 version)
 					" other than nodecount*3");
 
 		// deserialize nodes from buffer
-		for(u32 i=0; i<nodecount; i++)
-		{
-			u8 buf[3];
-			buf[0] = s[i];
-			buf[1] = s[i+nodecount];
-			buf[2] = s[i+nodecount*2];
-			data[i].deSerialize(buf, version);
-		}
+		deSerialize_nodes_sorted(data, (const u8*)s.c_str(), version);
+		m_contents.rebuild(data, nodecount);
 		
 		/*
 			NodeMetadata
@@ -815,6 +1005,156 @@ void MapBlock::deSerialize(std::istream &is, u8 version)
 	}
 }
 
+void MapBlock::serialize(std::string &dest, u8 version,
+		ZlibCompressor &compressor)
+{
+	if(!ser_ver_supported(version))
+		throw VersionMismatchException("ERROR: MapBlock format not supported");
+	
+	if(data == NULL)
+	{
+		throw SerializationError("ERROR: Not writing dummy block.");
+	}
+
+	if(version <= 10)
+	{
+		std::ostringstream os(std::ios_base::binary);
+		serialize(os, version);
+		dest += os.str();
+		return;
+	}
+
+	// First byte
+	dest += (char)getSerializationFlags(version);
+
+	u32 nodecount = MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE;
+
+	// Serialize nodes with different parameters sorted
+	u8 databuf[MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE*3];
+	serialize_nodes_sorted(data, databuf, version);
+
+	// Compress straight to the end of dest
+	compressor.compress(databuf, nodecount*3, dest);
+
+	/*
+		NodeMetadata
+	*/
+	if(version >= 14)
+	{
+		std::ostringstream oss(std::ios_base::binary);
+		m_node_metadata.serialize(oss);
+		if(version <= 15)
+		{
+			try{
+				dest += serializeString(oss.str());
+			}
+			// This will happen if the string is longer than 65535
+			catch(SerializationError &e)
+			{
+				// Use an empty string
+				dest += serializeString("");
+			}
+		}
+		else
+		{
+			std::string s = oss.str();
+			compressor.compress((const u8*)s.c_str(), s.size(), dest);
+		}
+	}
+}
+
+void MapBlock::deSerialize(const u8 *source, u32 size, u8 version,
+		ZlibDecompressor &decompressor)
+{
+	if(!ser_ver_supported(version))
+		throw VersionMismatchException("ERROR: MapBlock format not supported");
+
+	if(version <= 10)
+	{
+		std::string s((const char*)source, size);
+		std::istringstream is(s, std::ios_base::binary);
+		deSerialize(is, version);
+		return;
+	}
+
+	// These have no "generated" field
+	if(version < 18)
+	{
+		m_generated = true;
+	}
+
+	u32 nodecount = MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE;
+
+	if(size < 1)
+		throw SerializationError
+				("MapBlock::deSerialize: no enough input data");
+	setSerializationFlags(source[0], version);
+	u32 pos = 1;
+
+	// Inflate the nodes without copying the input
+	u8 databuf[MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE*3];
+	u32 datalen = 0;
+	pos += decompressor.decompress(&source[pos], size - pos,
+			databuf, nodecount*3, &datalen);
+	if(datalen != nodecount*3)
+		throw SerializationError
+				("MapBlock::deSerialize: decompress resulted in size"
+				" other than nodecount*3");
+
+	deSerialize_nodes_sorted(data, databuf, version);
+	m_contents.rebuild(data, nodecount);
+
+	/*
+		NodeMetadata
+	*/
+	if(version >= 14)
+	{
+		// Ignore errors
+		try{
+			std::string s;
+			if(version <= 15)
+			{
+				if(size - pos < 2)
+					throw SerializationError
+							("MapBlock::deSerialize: no enough input data");
+				u16 len = readU16(&source[pos]);
+				pos += 2;
+				if(size - pos < len)
+					throw SerializationError
+							("MapBlock::deSerialize: no enough input data");
+				s.assign((const char*)&source[pos], len);
+				pos += len;
+			}
+			else
+			{
+				pos += decompressor.decompress(&source[pos], size - pos, s);
+			}
+			std::istringstream iss(s, std::ios_base::binary);
+			m_node_metadata.deSerialize(iss);
+		}
+		catch(SerializationError &e)
+		{
+			dstream<<"WARNING: MapBlock::deSerialize(): Ignoring an error"
+					<<" while deserializing node metadata"<<std::endl;
+		}
+	}
+}
+
+void MapBlock::takeContents(MapBlock *other)
+{
+	MapNode *olddata = data;
+	data = other->data;
+	other->data = olddata;
+
+	is_underground = other->is_underground;
+	m_lighting_expired = other->m_lighting_expired;
+	m_day_night_differs = other->m_day_night_differs;
+	m_generated = other->m_generated;
+	m_contents = other->m_contents;
+
+	m_node_metadata.takeFrom(other->m_node_metadata);
+}
+
 void MapBlock::serializeDiskExtra(std::ostream &os, u8 version)
 {
 	// Versions up from 9 have block objects.
@@ -935,34 +1275,16 @@ std::string analyze_block(MapBlock *block)
 		const content_t content_leaves = 0x802;
 		const content_t content_jungletree = 0x815;
 
-		bool full_ignore = true;
-		bool some_ignore = false;
-		bool full_air = true;
-		bool some_air = false;
-		bool trees = false;
-		bool water = false;
-		for(s16 z0=0; z0<MAP_BLOCKSIZE; z0++)
-		for(s16 y0=0; y0<MAP_BLOCKSIZE; y0++)
-		for(s16 x0=0; x0<MAP_BLOCKSIZE; x0++)
-		{
-			v3s16 p(x0,y0,z0);
-			MapNode n = block->getNode(p);
-			content_t c = n.getContent();
-			if(c == CONTENT_IGNORE)
-				some_ignore = true;
-			else
-				full_ignore = false;
-			if(c == CONTENT_AIR)
-				some_air = true;
-			else
-				full_air = false;
-			if(c == content_tree || c == content_jungletree
-					|| c == content_leaves)
-				trees = true;
-			if(c == content_water
-					|| c == content_watersource)
-				water = true;
-		}
+		const MapBlockContents &contents = block->getContents();
+		bool full_ignore = contents.isOnly(CONTENT_IGNORE);
+		bool some_ignore = contents.contains(CONTENT_IGNORE);
+		bool full_air = contents.isOnly(CONTENT_AIR);
+		bool some_air = contents.contains(CONTENT_AIR);
+		bool trees = (contents.contains(content_tree)
+				|| contents.contains(content_jungletree)
+				|| contents.contains(content_leaves));
+		bool water = (contents.contains(content_water)
+				|| contents.contains(content_watersource));
 		
 		desc<<"content {";
 		
@@ -36,6 +36,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapblock_nodemod.h"
 #ifndef SERVER
 	#include "mapblock_mesh.h"
+	#include "mapblock_visibility.h"
 #endif
 
 class Map;
@@ -112,6 +113,113 @@ class NodeContainer
 };
 #endif
 
+/*
+	A node addition or removal recorded in the change journal of a
+	block, for updating clients that have an older version of it.
+	The position can be outside the block if the change modified the
+	block through lighting.
+*/
+struct MapBlockChange
+{
+	// Version of the block before the change
+	u32 prev_version;
+	// Absolute node position
+	v3s16 p;
+	bool remove;
+	// The added node
+	MapNode n;
+};
+
+// Maximum number of changes remembered per block
+#define MAPBLOCK_CHANGE_JOURNAL_SIZE 32
+
+/*
+	Summary of what a block contains, kept up to date as nodes are
+	set, so that questions about the whole block can be answered
+	without going through all of its nodes.
+
+	Blocks have only a few different contents, so they are kept in
+	a short list with the number of nodes of each.
+*/
+class MapBlockContents
+{
+public:
+	MapBlockContents();
+
+	void clear();
+	// Replaces everything with the contents of nodes
+	void rebuild(MapNode *nodes, u32 count);
+	// Called when a node of content old is replaced by one of content c
+	void replace(content_t old, content_t c)
+	{
+		if(old == c)
+			return;
+		remove(old);
+		add(c);
+	}
+	void add(content_t c);
+	void remove(content_t c);
+
+	// Number of nodes of the content
+	u32 count(content_t c) const;
+	bool contains(content_t c) const
+	{
+		return count(c) != 0;
+	}
+	// Number of different contents
+	u32 getTypeCount() const
+	{
+		return m_types.size();
+	}
+	// True if all nodes have the same content
+	bool isUniform() const
+	{
+		return m_types.size() == 1;
+	}
+	// True if all nodes are of the content
+	bool isOnly(content_t c) const
+	{
+		return isUniform() && m_types[0].content == c;
+	}
+
+	u32 getAirCount() const
+	{
+		return m_air_count;
+	}
+	// Walkable nodes
+	u32 getSolidCount() const
+	{
+		return m_solid_count;
+	}
+	u32 getLiquidCount() const
+	{
+		return m_liquid_count;
+	}
+	u32 getLightSourceCount() const
+	{
+		return m_light_source_count;
+	}
+
+private:
+	struct ContentCount
+	{
+		content_t content;
+		u32 count;
+	};
+
+	// Adds a to the counts of the kinds of content c is
+	void addToKinds(content_t c, s32 a);
+
+	core::array<ContentCount> m_types;
+	// Index in m_types that was used last; nodes come in runs
+	u32 m_last_type;
+
+	u32 m_air_count;
+	u32 m_solid_count;
+	u32 m_liquid_count;
+	u32 m_light_source_count;
+};
+
 /*
 	MapBlock itself
 */
@@ -142,6 +250,7 @@ class MapBlock /*: public NodeContainer*/
 			//data[i] = MapNode();
 			data[i] = MapNode(CONTENT_IGNORE);
 		}
+		m_contents.rebuild(data, l);
 		raiseModified(MOD_STATE_WRITE_NEEDED);
 	}
 
@@ -221,6 +330,20 @@ class MapBlock /*: public NodeContainer*/
 	{
 		return m_mesh_expired;
 	}
+
+	/*
+		Which faces of the block can be seen from each other; see
+		mapblock_visibility.h. Found with the mesh.
+	*/
+	void setFaceConnectivity(u16 connectivity)
+	{
+		m_face_connectivity = connectivity;
+	}
+
+	u16 getFaceConnectivity()
+	{
+		return m_face_connectivity;
+	}
 #endif
 
 	void setLightingExpired(bool expired)
@@ -318,7 +441,9 @@ class MapBlock /*: public NodeContainer*/
 		if(x < 0 || x >= MAP_BLOCKSIZE) throw InvalidPositionException();
 		if(y < 0 || y >= MAP_BLOCKSIZE) throw InvalidPositionException();
 		if(z < 0 || z >= MAP_BLOCKSIZE) throw InvalidPositionException();
-		data[z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + y*MAP_BLOCKSIZE + x] = n;
+		MapNode &n_old = data[z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + y*MAP_BLOCKSIZE + x];
+		m_contents.replace(n_old.getContent(), n.getContent());
+		n_old = n;
 		raiseModified(MOD_STATE_WRITE_NEEDED);
 	}
 	
@@ -347,7 +472,9 @@ class MapBlock /*: public NodeContainer*/
 	{
 		if(data == NULL)
 			throw InvalidPositionException();
-		data[z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + y*MAP_BLOCKSIZE + x] = n;
+		MapNode &n_old = data[z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + y*MAP_BLOCKSIZE + x];
+		m_contents.replace(n_old.getContent(), n.getContent());
+		n_old = n;
 		raiseModified(MOD_STATE_WRITE_NEEDED);
 	}
 	
@@ -416,6 +543,9 @@ class MapBlock /*: public NodeContainer*/
 	
 	// Copies data to VoxelManipulator to getPosRelative()
 	void copyTo(VoxelManipulator &dst);
+	// Copies the part of data that is inside area (in absolute node
+	// coordinates) to VoxelManipulator
+	void copyTo(VoxelManipulator &dst, const VoxelArea &area);
 	// Copies data from VoxelManipulator getPosRelative()
 	void copyFrom(VoxelManipulator &dst);
 
@@ -542,6 +672,14 @@ class MapBlock /*: public NodeContainer*/
 		return m_day_night_differs;
 	}
 
+	/*
+		What the block contains. Empty for dummy blocks.
+	*/
+	const MapBlockContents & getContents()
+	{
+		return m_contents;
+	}
+
 	/*
 		Miscellaneous stuff
 	*/
@@ -575,20 +713,38 @@ class MapBlock /*: public NodeContainer*/
 	}
 	
 	/*
-		See m_usage_timer
+		Marks the block as used now; moves it to the most recently used
+		end of the parent map's block list. See m_usage_time.
 	*/
-	void resetUsageTimer()
+	void resetUsageTimer();
+	double getUsageTime()
 	{
-		m_usage_timer = 0;
+		return m_usage_time;
 	}
-	void incrementUsageTimer(float dtime)
+
+	/*
+		Change journal (server only)
+
+		The version is changed every time a change is recorded. It is
+		assigned by the server and is unique among all the blocks the
+		server has had in memory, so a version held by a client never
+		matches another instance of the block. 0 = not assigned.
+	*/
+	u32 getVersion()
 	{
-		m_usage_timer += dtime;
+		return m_version;
 	}
-	u32 getUsageTimer()
+	void setVersion(u32 version)
 	{
-		return m_usage_timer;
+		m_version = version;
 	}
+	// p has to be a node of this block
+	void recordChange(v3s16 p, bool remove, MapNode n, u32 new_version);
+	/*
+		Gets the changes made after the given version, in order.
+		Returns false if the journal doesn't reach that far back.
+	*/
+	bool getChangesSince(u32 version, core::list<MapBlockChange> &dest);
 
 	/*
 		Serialization
@@ -600,12 +756,31 @@ class MapBlock /*: public NodeContainer*/
 	// Used after the basic ones when writing on disk (serverside)
 	void serializeDiskExtra(std::ostream &os, u8 version);
 	void deSerializeDiskExtra(std::istream &is, u8 version);
+	/*
+		These work on memory directly and are used for sending blocks
+		over the network. serialize() appends to dest. Versions older
+		than 11 go through the stream ones.
+	*/
+	void serialize(std::string &dest, u8 version,
+			ZlibCompressor &compressor);
+	void deSerialize(const u8 *source, u32 size, u8 version,
+			ZlibDecompressor &decompressor);
+	/*
+		Takes the nodes, flags and node metadata of a block that has
+		been deserialized separately, eg. in another thread.
+		other is left with undefined contents.
+	*/
+	void takeContents(MapBlock *other);
 
 private:
 	/*
 		Private methods
 	*/
 
+	// Flags byte of the serialization formats from version 11 on
+	u8 getSerializationFlags(u8 version);
+	void setSerializationFlags(u8 flags, u8 version);
+
 	/*
 		Used only internally, because changes can't be tracked
 	*/
@@ -653,6 +828,9 @@ class MapBlock /*: public NodeContainer*/
 	*/
 	MapNode * data;
 
+	// Kept up to date with data
+	MapBlockContents m_contents;
+
 	/*
 		- On the server, this is used for telling whether the
 		  block has been modified from the one on disk.
@@ -694,6 +872,9 @@ class MapBlock /*: public NodeContainer*/
 		In practice this is set when the day/night lighting switches.
 	*/
 	bool m_mesh_expired;
+
+	// Until the mesh has been made, the block is taken to be seen through
+	u16 m_face_connectivity;
 	
 	// Temporary modifications to nodes
 	// These are only used when drawing
@@ -708,10 +889,25 @@ class MapBlock /*: public NodeContainer*/
 	u32 m_timestamp;
 
 	/*
-		When the block is accessed, this is set to 0.
-		Map will unload the block when this reaches a timeout.
+		When the block is accessed, this is set to the map's time.
+		Map will unload the block when it hasn't been used for a timeout,
+		or earlier if too many blocks are loaded.
+	*/
+	double m_usage_time;
+
+	/*
+		Links in the parent map's list of loaded blocks, which is kept
+		in the order of last use. Handled by Map.
 	*/
-	float m_usage_timer;
+	MapBlock *m_lru_prev;
+	MapBlock *m_lru_next;
+	bool m_lru_linked;
+	friend class Map;
+
+	// See getVersion()
+	u32 m_version;
+	// Latest changes, oldest first
+	core::list<MapBlockChange> m_change_journal;
 };
 
 inline bool blockpos_over_limit(v3s16 p)
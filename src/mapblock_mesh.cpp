@@ -37,15 +37,23 @@ void MeshMakeData::fill(u32 daynight_ratio, MapBlock *block)
 	*/
 	m_temp_mods.clear();
 	block->copyTempMods(m_temp_mods);
+
+	m_air_only = block->getContents().isOnly(CONTENT_AIR);
 	
 	/*
 		Copy data
 	*/
 
-	// Allocate this block + neighbors
+	/*
+		Allocate this block + the one node thick layers of the
+		neighbors that touch it. The mesh generator never looks
+		further than that, so there's no need to copy the whole
+		neighbor blocks.
+	*/
+	VoxelArea area(blockpos_nodes-v3s16(1,1,1),
+			blockpos_nodes+v3s16(1,1,1)*MAP_BLOCKSIZE);
 	m_vmanip.clear();
-	m_vmanip.addArea(VoxelArea(blockpos_nodes-v3s16(1,1,1)*MAP_BLOCKSIZE,
-			blockpos_nodes+v3s16(1,1,1)*MAP_BLOCKSIZE*2-v3s16(1,1,1)));
+	m_vmanip.addArea(area);
 
 	{
 		//TimeTaker timer("copy central block data");
@@ -59,8 +67,8 @@ void MeshMakeData::fill(u32 daynight_ratio, MapBlock *block)
 		// 0ms
 
 		/*
-			Copy neighbors. This is lightning fast.
-			Copying only the borders would be *very* slow.
+			Copy the borders of the neighbors.
+			Diagonal neighbors are left as CONTENT_IGNORE, as before.
 		*/
 		
 		// Get map
@@ -72,7 +80,16 @@ void MeshMakeData::fill(u32 daynight_ratio, MapBlock *block)
 			v3s16 bp = m_blockpos + dir;
 			MapBlock *b = map->getBlockNoCreateNoEx(bp);
 			if(b)
-				b->copyTo(m_vmanip);
+				b->copyTo(m_vmanip, area);
+
+			/*
+				The block includes the faces towards its neighbors
+				in the positive directions. Missing neighbors are
+				CONTENT_IGNORE, which doesn't make faces.
+			*/
+			if(dir.X + dir.Y + dir.Z > 0 && b != NULL
+					&& b->getContents().isOnly(CONTENT_AIR) == false)
+				m_air_only = false;
 		}
 	}
 }
@@ -609,6 +626,10 @@ scene::SMesh* makeMapBlockMesh(MeshMakeData *data)
 	// 24-155ms for MAP_BLOCKSIZE=32
 	//TimeTaker timer1("makeMapBlockMesh()");
 
+	// Air makes no faces against air
+	if(data->m_air_only)
+		return NULL;
+
 	core::array<FastFace> fastfaces_new;
 
 	v3s16 blockpos_nodes = data->m_blockpos*MAP_BLOCKSIZE;
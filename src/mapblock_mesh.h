@@ -132,6 +132,11 @@ struct MeshMakeData
 	NodeModMap m_temp_mods;
 	VoxelManipulator m_vmanip;
 	v3s16 m_blockpos;
+	/*
+		True if the block and its neighbors in the directions whose
+		faces the block includes are all air, so it has no mesh
+	*/
+	bool m_air_only;
 	
 	/*
 		Copy central data directly from block, and other data from
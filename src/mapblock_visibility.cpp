@@ -0,0 +1,244 @@
+/*
+Minetest-c55
+Copyright (C) 2010-2011 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "mapblock_visibility.h"
+#include "voxel.h"
+#include "mapblock.h"
+#include "utility.h"
+
+/*
+	Bit of the pair of faces a and b. The pairs are numbered
+	(0,1), (0,2)...(0,5), (1,2)...(4,5).
+*/
+static u16 face_pair_bit(u16 a, u16 b)
+{
+	if(a > b)
+	{
+		u16 t = a;
+		a = b;
+		b = t;
+	}
+	return 1 << (a*6 - a*(a+1)/2 + (b-a-1));
+}
+
+bool faces_connected(u16 connectivity, u16 a, u16 b)
+{
+	if(a == b)
+		return true;
+	return (connectivity & face_pair_bit(a, b)) != 0;
+}
+
+/*
+	Nodes that can be seen through. Unknown nodes are taken to be, so
+	that nothing is hidden behind them by mistake.
+*/
+static bool lets_sight_through(VoxelManipulator &vmanip, v3s16 p)
+{
+	if(vmanip.m_area.contains(p) == false)
+		return true;
+	s32 i = vmanip.m_area.index(p);
+	if(vmanip.m_flags[i] & (VOXELFLAG_NOT_LOADED|VOXELFLAG_INEXISTENT))
+		return true;
+	MapNode &n = vmanip.m_data[i];
+	return n.getContent() == CONTENT_IGNORE
+			|| content_features(n).solidness != 2;
+}
+
+// Faces of the block that the node at relative position p is on
+static u8 get_node_faces(v3s16 p)
+{
+	u8 faces = 0;
+	for(u16 i=0; i<6; i++)
+	{
+		const v3s16 &dir = g_6dirs[i];
+		if((dir.X == 1 && p.X == MAP_BLOCKSIZE-1) || (dir.X == -1 && p.X == 0)
+		|| (dir.Y == 1 && p.Y == MAP_BLOCKSIZE-1) || (dir.Y == -1 && p.Y == 0)
+		|| (dir.Z == 1 && p.Z == MAP_BLOCKSIZE-1) || (dir.Z == -1 && p.Z == 0))
+			faces |= 1 << i;
+	}
+	return faces;
+}
+
+u16 get_face_connectivity(VoxelManipulator &vmanip, v3s16 blockpos)
+{
+	const u32 nodecount = MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE;
+	v3s16 blockpos_nodes = blockpos * MAP_BLOCKSIZE;
+
+	/*
+		Nodes that can be seen through and haven't been reached yet
+		are marked open; they are indexed like in MapBlock.
+	*/
+	bool open[nodecount];
+	for(s16 z=0; z<MAP_BLOCKSIZE; z++)
+	for(s16 y=0; y<MAP_BLOCKSIZE; y++)
+	for(s16 x=0; x<MAP_BLOCKSIZE; x++)
+	{
+		open[z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + y*MAP_BLOCKSIZE + x] =
+				lets_sight_through(vmanip, blockpos_nodes + v3s16(x,y,z));
+	}
+
+	u16 connectivity = 0;
+	u16 stack[nodecount];
+
+	for(u32 i=0; i<nodecount; i++)
+	{
+		if(open[i] == false)
+			continue;
+
+		/*
+			Go through the open space the node is in and find out
+			which faces it touches
+		*/
+		u8 faces = 0;
+		u32 stack_size = 0;
+		stack[stack_size++] = i;
+		open[i] = false;
+		while(stack_size > 0)
+		{
+			u16 j = stack[--stack_size];
+			v3s16 p(j % MAP_BLOCKSIZE,
+					(j / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+					j / (MAP_BLOCKSIZE*MAP_BLOCKSIZE));
+			u8 node_faces = get_node_faces(p);
+			faces |= node_faces;
+			for(u16 k=0; k<6; k++)
+			{
+				// Neighbors outside the block are not in the space
+				if(node_faces & (1 << k))
+					continue;
+				v3s16 p2 = p + g_6dirs[k];
+				u16 j2 = p2.Z*MAP_BLOCKSIZE*MAP_BLOCKSIZE
+						+ p2.Y*MAP_BLOCKSIZE + p2.X;
+				if(open[j2] == false)
+					continue;
+				open[j2] = false;
+				stack[stack_size++] = j2;
+			}
+		}
+
+		// All the faces it touches can be seen from each other
+		for(u16 a=0; a<6; a++)
+		for(u16 b=a+1; b<6; b++)
+		{
+			if((faces & (1 << a)) && (faces & (1 << b)))
+				connectivity |= face_pair_bit(a, b);
+		}
+
+		if(connectivity == FACE_CONNECTIVITY_ALL)
+			break;
+	}
+
+	return connectivity;
+}
+
+struct VisibilityStep
+{
+	v3s16 p;
+	// Face of the block it was entered from; 6 = block of the camera
+	u16 entered_from;
+	// Face connectivity of the block
+	u16 connectivity;
+	// Directions gone to from the block of the camera
+	u8 dirs;
+};
+
+void find_visible_blocks(BlockConnectivitySource *source,
+		v3f camera_pos, v3f camera_dir, f32 range,
+		core::array<v3s16> &dest)
+{
+	v3s16 camera_block = getNodeBlockPos(floatToInt(camera_pos, BS));
+
+	/*
+		The faces each block has been entered from. A block can be
+		entered again from a different face, because something else
+		can be seen through it from there.
+	*/
+	core::map<v3s16, u8> entered;
+	entered.insert(camera_block, 0);
+	u16 camera_block_connectivity;
+	if(source->getFaceConnectivity(camera_block, camera_block_connectivity))
+		dest.push_back(camera_block);
+
+	core::list<VisibilityStep> queue;
+	VisibilityStep first;
+	first.p = camera_block;
+	first.entered_from = 6;
+	// Everything can be seen from the camera in its block
+	first.connectivity = FACE_CONNECTIVITY_ALL;
+	first.dirs = 0;
+	queue.push_back(first);
+
+	while(queue.size() > 0)
+	{
+		VisibilityStep step = *queue.begin();
+		queue.erase(queue.begin());
+
+		for(u16 i=0; i<6; i++)
+		{
+			u16 opposite = (i + 3) % 6;
+
+			// Only go away from the camera
+			if(step.dirs & (1 << opposite))
+				continue;
+
+			if(step.entered_from != 6 && faces_connected(
+					step.connectivity, step.entered_from, i) == false)
+				continue;
+
+			v3s16 p = step.p + g_6dirs[i];
+			u16 connectivity;
+
+			core::map<v3s16, u8>::Node *n = entered.find(p);
+			if(n != NULL)
+			{
+				if(n->getValue() & (1 << opposite))
+					continue;
+				n->setValue(n->getValue() | (1 << opposite));
+				if(source->getFaceConnectivity(p, connectivity) == false)
+					connectivity = FACE_CONNECTIVITY_ALL;
+			}
+			else
+			{
+				// Blocks out of sight are not looked at again
+				if(isBlockInSight(p, camera_pos, camera_dir, range) == false)
+				{
+					entered.insert(p, 0x3f);
+					continue;
+				}
+				entered.insert(p, 1 << opposite);
+				/*
+					Blocks that are not loaded are seen through. The
+					server doesn't send blocks of open air far away.
+				*/
+				if(source->getFaceConnectivity(p, connectivity))
+					dest.push_back(p);
+				else
+					connectivity = FACE_CONNECTIVITY_ALL;
+			}
+
+			VisibilityStep next;
+			next.p = p;
+			next.entered_from = opposite;
+			next.connectivity = connectivity;
+			next.dirs = step.dirs | (1 << i);
+			queue.push_back(next);
+		}
+	}
+}
+
@@ -0,0 +1,72 @@
+/*
+Minetest-c55
+Copyright (C) 2010-2011 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef MAPBLOCK_VISIBILITY_HEADER
+#define MAPBLOCK_VISIBILITY_HEADER
+
+#include "common_irrlicht.h"
+
+class VoxelManipulator;
+
+/*
+	Face connectivity of a block tells which faces of the block can be
+	seen from each other through the nodes in the block. There is a bit
+	for each pair of faces; the faces are numbered like g_6dirs.
+*/
+
+// All faces can be seen from each other, eg. the block is all air
+#define FACE_CONNECTIVITY_ALL 0x7fff
+
+// Returns true if face a can be seen from face b
+bool faces_connected(u16 connectivity, u16 a, u16 b);
+
+/*
+	Finds the face connectivity of the block at blockpos, whose nodes
+	are in vmanip. Nodes that are not known are taken to be seen through.
+*/
+u16 get_face_connectivity(VoxelManipulator &vmanip, v3s16 blockpos);
+
+class BlockConnectivitySource
+{
+public:
+	virtual ~BlockConnectivitySource(){}
+	// Returns false if the block is not loaded
+	virtual bool getFaceConnectivity(v3s16 blockpos, u16 &connectivity) = 0;
+};
+
+/*
+	Finds the blocks that can be seen from the camera within range
+	(in nodes, like isBlockInSight()).
+
+	Starting from the block of the camera, goes to the neighbors of
+	the blocks through faces that can be seen from the face the block
+	was entered from, only ever going away from the camera. Blocks
+	that are behind solid ground, like caves, are not reached. Blocks
+	that are not loaded are seen through, because the server doesn't
+	send far away blocks of open air.
+
+	The amount of work depends on the number of blocks in sight.
+	Only loaded blocks are added to dest, roughly nearest first.
+*/
+void find_visible_blocks(BlockConnectivitySource *source,
+		v3f camera_pos, v3f camera_dir, f32 range,
+		core::array<v3s16> &dest);
+
+#endif
+
@@ -80,12 +80,13 @@ static s16 find_ground_level_clever(VoxelManipulator &vmanip, v2s16 p2d)
 }
 #endif
 
-static void make_tree(VoxelManipulator &vmanip, v3s16 p0)
+static void make_tree(VoxelManipulator &vmanip, v3s16 p0,
+		PseudoRandom &random)
 {
 	MapNode treenode(CONTENT_TREE);
 	MapNode leavesnode(CONTENT_LEAVES);
 
-	s16 trunk_h = myrand_range(4, 5);
+	s16 trunk_h = random.range(4, 5);
 	v3s16 p1 = p0;
 	for(s16 ii=0; ii<trunk_h; ii++)
 	{
@@ -120,9 +121,9 @@ static void make_tree(VoxelManipulator &vmanip, v3s16 p0)
 		s16 d = 1;
 
 		v3s16 p(
-			myrand_range(leaves_a.MinEdge.X, leaves_a.MaxEdge.X-d),
-			myrand_range(leaves_a.MinEdge.Y, leaves_a.MaxEdge.Y-d),
-			myrand_range(leaves_a.MinEdge.Z, leaves_a.MaxEdge.Z-d)
+			random.range(leaves_a.MinEdge.X, leaves_a.MaxEdge.X-d),
+			random.range(leaves_a.MinEdge.Y, leaves_a.MaxEdge.Y-d),
+			random.range(leaves_a.MinEdge.Z, leaves_a.MaxEdge.Z-d)
 		);
 
 		for(s16 z=0; z<=d; z++)
@@ -152,7 +153,8 @@ static void make_tree(VoxelManipulator &vmanip, v3s16 p0)
 	}
 }
 
-static void make_jungletree(VoxelManipulator &vmanip, v3s16 p0)
+static void make_jungletree(VoxelManipulator &vmanip, v3s16 p0,
+		PseudoRandom &random)
 {
 	MapNode treenode(CONTENT_JUNGLETREE);
 	MapNode leavesnode(CONTENT_LEAVES);
@@ -160,7 +162,7 @@ static void make_jungletree(VoxelManipulator &vmanip, v3s16 p0)
 	for(s16 x=-1; x<=1; x++)
 	for(s16 z=-1; z<=1; z++)
 	{
-		if(myrand_range(0, 2) == 0)
+		if(random.range(0, 2) == 0)
 			continue;
 		v3s16 p1 = p0 + v3s16(x,0,z);
 		v3s16 p2 = p0 + v3s16(x,-1,z);
@@ -171,7 +173,7 @@ static void make_jungletree(VoxelManipulator &vmanip, v3s16 p0)
 			vmanip.m_data[vmanip.m_area.index(p1)] = treenode;
 	}
 
-	s16 trunk_h = myrand_range(8, 12);
+	s16 trunk_h = random.range(8, 12);
 	v3s16 p1 = p0;
 	for(s16 ii=0; ii<trunk_h; ii++)
 	{
@@ -206,9 +208,9 @@ static void make_jungletree(VoxelManipulator &vmanip, v3s16 p0)
 		s16 d = 1;
 
 		v3s16 p(
-			myrand_range(leaves_a.MinEdge.X, leaves_a.MaxEdge.X-d),
-			myrand_range(leaves_a.MinEdge.Y, leaves_a.MaxEdge.Y-d),
-			myrand_range(leaves_a.MinEdge.Z, leaves_a.MaxEdge.Z-d)
+			random.range(leaves_a.MinEdge.X, leaves_a.MaxEdge.X-d),
+			random.range(leaves_a.MinEdge.Y, leaves_a.MaxEdge.Y-d),
+			random.range(leaves_a.MinEdge.Z, leaves_a.MaxEdge.Z-d)
 		);
 
 		for(s16 z=0; z<=d; z++)
@@ -238,11 +240,12 @@ static void make_jungletree(VoxelManipulator &vmanip, v3s16 p0)
 	}
 }
 
-void make_papyrus(VoxelManipulator &vmanip, v3s16 p0)
+void make_papyrus(VoxelManipulator &vmanip, v3s16 p0,
+		PseudoRandom &random)
 {
 	MapNode papyrusnode(CONTENT_PAPYRUS);
 
-	s16 trunk_h = myrand_range(2, 3);
+	s16 trunk_h = random.range(2, 3);
 	v3s16 p1 = p0;
 	for(s16 ii=0; ii<trunk_h; ii++)
 	{
@@ -1081,29 +1084,58 @@ bool is_cave(u64 seed, v3s16 p)
 }
 
 /*
-	Ground density noise shall be interpreted by using this.
+	The part of the ground density that depends only on X and Z.
+	It takes two 2D perlin noises, so it is calculated once for a
+	whole column of nodes.
+*/
+struct GroundColumn
+{
+	// Scale of the density noise
+	double f;
+	// Height that the density noise is relative to
+	double h;
+
+	GroundColumn():
+		f(1),
+		h(0)
+	{
+	}
+
+	GroundColumn(u64 seed, v2s16 p2d)
+	{
+		f = 0.55 + noise2d_perlin(
+				0.5+(float)p2d.X/250, 0.5+(float)p2d.Y/250,
+				seed+920381, 3, 0.45);
+		if(f < 0.01)
+			f = 0.01;
+		else if(f >= 1.0)
+			f *= 1.6;
+		h = WATER_LEVEL + 10 * noise2d_perlin(
+				0.5+(float)p2d.X/250, 0.5+(float)p2d.Y/250,
+				seed+84174, 4, 0.5);
+	}
 
-	TODO: No perlin noises here, they should be outsourced
-	      and buffered
-		  NOTE: The speed of these actually isn't terrible
+	bool isGround(double ground_noise1_val, s16 y) const
+	{
+		return ((double)y - h < ground_noise1_val * f);
+	}
+};
+
+/*
+	Ground density noise shall be interpreted by using this.
 */
 bool val_is_ground(double ground_noise1_val, v3s16 p, u64 seed)
 {
 	//return ((double)p.Y < ground_noise1_val);
 
-	double f = 0.55 + noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+920381, 3, 0.45);
-	if(f < 0.01)
-		f = 0.01;
-	else if(f >= 1.0)
-		f *= 1.6;
-	double h = WATER_LEVEL + 10 * noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+84174, 4, 0.5);
-	/*double f = 1;
-	double h = 0;*/
-	return ((double)p.Y - h < ground_noise1_val * f);
+	return GroundColumn(seed, v2s16(p.X, p.Z)).isGround(
+			ground_noise1_val, p.Y);
+}
+
+static bool is_ground(u64 seed, const GroundColumn &column, v3s16 p)
+{
+	double val1 = noise3d_param(get_ground_noise1_params(seed), p.X,p.Y,p.Z);
+	return column.isGround(val1, p.Y);
 }
 
 /*
@@ -1111,8 +1143,7 @@ bool val_is_ground(double ground_noise1_val, v3s16 p, u64 seed)
 */
 bool is_ground(u64 seed, v3s16 p)
 {
-	double val1 = noise3d_param(get_ground_noise1_params(seed), p.X,p.Y,p.Z);
-	return val_is_ground(val1, p, seed);
+	return is_ground(seed, GroundColumn(seed, v2s16(p.X, p.Z)), p);
 }
 
 // Amount of trees per area in nodes
@@ -1176,9 +1207,13 @@ double largestone_amount_2d(u64 seed, v2s16 p)
 s16 find_ground_level_from_noise(u64 seed, v2s16 p2d, s16 precision)
 {
 	// Start a bit fuzzy to make averaging lower precision values
-	// more useful
-	s16 level = myrand_range(-precision/2, precision/2);
+	// more useful. The fuzz depends only on the position, so that
+	// the result is the same in any thread.
+	PseudoRandom random((s32)(seed%0x100000000ULL)
+			+ p2d.X*73856093 + p2d.Y*19349663);
+	s16 level = random.range(-precision/2, precision/2);
 	s16 dec[] = {31000, 100, 20, 4, 1, 0};
+	GroundColumn column(seed, p2d);
 	s16 i;
 	for(i = 1; dec[i] != 0 && precision <= dec[i]; i++)
 	{
@@ -1189,7 +1224,7 @@ s16 find_ground_level_from_noise(u64 seed, v2s16 p2d, s16 precision)
 			v3s16 p(p2d.X, level, p2d.Y);
 			for(; p.Y < max; p.Y += dec[i])
 			{
-				if(!is_ground(seed, p))
+				if(!is_ground(seed, column, p))
 				{
 					level = p.Y;
 					break;
@@ -1203,7 +1238,7 @@ s16 find_ground_level_from_noise(u64 seed, v2s16 p2d, s16 precision)
 			v3s16 p(p2d.X, level, p2d.Y);
 			for(; p.Y>min; p.Y-=dec[i])
 			{
-				bool ground = is_ground(seed, p);
+				bool ground = is_ground(seed, column, p);
 				/*if(dec[i] == 1 && is_cave(seed, p))
 					ground = false;*/
 				if(ground)
@@ -1304,11 +1339,24 @@ double get_sector_minimum_ground_level(u64 seed, v2s16 sectorpos, double p)
 	return a;
 }
 
+void find_sector_ground_levels(u64 seed, v2s16 sectorpos,
+		SectorGroundLevels &levels)
+{
+	levels.average = (s16)get_sector_average_ground_level(seed, sectorpos);
+	levels.minimum = (s16)get_sector_minimum_ground_level(seed, sectorpos);
+	levels.maximum = (s16)get_sector_maximum_ground_level(seed, sectorpos, 1);
+}
+
 bool block_is_underground(u64 seed, v3s16 blockpos)
 {
 	s16 minimum_groundlevel = (s16)get_sector_minimum_ground_level(
 			seed, v2s16(blockpos.X, blockpos.Z));
 	
+	return block_is_underground(minimum_groundlevel, blockpos);
+}
+
+bool block_is_underground(s16 minimum_groundlevel, v3s16 blockpos)
+{
 	if(blockpos.Y*MAP_BLOCKSIZE + MAP_BLOCKSIZE <= minimum_groundlevel)
 		return true;
 	else
@@ -1489,21 +1537,19 @@ void make_block(BlockMakeData *data)
 
 	/*
 		Get average ground level from noise
+		(found by ServerMap::initBlockMake)
 	*/
 	
-	s16 approx_groundlevel = (s16)get_sector_average_ground_level(
-			data->seed, v2s16(blockpos.X, blockpos.Z));
+	s16 approx_groundlevel = data->ground_levels.average;
 	//dstream<<"approx_groundlevel="<<approx_groundlevel<<std::endl;
 	
 	s16 approx_ground_depth = approx_groundlevel - (node_min.Y+MAP_BLOCKSIZE/2);
 	
-	s16 minimum_groundlevel = (s16)get_sector_minimum_ground_level(
-			data->seed, v2s16(blockpos.X, blockpos.Z));
+	s16 minimum_groundlevel = data->ground_levels.minimum;
 	// Minimum amount of ground above the top of the central block
 	s16 minimum_ground_depth = minimum_groundlevel - node_max.Y;
 
-	s16 maximum_groundlevel = (s16)get_sector_maximum_ground_level(
-			data->seed, v2s16(blockpos.X, blockpos.Z), 1);
+	s16 maximum_groundlevel = data->ground_levels.maximum;
 	// Maximum amount of ground above the bottom of the central block
 	s16 maximum_ground_depth = maximum_groundlevel - node_min.Y;
 
@@ -1625,6 +1671,11 @@ void make_block(BlockMakeData *data)
 		// Node position
 		v2s16 p2d(x,z);
 		{
+			// The 2D part of the ground density of the column
+			GroundColumn ground_column;
+			if(all_is_ground_except_caves == false)
+				ground_column = GroundColumn(data->seed, p2d);
+
 			// Use fast index incrementing
 			v3s16 em = vmanip.m_area.getExtent();
 			u32 i = vmanip.m_area.index(v3s16(p2d.X, node_min.Y, p2d.Y));
@@ -1636,8 +1687,8 @@ void make_block(BlockMakeData *data)
 					// First priority: make air and water.
 					// This avoids caves inside water.
 					if(all_is_ground_except_caves == false
-							&& val_is_ground(noisebuf_ground.get(x,y,z),
-							v3s16(x,y,z), data->seed) == false)
+							&& ground_column.isGround(
+							noisebuf_ground.get(x,y,z), y) == false)
 					{
 						if(y <= WATER_LEVEL)
 							vmanip.m_data[i] = MapNode(CONTENT_WATERSOURCE);
@@ -1805,14 +1856,15 @@ void make_block(BlockMakeData *data)
 			{
 				if(vmanip.m_data[i].getContent() == CONTENT_STONE)
 				{
-					if(noisebuf_ground_crumbleness.get(x,y,z) > 1.3)
+					double crumbleness = noisebuf_ground_crumbleness.get(x,y,z);
+					if(crumbleness > 1.3)
 					{
 						if(noisebuf_ground_wetness.get(x,y,z) > 0.0)
 							vmanip.m_data[i] = MapNode(CONTENT_MUD);
 						else
 							vmanip.m_data[i] = MapNode(CONTENT_SAND);
 					}
-					else if(noisebuf_ground_crumbleness.get(x,y,z) > 0.7)
+					else if(crumbleness > 0.7)
 					{
 						if(noisebuf_ground_wetness.get(x,y,z) < -0.6)
 							vmanip.m_data[i] = MapNode(CONTENT_GRAVEL);
@@ -1983,6 +2035,9 @@ void make_block(BlockMakeData *data)
 				bool air_detected = false;
 				bool water_detected = false;
 				bool have_clay = false;
+				// Clay noise of the column, calculated when needed
+				bool claynoise_got = false;
+				double claynoise = 0;
 
 				// Use fast index incrementing
 				s16 start_y = node_max.Y+2;
@@ -1990,16 +2045,18 @@ void make_block(BlockMakeData *data)
 				u32 i = vmanip.m_area.index(v3s16(p2d.X, start_y, p2d.Y));
 				for(s16 y=start_y; y>=node_min.Y-3; y--)
 				{
-					if(vmanip.m_data[i].getContent() == CONTENT_WATERSOURCE)
+					content_t c = vmanip.m_data[i].getContent();
+
+					if(c == CONTENT_WATERSOURCE)
 						water_detected = true;
-					if(vmanip.m_data[i].getContent() == CONTENT_AIR)
+					if(c == CONTENT_AIR)
 						air_detected = true;
 
-					if((vmanip.m_data[i].getContent() == CONTENT_STONE
-							|| vmanip.m_data[i].getContent() == CONTENT_GRASS
-							|| vmanip.m_data[i].getContent() == CONTENT_MUD
-							|| vmanip.m_data[i].getContent() == CONTENT_SAND
-							|| vmanip.m_data[i].getContent() == CONTENT_GRAVEL
+					if((c == CONTENT_STONE
+							|| c == CONTENT_GRASS
+							|| c == CONTENT_MUD
+							|| c == CONTENT_SAND
+							|| c == CONTENT_GRAVEL
 							) && (air_detected || water_detected))
 					{
 						if(current_depth == 0 && y <= WATER_LEVEL+2
@@ -2011,9 +2068,13 @@ void make_block(BlockMakeData *data)
 							if(have_sand)
 							{
 								// Determine whether to have clay in the sand here
-								double claynoise = noise2d_perlin(
-										0.5+(float)p2d.X/500, 0.5+(float)p2d.Y/500,
-										data->seed+4321, 6, 0.95) + 0.5;
+								if(claynoise_got == false)
+								{
+									claynoise = noise2d_perlin(
+											0.5+(float)p2d.X/500, 0.5+(float)p2d.Y/500,
+											data->seed+4321, 6, 0.95) + 0.5;
+									claynoise_got = true;
+								}
 				
 								have_clay = (y <= WATER_LEVEL) && (y >= WATER_LEVEL-2) && (
 									((claynoise > 0) && (claynoise < 0.04) && (current_depth == 0)) ||
@@ -2034,8 +2095,7 @@ void make_block(BlockMakeData *data)
 						}
 						else
 						{
-							if(vmanip.m_data[i].getContent() == CONTENT_MUD
-								|| vmanip.m_data[i].getContent() == CONTENT_GRASS)
+							if(c == CONTENT_MUD || c == CONTENT_GRASS)
 								vmanip.m_data[i] = MapNode(CONTENT_STONE);
 						}
 
@@ -2111,7 +2171,7 @@ void make_block(BlockMakeData *data)
 				if(n->getContent() == CONTENT_MUD && y <= WATER_LEVEL)
 				{
 					p.Y++;
-					make_papyrus(vmanip, p);
+					make_papyrus(vmanip, p, treerandom);
 				}
 				// Trees grow only on mud and grass, on land
 				else if((n->getContent() == CONTENT_MUD || n->getContent() == CONTENT_GRASS) && y > WATER_LEVEL + 2)
@@ -2119,9 +2179,9 @@ void make_block(BlockMakeData *data)
 					p.Y++;
 					//if(surface_humidity_2d(data->seed, v2s16(x, y)) < 0.5)
 					if(is_jungle == false)
-						make_tree(vmanip, p);
+						make_tree(vmanip, p, treerandom);
 					else
-						make_jungletree(vmanip, p);
+						make_jungletree(vmanip, p, treerandom);
 				}
 				// Cactii grow only on sand, on land
 				else if(n->getContent() == CONTENT_SAND && y > WATER_LEVEL + 2)
@@ -2256,7 +2316,11 @@ BlockMakeData::BlockMakeData():
 	no_op(false),
 	vmanip(NULL),
 	seed(0)
-{}
+{
+	ground_levels.average = 0;
+	ground_levels.minimum = 0;
+	ground_levels.maximum = 0;
+}
 
 BlockMakeData::~BlockMakeData()
 {
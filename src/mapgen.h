@@ -32,8 +32,24 @@ namespace mapgen
 	// Finds precise ground level at any position
 	s16 find_ground_level_from_noise(u64 seed, v2s16 p2d, s16 precision);
 
+	/*
+		Approximate ground levels of a sector, found from noise at a few
+		points. The searches are slow, so ServerMap stores these in its
+		sectors.
+	*/
+	struct SectorGroundLevels
+	{
+		s16 average;
+		s16 minimum;
+		s16 maximum;
+	};
+	void find_sector_ground_levels(u64 seed, v2s16 sectorpos,
+			SectorGroundLevels &levels);
+
 	// Find out if block is completely underground
 	bool block_is_underground(u64 seed, v3s16 blockpos);
+	// Same, with a known minimum ground level of the block's sector
+	bool block_is_underground(s16 minimum_groundlevel, v3s16 blockpos);
 
 	// Main map generation routine
 	void make_block(BlockMakeData *data);
@@ -54,6 +70,8 @@ namespace mapgen
 		ManualMapVoxelManipulator *vmanip;
 		u64 seed;
 		v3s16 blockpos;
+		// Ground levels of the sector of blockpos
+		SectorGroundLevels ground_levels;
 		UniqueQueue<v3s16> transforming_liquid;
 
 		BlockMakeData();
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "client.h"
 #include "exceptions.h"
 #include "mapblock.h"
+#include "map.h"
 
 MapSector::MapSector(Map *parent, v2s16 pos):
 		differs_from_disk(false),
@@ -45,7 +46,9 @@ void MapSector::deleteBlocks()
 	core::map<s16, MapBlock*>::Iterator i = m_blocks.getIterator();
 	for(; i.atEnd() == false; i++)
 	{
-		delete i.getNode()->getValue();
+		MapBlock *block = i.getNode()->getValue();
+		m_parent->unlinkBlock(block);
+		delete block;
 	}
 
 	// Clear container
@@ -83,6 +86,14 @@ MapBlock * MapSector::getBlockNoCreateNoEx(s16 y)
 	return getBlockBuffered(y);
 }
 
+MapBlock * MapSector::getBlockNoCreateNoExNoCache(s16 y)
+{
+	core::map<s16, MapBlock*>::Node *n = m_blocks.find(y);
+	if(n == NULL)
+		return NULL;
+	return n->getValue();
+}
+
 MapBlock * MapSector::createBlankBlockNoInsert(s16 y)
 {
 	assert(getBlockBuffered(y) == NULL);
@@ -99,6 +110,7 @@ MapBlock * MapSector::createBlankBlock(s16 y)
 	MapBlock *block = createBlankBlockNoInsert(y);
 	
 	m_blocks.insert(y, block);
+	m_parent->linkBlock(block);
 
 	return block;
 }
@@ -117,6 +129,7 @@ void MapSector::insertBlock(MapBlock *block)
 	
 	// Insert into container
 	m_blocks.insert(block_y, block);
+	m_parent->linkBlock(block);
 }
 
 void MapSector::deleteBlock(MapBlock *block)
@@ -128,6 +141,7 @@ void MapSector::deleteBlock(MapBlock *block)
 	
 	// Remove from container
 	m_blocks.remove(block_y);
+	m_parent->unlinkBlock(block);
 
 	// Delete
 	delete block;
@@ -152,7 +166,9 @@ void MapSector::getBlocks(core::list<MapBlock*> &dest)
 */
 
 ServerMapSector::ServerMapSector(Map *parent, v2s16 pos):
-		MapSector(parent, pos)
+		MapSector(parent, pos),
+		m_ground_levels_known(false),
+		m_sunlight_heights_known(false)
 {
 }
 
@@ -160,6 +176,13 @@ ServerMapSector::~ServerMapSector()
 {
 }
 
+/*
+	Format of the ground levels in the sector metadata. A newer format
+	that isn't understood is left unread, and so is everything after it;
+	the levels and the sunlight heights are then just found again.
+*/
+#define SECTOR_GROUND_LEVELS_VERSION 1
+
 void ServerMapSector::serialize(std::ostream &os, u8 version)
 {
 	if(!ser_ver_supported(version))
@@ -167,7 +190,15 @@ void ServerMapSector::serialize(std::ostream &os, u8 version)
 	
 	/*
 		[0] u8 serialization version
-		+ heightmap data
+		[1] u8 ground levels format, 0 = not known (optional, omitted
+		       in old files)
+		if format 1:
+			[2] s16 average ground level
+			[4] s16 minimum ground level
+			[6] s16 maximum ground level
+		u8 sunlight heights known (optional, omitted in old files)
+		if known:
+			s16 sunlight height * MAP_BLOCKSIZE*MAP_BLOCKSIZE (z, x)
 	*/
 	
 	// Server has both of these, no need to support not having them.
@@ -180,6 +211,24 @@ void ServerMapSector::serialize(std::ostream &os, u8 version)
 		Add stuff here, if needed
 	*/
 
+	writeU8(os, m_ground_levels_known ? SECTOR_GROUND_LEVELS_VERSION : 0);
+	if(m_ground_levels_known)
+	{
+		u8 buf[6];
+		writeS16(&buf[0], m_ground_levels.average);
+		writeS16(&buf[2], m_ground_levels.minimum);
+		writeS16(&buf[4], m_ground_levels.maximum);
+		os.write((char*)buf, 6);
+	}
+
+	writeU8(os, m_sunlight_heights_known ? 1 : 0);
+	if(m_sunlight_heights_known)
+	{
+		u8 buf[MAP_BLOCKSIZE*MAP_BLOCKSIZE*2];
+		for(u32 i=0; i<MAP_BLOCKSIZE*MAP_BLOCKSIZE; i++)
+			writeS16(&buf[i*2], m_sunlight_heights[i]);
+		os.write((char*)buf, sizeof(buf));
+	}
 }
 
 ServerMapSector* ServerMapSector::deSerialize(
@@ -191,7 +240,7 @@ ServerMapSector* ServerMapSector::deSerialize(
 {
 	/*
 		[0] u8 serialization version
-		+ heightmap data
+		+ ground levels and sunlight heights (see serialize())
 	*/
 
 	/*
@@ -208,6 +257,45 @@ ServerMapSector* ServerMapSector::deSerialize(
 	/*
 		Add necessary reading stuff here
 	*/
+
+	bool ground_levels_known = false;
+	mapgen::SectorGroundLevels ground_levels;
+	// Set if the rest can't be read because of a newer format
+	bool unknown_format = false;
+	{
+		u8 format = 0;
+		is.read((char*)&format, 1);
+		if(is.gcount() == 1 && format > SECTOR_GROUND_LEVELS_VERSION)
+		{
+			unknown_format = true;
+		}
+		else if(is.gcount() == 1 && format != 0)
+		{
+			u8 buf[6];
+			is.read((char*)buf, 6);
+			if(is.gcount() == 6)
+			{
+				ground_levels.average = readS16(&buf[0]);
+				ground_levels.minimum = readS16(&buf[2]);
+				ground_levels.maximum = readS16(&buf[4]);
+				ground_levels_known = true;
+			}
+		}
+	}
+
+	bool sunlight_heights_known = false;
+	u8 sunlight_heights_buf[MAP_BLOCKSIZE*MAP_BLOCKSIZE*2];
+	if(unknown_format == false)
+	{
+		u8 known = 0;
+		is.read((char*)&known, 1);
+		if(is.gcount() == 1 && known != 0)
+		{
+			is.read((char*)sunlight_heights_buf, sizeof(sunlight_heights_buf));
+			if(is.gcount() == sizeof(sunlight_heights_buf))
+				sunlight_heights_known = true;
+		}
+	}
 	
 	/*
 		Get or create sector
@@ -237,11 +325,167 @@ ServerMapSector* ServerMapSector::deSerialize(
 		Set stuff in sector
 	*/
 
-	// Nothing here
+	if(ground_levels_known)
+	{
+		sector->m_ground_levels = ground_levels;
+		sector->m_ground_levels_known = true;
+	}
+
+	if(sunlight_heights_known)
+	{
+		for(u32 i=0; i<MAP_BLOCKSIZE*MAP_BLOCKSIZE; i++)
+			sector->m_sunlight_heights[i] =
+					readS16(&sunlight_heights_buf[i*2]);
+		sector->m_sunlight_heights_known = true;
+	}
 
 	return sector;
 }
 
+bool ServerMapSector::getSunlightHeight(v2s16 p2d, s16 &y)
+{
+	if(m_sunlight_heights_known == false)
+		return false;
+	v2s16 relpos = p2d - m_pos * MAP_BLOCKSIZE;
+	assert(relpos.X >= 0 && relpos.X < MAP_BLOCKSIZE);
+	assert(relpos.Y >= 0 && relpos.Y < MAP_BLOCKSIZE);
+	y = m_sunlight_heights[relpos.Y*MAP_BLOCKSIZE + relpos.X];
+	return true;
+}
+
+void ServerMapSector::initSunlightHeights()
+{
+	for(u32 i=0; i<MAP_BLOCKSIZE*MAP_BLOCKSIZE; i++)
+		m_sunlight_heights[i] = SUNLIGHT_HEIGHT_NONE;
+	m_sunlight_heights_known = true;
+	differs_from_disk = true;
+}
+
+/*
+	Only nodes that are known count; blocks that are not loaded are
+	skipped and ignore is taken to let sunlight through.
+*/
+static bool stops_sunlight(MapNode n)
+{
+	return n.getContent() != CONTENT_IGNORE
+			&& n.sunlight_propagates() == false;
+}
+
+s16 ServerMapSector::findSunlightHeight(s16 x, s16 z, s16 y)
+{
+	/*
+		Go through the loaded blocks below y from top to bottom
+	*/
+	core::array<s16> block_ys;
+	for(core::map<s16, MapBlock*>::Iterator i = m_blocks.getIterator();
+			i.atEnd() == false; i++)
+	{
+		s16 block_y = i.getNode()->getKey();
+		if(block_y * MAP_BLOCKSIZE <= y)
+			block_ys.push_back(block_y);
+	}
+	block_ys.sort();
+
+	for(s32 i=(s32)block_ys.size()-1; i>=0; i--)
+	{
+		MapBlock *block = getBlockNoCreateNoEx(block_ys[i]);
+		if(block->isDummy() || block->getContents().isOnly(CONTENT_AIR))
+			continue;
+		s16 y0 = block->getPosRelative().Y;
+		s16 y1 = MYMIN(y, y0 + MAP_BLOCKSIZE - 1);
+		for(s16 y2=y1; y2>=y0; y2--)
+		{
+			if(stops_sunlight(block->getNodeNoCheck(x, y2 - y0, z)))
+				return y2;
+		}
+	}
+
+	return SUNLIGHT_HEIGHT_NONE;
+}
+
+void ServerMapSector::updateSunlightHeight(v3s16 p)
+{
+	if(m_sunlight_heights_known == false)
+		return;
+
+	s16 x = p.X - m_pos.X * MAP_BLOCKSIZE;
+	s16 z = p.Z - m_pos.Y * MAP_BLOCKSIZE;
+	s16 &height = m_sunlight_heights[z*MAP_BLOCKSIZE + x];
+
+	// Nodes below the height don't change it
+	if(p.Y < height)
+		return;
+
+	s16 new_height = height;
+	if(p.Y == height)
+	{
+		// The highest one was changed; find out what is highest now
+		new_height = findSunlightHeight(x, z, p.Y);
+	}
+	else
+	{
+		MapBlock *block = getBlockNoCreateNoEx(
+				getContainerPos(p.Y, MAP_BLOCKSIZE));
+		if(block == NULL || block->isDummy())
+			return;
+		MapNode n = block->getNodeNoCheck(
+				x, p.Y - block->getPosRelative().Y, z);
+		if(stops_sunlight(n))
+			new_height = p.Y;
+	}
+
+	if(new_height != height)
+	{
+		height = new_height;
+		differs_from_disk = true;
+	}
+}
+
+void ServerMapSector::updateSunlightHeights(MapBlock *block)
+{
+	if(m_sunlight_heights_known == false || block->isDummy())
+		return;
+	
+	s16 y0 = block->getPosRelative().Y;
+	s16 y1 = y0 + MAP_BLOCKSIZE - 1;
+	bool all_air = block->getContents().isOnly(CONTENT_AIR);
+
+	for(s16 z=0; z<MAP_BLOCKSIZE; z++)
+	for(s16 x=0; x<MAP_BLOCKSIZE; x++)
+	{
+		s16 &height = m_sunlight_heights[z*MAP_BLOCKSIZE + x];
+
+		// Something above the block is higher
+		if(height > y1)
+			continue;
+
+		s16 new_height = height;
+		bool found = false;
+		if(all_air == false)
+		{
+			for(s16 y=y1; y>=y0; y--)
+			{
+				if(stops_sunlight(block->getNodeNoCheck(x, y - y0, z)))
+				{
+					new_height = y;
+					found = true;
+					break;
+				}
+			}
+		}
+		// If the highest one was in the block and isn't anymore,
+		// look under the block
+		if(found == false && height >= y0)
+			new_height = findSunlightHeight(x, z, y0 - 1);
+
+		if(new_height != height)
+		{
+			height = new_height;
+			differs_from_disk = true;
+		}
+	}
+}
+
 #ifndef SERVER
 /*
 	ClientMapSector
@@ -27,11 +27,19 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <jmutex.h>
 #include "common_irrlicht.h"
 #include "exceptions.h"
+#include "mapgen.h" // SectorGroundLevels
+#include "constants.h" // MAP_BLOCKSIZE
 #include <ostream>
 
 class MapBlock;
 class Map;
 
+/*
+	Sunlight height of a node column that has no nodes that stop
+	sunlight
+*/
+#define SUNLIGHT_HEIGHT_NONE (-32768)
+
 /*
 	This is an Y-wise stack of MapBlocks.
 */
@@ -56,6 +64,8 @@ class MapSector
 	}
 
 	MapBlock * getBlockNoCreateNoEx(s16 y);
+	// Doesn't use the block cache; see Map::getNodeNoCache()
+	MapBlock * getBlockNoCreateNoExNoCache(s16 y);
 	MapBlock * createBlankBlockNoInsert(s16 y);
 	MapBlock * createBlankBlock(s16 y);
 
@@ -65,7 +75,12 @@ class MapSector
 	
 	void getBlocks(core::list<MapBlock*> &dest);
 	
-	// Always false at the moment, because sector contains no metadata.
+	u32 getBlockCount()
+	{
+		return m_blocks.size();
+	}
+	
+	// Set when the metadata of a ServerMapSector changes
 	bool differs_from_disk;
 
 protected:
@@ -113,8 +128,62 @@ class ServerMapSector : public MapSector
 			v2s16 p2d,
 			core::map<v2s16, MapSector*> & sectors
 		);
+	
+	/*
+		Ground levels found by the map generator; stored in the
+		metadata so that they don't have to be searched from noise again.
+		Returns false if they are not known.
+	*/
+	bool getGroundLevels(mapgen::SectorGroundLevels &levels)
+	{
+		if(m_ground_levels_known == false)
+			return false;
+		levels = m_ground_levels;
+		return true;
+	}
+	void setGroundLevels(const mapgen::SectorGroundLevels &levels)
+	{
+		m_ground_levels = levels;
+		m_ground_levels_known = true;
+		differs_from_disk = true;
+	}
+
+	/*
+		Sunlight heights: the y of the highest node in each node column
+		that doesn't let sunlight through, or SUNLIGHT_HEIGHT_NONE.
+		They are stored in the metadata and kept up to date as blocks
+		are loaded and nodes are changed, so that columns don't have to
+		be searched for them.
+
+		Only nodes that are known count; ignore is taken to let
+		sunlight through and blocks that are not loaded are skipped
+		when looking for a new height. So a height is never higher than
+		the real one, and a node under it surely doesn't get sunlight.
+
+		The heights are known only in sectors that have been created
+		after they were added. p2d is in nodes.
+		Returns false if the height is not known.
+	*/
+	bool getSunlightHeight(v2s16 p2d, s16 &y);
+	// Called for a sector that doesn't have any blocks yet
+	void initSunlightHeights();
+	// Called when the node at p (in nodes) has been changed
+	void updateSunlightHeight(v3s16 p);
+	// Called when a block has been loaded or generated
+	void updateSunlightHeights(MapBlock *block);
 		
 private:
+	/*
+		Finds the sunlight height of column (x,z) of the sector,
+		starting from y downwards.
+	*/
+	s16 findSunlightHeight(s16 x, s16 z, s16 y);
+
+	bool m_ground_levels_known;
+	mapgen::SectorGroundLevels m_ground_levels;
+
+	bool m_sunlight_heights_known;
+	s16 m_sunlight_heights[MAP_BLOCKSIZE*MAP_BLOCKSIZE];
 };
 
 #ifndef SERVER
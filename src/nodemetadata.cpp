@@ -130,6 +130,7 @@ void NodeMetadataList::serialize(std::ostream &os)
 void NodeMetadataList::deSerialize(std::istream &is)
 {
 	m_data.clear();
+	m_stepped.clear();
 
 	u8 buf[6];
 	
@@ -174,6 +175,8 @@ void NodeMetadataList::deSerialize(std::istream &is)
 		}
 
 		m_data.insert(p, data);
+		if(data->needsStep())
+			m_stepped.insert(p, data);
 	}
 }
 	
@@ -203,6 +206,7 @@ void NodeMetadataList::remove(v3s16 p)
 	{
 		delete olddata;
 		m_data.remove(p);
+		m_stepped.remove(p);
 	}
 }
 
@@ -210,13 +214,42 @@ void NodeMetadataList::set(v3s16 p, NodeMetadata *d)
 {
 	remove(p);
 	m_data.insert(p, d);
+	if(d->needsStep())
+		m_stepped.insert(p, d);
+}
+
+void NodeMetadataList::takeFrom(NodeMetadataList &other)
+{
+	for(core::map<v3s16, NodeMetadata*>::Iterator
+			i = m_data.getIterator();
+			i.atEnd()==false; i++)
+	{
+		delete i.getNode()->getValue();
+	}
+	m_data.clear();
+	m_stepped.clear();
+
+	for(core::map<v3s16, NodeMetadata*>::Iterator
+			i = other.m_data.getIterator();
+			i.atEnd()==false; i++)
+	{
+		m_data.insert(i.getNode()->getKey(), i.getNode()->getValue());
+	}
+	for(core::map<v3s16, NodeMetadata*>::Iterator
+			i = other.m_stepped.getIterator();
+			i.atEnd()==false; i++)
+	{
+		m_stepped.insert(i.getNode()->getKey(), i.getNode()->getValue());
+	}
+	other.m_data.clear();
+	other.m_stepped.clear();
 }
 
 bool NodeMetadataList::step(float dtime)
 {
 	bool something_changed = false;
 	for(core::map<v3s16, NodeMetadata*>::Iterator
-			i = m_data.getIterator();
+			i = m_stepped.getIterator();
 			i.atEnd()==false; i++)
 	{
 		v3s16 p = i.getNode()->getKey();
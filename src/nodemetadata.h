@@ -60,7 +60,11 @@ class NodeMetadata
 	// the changes are copied elsewhere
 	virtual void inventoryModified(){}
 	// A step in time. Returns true if metadata changed.
+	// A long dtime is given when a block is activated, so this should
+	// catch up without looping through every elapsed interval.
 	virtual bool step(float dtime) {return false;}
+	// Only metadata that returns true here is stepped at all
+	virtual bool needsStep() {return false;}
 	virtual bool nodeRemovalDisabled(){return false;}
 	// Used to make custom inventory menus.
 	// See format in guiInventoryMenu.cpp.
@@ -90,12 +94,16 @@ class NodeMetadataList
 	void remove(v3s16 p);
 	// Deletes old data and sets a new one
 	void set(v3s16 p, NodeMetadata *d);
+	// Deletes old data and moves all of the data of other here
+	void takeFrom(NodeMetadataList &other);
 	
 	// A step in time. Returns true if something changed.
 	bool step(float dtime);
 
 private:
 	core::map<v3s16, NodeMetadata*> m_data;
+	// The ones of m_data that need to be stepped
+	core::map<v3s16, NodeMetadata*> m_stepped;
 };
 
 #endif
@@ -37,7 +37,8 @@ Player::Player():
 	m_pitch(0),
 	m_yaw(0),
 	m_speed(0,0,0),
-	m_position(0,0,0)
+	m_position(0,0,0),
+	m_modified(true)
 {
 	updateName("<not set>");
 	resetInventory();
@@ -98,23 +99,33 @@ void Player::accelerate(v3f target_speed, f32 max_increase)
 #endif
 }
 
+/*
+	Binary player record format:
+	u8 0 (text records never begin with '\0')
+	u8 version
+	u16 name length, name
+	F1000 pitch
+	F1000 yaw
+	V3F1000 position
+	u8 craftresult_is_preview
+	u16 hp
+	inventory as text
+*/
+#define PLAYER_BINARY_RECORD_VERSION 1
+
 void Player::serialize(std::ostream &os)
 {
-	// Utilize a Settings object for storing values
-	Settings args;
-	args.setS32("version", 1);
-	args.set("name", m_name);
-	//args.set("password", m_password);
-	args.setFloat("pitch", m_pitch);
-	args.setFloat("yaw", m_yaw);
-	args.setV3F("position", m_position);
-	args.setBool("craftresult_is_preview", craftresult_is_preview);
-	args.setS32("hp", hp);
-
-	args.writeLines(os);
-
-	os<<"PlayerArgsEnd\n";
-	
+	writeU8(os, 0);
+	writeU8(os, PLAYER_BINARY_RECORD_VERSION);
+	os<<serializeString(m_name);
+	u8 buf[23];
+	writeF1000(&buf[0], m_pitch);
+	writeF1000(&buf[4], m_yaw);
+	writeV3F1000(&buf[8], m_position);
+	writeU8(&buf[20], craftresult_is_preview ? 1 : 0);
+	writeU16(&buf[21], hp);
+	os.write((char*)buf, 23);
+
 	// If actual inventory is backed up due to creative mode, save it
 	// instead of the dummy creative mode inventory
 	if(inventory_backup)
@@ -124,6 +135,39 @@ void Player::serialize(std::ostream &os)
 }
 
 void Player::deSerialize(std::istream &is)
+{
+	if(is.peek() != 0)
+	{
+		deSerializeText(is);
+		return;
+	}
+
+	readU8(is);
+	u8 version = readU8(is);
+	if(version > PLAYER_BINARY_RECORD_VERSION)
+		throw SerializationError
+				("Player::deSerialize(): Unsupported record version");
+
+	std::string name = deSerializeString(is);
+	u8 buf[23];
+	is.read((char*)buf, 23);
+	if(is.gcount() != 23)
+		throw SerializationError
+				("Player::deSerialize(): Truncated record");
+	updateName(name.c_str());
+	m_pitch = readF1000(&buf[0]);
+	m_yaw = readF1000(&buf[4]);
+	m_position = readV3F1000(&buf[8]);
+	craftresult_is_preview = readU8(&buf[20]) != 0;
+	hp = readU16(&buf[21]);
+
+	inventory.deSerialize(is);
+}
+
+/*
+	Reads the old Settings-based text format
+*/
+void Player::deSerializeText(std::istream &is)
 {
 	Settings args;
 	
@@ -143,10 +187,6 @@ void Player::deSerialize(std::istream &is)
 	//args.getS32("version");
 	std::string name = args.get("name");
 	updateName(name.c_str());
-	/*std::string password = "";
-	if(args.exists("password"))
-		password = args.get("password");
-	updatePassword(password.c_str());*/
 	m_pitch = args.getFloat("pitch");
 	m_yaw = args.getFloat("yaw");
 	m_position = args.getV3F("position");
@@ -160,20 +200,6 @@ void Player::deSerialize(std::istream &is)
 	}catch(SettingNotFoundException &e){
 		hp = 20;
 	}
-	/*try{
-		std::string sprivs = args.get("privs");
-		if(sprivs == "all")
-		{
-			privs = PRIV_ALL;
-		}
-		else
-		{
-			std::istringstream ss(sprivs);
-			ss>>privs;
-		}
-	}catch(SettingNotFoundException &e){
-		privs = PRIV_DEFAULT;
-	}*/
 
 	inventory.deSerialize(is);
 }
@@ -128,13 +128,27 @@ class Player
 	virtual void setClientConnected(bool) {}*/
 	
 	/*
-		serialize() writes a bunch of text that can contain
-		any characters except a '\0', and such an ending that
-		deSerialize stops reading exactly at the right point.
+		serialize() writes a compact binary record, followed by the
+		inventory as text, with such an ending that deSerialize stops
+		reading exactly at the right point.
+		deSerialize() also reads the older text-only format.
 	*/
 	void serialize(std::ostream &os);
 	void deSerialize(std::istream &is);
 
+	/*
+		Set when the saved copy of the player may be out of date.
+		Cleared when the player is saved or loaded.
+	*/
+	void setModified(bool modified)
+	{
+		m_modified = modified;
+	}
+	bool isModified()
+	{
+		return m_modified;
+	}
+
 	bool touching_ground;
 	// This oscillates so that the player jumps a bit above the surface
 	bool in_water;
@@ -160,6 +174,9 @@ class Player
 	f32 m_yaw;
 	v3f m_speed;
 	v3f m_position;
+	bool m_modified;
+
+	void deSerializeText(std::istream &is);
 
 public:
 
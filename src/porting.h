@@ -111,6 +111,28 @@ void initializePaths();
 	}*/
 #endif
 
+/*
+	Number of processors available; 1 if it can't be found out.
+*/
+#ifdef _WIN32 // Windows
+	inline u32 getNumberOfProcessors()
+	{
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		if(info.dwNumberOfProcessors < 1)
+			return 1;
+		return info.dwNumberOfProcessors;
+	}
+#else // Posix
+	inline u32 getNumberOfProcessors()
+	{
+		long count = sysconf(_SC_NPROCESSORS_ONLN);
+		if(count < 1)
+			return 1;
+		return count;
+	}
+#endif
+
 } // namespace porting
 
 #endif // PORTING_HEADER
@@ -0,0 +1,309 @@
+/*
+Minetest-c55
+Copyright (C) 2010-2011 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "pregenerate.h"
+#include "map.h"
+#include "mapblock.h"
+#include "main.h" // For g_settings
+#include "porting.h"
+#include "utility.h"
+#include "debug.h"
+
+/*
+	Blocks whose positions differ by less than this on X and Z are not
+	generated at the same time, whatever their Y. The generation area of
+	a block includes its neighbors, and this leaves one block between the
+	areas sideways. Sunlight is carried down without a depth limit when
+	a block is finished, so blocks in the same columns are generated one
+	at a time.
+*/
+#define PREGENERATE_BLOCK_SPACING 4
+
+// How often the map is saved and unused blocks are unloaded (ms)
+#define PREGENERATE_SAVE_INTERVAL 10000
+// How often progress is printed (ms)
+#define PREGENERATE_PRINT_INTERVAL 5000
+
+class PregenerateThread : public SimpleThread
+{
+	MapPregenerator *m_pregen;
+
+public:
+
+	PregenerateThread(MapPregenerator *pregen):
+		SimpleThread(),
+		m_pregen(pregen)
+	{
+	}
+
+	void * Thread()
+	{
+		ThreadStarted();
+
+		DSTACK(__FUNCTION_NAME);
+
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		while(getRun())
+		{
+			mapgen::BlockMakeData data;
+
+			MapPregenerator::NextBlockResult r =
+					m_pregen->getNextBlock(&data);
+			if(r == MapPregenerator::NEXTBLOCK_DONE)
+				break;
+			if(r == MapPregenerator::NEXTBLOCK_WAIT)
+			{
+				sleep_ms(10);
+				continue;
+			}
+
+			mapgen::make_block(&data);
+
+			m_pregen->finishBlock(&data);
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return NULL;
+	}
+};
+
+MapPregenerator::MapPregenerator(ServerMap *map,
+		v3s16 blockpos_min, v3s16 blockpos_max):
+	m_map(map),
+	m_pause(false),
+	m_total_count(0),
+	m_done_count(0),
+	m_skipped_count(0)
+{
+	m_mutex.Init();
+
+	/*
+		Go through the area a column at a time, from top to bottom so
+		that the blocks above are ready when sunlight is calculated
+	*/
+	for(s16 z=blockpos_min.Z; z<=blockpos_max.Z; z++)
+	for(s16 x=blockpos_min.X; x<=blockpos_max.X; x++)
+	for(s16 y=blockpos_max.Y; y>=blockpos_min.Y; y--)
+	{
+		m_queue.push_back(v3s16(x,y,z));
+		m_total_count++;
+	}
+}
+
+void MapPregenerator::run(u32 thread_count, bool &kill)
+{
+	DSTACK(__FUNCTION_NAME);
+
+	if(m_total_count == 0)
+		return;
+
+	if(thread_count < 1)
+		thread_count = 1;
+
+	dstream<<"Pregenerating "<<m_total_count<<" blocks using "
+			<<thread_count<<" threads"<<std::endl;
+
+	core::array<PregenerateThread*> threads;
+	for(u32 i=0; i<thread_count; i++)
+	{
+		PregenerateThread *thread = new PregenerateThread(this);
+		thread->Start();
+		threads.push_back(thread);
+	}
+
+	u32 start_time = porting::getTimeMs();
+	u32 last_save_time = start_time;
+	u32 last_print_time = start_time;
+	u32 last_print_count = 0;
+
+	for(;;)
+	{
+		sleep_ms(100);
+
+		bool running = false;
+		for(u32 i=0; i<threads.size(); i++)
+		{
+			if(threads[i]->IsRunning())
+				running = true;
+		}
+		if(running == false)
+			break;
+
+		if(kill)
+		{
+			dstream<<"Pregeneration interrupted"<<std::endl;
+			for(u32 i=0; i<threads.size(); i++)
+				threads[i]->stop();
+			break;
+		}
+
+		u32 time = porting::getTimeMs();
+
+		if(time - last_print_time >= PREGENERATE_PRINT_INTERVAL)
+		{
+			u32 done_count;
+			{
+				JMutexAutoLock lock(m_mutex);
+				done_count = m_done_count;
+			}
+			float dtime = (float)(time - last_print_time) / 1000.0;
+			dstream<<"Pregenerated "<<done_count<<"/"<<m_total_count
+					<<" blocks ("<<(done_count * 100 / m_total_count)
+					<<"%), "<<((float)(done_count - last_print_count) / dtime)
+					<<" blocks/s"<<std::endl;
+			last_print_time = time;
+			last_print_count = done_count;
+		}
+
+		if(time - last_save_time >= PREGENERATE_SAVE_INTERVAL)
+		{
+			/*
+				Stop giving out blocks and wait until the threads are done
+				with theirs, because the areas being generated must stay
+				in memory
+			*/
+			{
+				JMutexAutoLock lock(m_mutex);
+				m_pause = true;
+			}
+			for(;;)
+			{
+				{
+					JMutexAutoLock lock(m_mutex);
+					if(m_in_progress.size() == 0)
+						break;
+				}
+				sleep_ms(10);
+			}
+			{
+				JMutexAutoLock lock(m_mutex);
+				saveAndUnload();
+				m_pause = false;
+			}
+			last_save_time = porting::getTimeMs();
+		}
+	}
+
+	for(u32 i=0; i<threads.size(); i++)
+		delete threads[i];
+
+	{
+		JMutexAutoLock lock(m_mutex);
+		m_map->save(true);
+	}
+
+	float dtime = (float)(porting::getTimeMs() - start_time) / 1000.0;
+	if(dtime < 0.001)
+		dtime = 0.001;
+	dstream<<"Pregenerated "<<m_done_count<<" blocks ("
+			<<m_skipped_count<<" already existed) in "<<dtime<<"s, "
+			<<((float)(m_done_count - m_skipped_count) / dtime)
+			<<" blocks/s"<<std::endl;
+}
+
+MapPregenerator::NextBlockResult MapPregenerator::getNextBlock(
+		mapgen::BlockMakeData *data)
+{
+	JMutexAutoLock lock(m_mutex);
+
+	if(m_pause)
+		return NEXTBLOCK_WAIT;
+
+	core::list<v3s16>::Iterator i = m_queue.begin();
+	while(i != m_queue.end())
+	{
+		v3s16 p = *i;
+
+		if(conflictsWithInProgress(p))
+		{
+			i++;
+			continue;
+		}
+
+		i = m_queue.erase(i);
+
+		/*
+			Skip blocks that have been generated already
+		*/
+		MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+		if(block == NULL)
+			block = m_map->loadBlock(p);
+		if(block != NULL && block->isDummy() == false
+				&& block->isGenerated())
+		{
+			m_done_count++;
+			m_skipped_count++;
+			continue;
+		}
+
+		m_map->initBlockMake(data, p);
+		m_in_progress.insert(p, true);
+		return NEXTBLOCK_GOT;
+	}
+
+	if(m_queue.size() == 0)
+		return NEXTBLOCK_DONE;
+
+	// Everything left is next to blocks being generated
+	return NEXTBLOCK_WAIT;
+}
+
+void MapPregenerator::finishBlock(mapgen::BlockMakeData *data)
+{
+	JMutexAutoLock lock(m_mutex);
+
+	core::map<v3s16, MapBlock*> modified_blocks;
+	m_map->finishBlockMake(data, modified_blocks);
+
+	m_in_progress.remove(data->blockpos);
+	m_done_count++;
+}
+
+bool MapPregenerator::conflictsWithInProgress(v3s16 p)
+{
+	for(core::map<v3s16, bool>::Iterator
+			i = m_in_progress.getIterator();
+			i.atEnd() == false; i++)
+	{
+		v3s16 d = i.getNode()->getKey() - p;
+		if(abs(d.X) < PREGENERATE_BLOCK_SPACING
+				&& abs(d.Z) < PREGENERATE_BLOCK_SPACING)
+			return true;
+	}
+	return false;
+}
+
+void MapPregenerator::saveAndUnload()
+{
+	DSTACK(__FUNCTION_NAME);
+
+	m_map->save(true);
+
+	/*
+		Nothing is marked as used while generating, so the oldest blocks
+		are unloaded first. They are loaded back from disk if needed.
+	*/
+	m_map->timerUpdate((float)PREGENERATE_SAVE_INTERVAL / 1000.0,
+			g_settings.getFloat("server_unload_unused_data_timeout"),
+			Map::blockCountForMemory(
+			g_settings.getU16("server_map_memory_limit")));
+}
+
@@ -0,0 +1,84 @@
+/*
+Minetest-c55
+Copyright (C) 2010-2011 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef PREGENERATE_HEADER
+#define PREGENERATE_HEADER
+
+#include "common_irrlicht.h"
+#include "mapgen.h"
+#include <jmutex.h>
+
+class ServerMap;
+
+/*
+	Generates all blocks in an area of a map without running a server.
+
+	ServerMap::initBlockMake() and finishBlockMake() are done one at a
+	time, while mapgen::make_block() is run in many threads at once.
+	Blocks are given out so that the areas of blocks being generated at
+	the same time don't touch each other.
+*/
+class MapPregenerator
+{
+public:
+	MapPregenerator(ServerMap *map, v3s16 blockpos_min, v3s16 blockpos_max);
+
+	/*
+		Generates the area, saving and unloading the map as it goes.
+		Returns when everything is done or kill becomes true.
+	*/
+	void run(u32 thread_count, bool &kill);
+
+	/*
+		Called by the generator threads.
+	*/
+	enum NextBlockResult
+	{
+		NEXTBLOCK_GOT,
+		NEXTBLOCK_WAIT,
+		NEXTBLOCK_DONE
+	};
+	// Takes the next block that can be generated and calls
+	// initBlockMake() for it
+	NextBlockResult getNextBlock(mapgen::BlockMakeData *data);
+	// Calls finishBlockMake()
+	void finishBlock(mapgen::BlockMakeData *data);
+
+private:
+	// Returns true if generating p can overlap something being generated
+	bool conflictsWithInProgress(v3s16 p);
+	// Saves changed blocks and unloads the ones not needed anymore
+	void saveAndUnload();
+
+	ServerMap *m_map;
+	// Protects everything below and the map
+	JMutex m_mutex;
+	// Blocks waiting to be generated
+	core::list<v3s16> m_queue;
+	// Blocks being generated
+	core::map<v3s16, bool> m_in_progress;
+	// When set, no more blocks are given out
+	bool m_pause;
+	u32 m_total_count;
+	u32 m_done_count;
+	u32 m_skipped_count;
+};
+
+#endif
+
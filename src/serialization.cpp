@@ -193,6 +193,170 @@ void decompressZlib(std::istream &is, std::ostream &os)
 	inflateEnd(&z);
 }
 
+/*
+	ZlibCompressor
+*/
+
+ZlibCompressor::ZlibCompressor(int level)
+{
+	m_z = new z_stream;
+	m_z->zalloc = Z_NULL;
+	m_z->zfree = Z_NULL;
+	m_z->opaque = Z_NULL;
+
+	int status = deflateInit(m_z, level);
+	if(status != Z_OK)
+	{
+		delete m_z;
+		zerr(status);
+		throw SerializationError("ZlibCompressor: deflateInit failed");
+	}
+}
+
+ZlibCompressor::~ZlibCompressor()
+{
+	deflateEnd(m_z);
+	delete m_z;
+}
+
+void ZlibCompressor::compress(const u8 *data, u32 size, std::string &os)
+{
+	// Start over, keeping the allocated state
+	deflateReset(m_z);
+
+	// Deflate straight to the end of the output in one go
+	u32 start = os.size();
+	u32 bound = deflateBound(m_z, size);
+	os.resize(start + bound);
+
+	m_z->next_in = (Bytef*)data;
+	m_z->avail_in = size;
+	m_z->next_out = (Bytef*)&os[start];
+	m_z->avail_out = bound;
+
+	int status = deflate(m_z, Z_FINISH);
+	if(status != Z_STREAM_END)
+	{
+		os.resize(start);
+		zerr(status);
+		throw SerializationError("ZlibCompressor: deflate failed");
+	}
+
+	os.resize(start + bound - m_z->avail_out);
+}
+
+/*
+	ZlibDecompressor
+*/
+
+ZlibDecompressor::ZlibDecompressor()
+{
+	m_z = new z_stream;
+	m_z->zalloc = Z_NULL;
+	m_z->zfree = Z_NULL;
+	m_z->opaque = Z_NULL;
+	m_z->next_in = Z_NULL;
+	m_z->avail_in = 0;
+
+	int status = inflateInit(m_z);
+	if(status != Z_OK)
+	{
+		delete m_z;
+		zerr(status);
+		throw SerializationError("ZlibDecompressor: inflateInit failed");
+	}
+}
+
+ZlibDecompressor::~ZlibDecompressor()
+{
+	inflateEnd(m_z);
+	delete m_z;
+}
+
+u32 ZlibDecompressor::decompress(const u8 *data, u32 size,
+		u8 *dest, u32 dest_size, u32 *dest_len)
+{
+	// Start over, keeping the allocated state
+	inflateReset(m_z);
+
+	m_z->next_in = (Bytef*)data;
+	m_z->avail_in = size;
+	m_z->next_out = (Bytef*)dest;
+	m_z->avail_out = dest_size;
+
+	int status = inflate(m_z, Z_FINISH);
+	if(status != Z_STREAM_END)
+	{
+		// Either the input ended or the result didn't fit in dest
+		if(status == Z_BUF_ERROR)
+			throw SerializationError("decompressZlib: invalid data size");
+		zerr(status);
+		throw SerializationError("decompressZlib: inflate failed");
+	}
+
+	*dest_len = dest_size - m_z->avail_out;
+
+	return size - m_z->avail_in;
+}
+
+u32 ZlibDecompressor::decompress(const u8 *data, u32 size, std::string &os)
+{
+	const u32 bufsize = 16384;
+	int status;
+
+	// Start over, keeping the allocated state
+	inflateReset(m_z);
+
+	m_z->next_in = (Bytef*)data;
+	m_z->avail_in = size;
+
+	do
+	{
+		// Inflate straight to the end of the output
+		u32 start = os.size();
+		os.resize(start + bufsize);
+		m_z->next_out = (Bytef*)&os[start];
+		m_z->avail_out = bufsize;
+
+		status = inflate(m_z, Z_NO_FLUSH);
+
+		os.resize(start + bufsize - m_z->avail_out);
+
+		// There is always room for output, so this means that the
+		// input ended before the end of the compressed data
+		if(status == Z_BUF_ERROR)
+			throw SerializationError("decompressZlib: data ended halfway");
+		if(status == Z_NEED_DICT || status == Z_DATA_ERROR
+				|| status == Z_MEM_ERROR)
+		{
+			zerr(status);
+			throw SerializationError("decompressZlib: inflate failed");
+		}
+	}
+	while(status != Z_STREAM_END);
+
+	return size - m_z->avail_in;
+}
+
+void compressZlib(const u8 *data, u32 size, std::string &os)
+{
+	ZlibCompressor compressor;
+	compressor.compress(data, size, os);
+}
+
+u32 decompressZlib(const u8 *data, u32 size,
+		u8 *dest, u32 dest_size, u32 *dest_len)
+{
+	ZlibDecompressor decompressor;
+	return decompressor.decompress(data, size, dest, dest_size, dest_len);
+}
+
+u32 decompressZlib(const u8 *data, u32 size, std::string &os)
+{
+	ZlibDecompressor decompressor;
+	return decompressor.decompress(data, size, os);
+}
+
 void compress(SharedBuffer<u8> data, std::ostream &os, u8 version)
 {
 	if(version >= 11)
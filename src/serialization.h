@@ -74,6 +74,63 @@ void compressZlib(SharedBuffer<u8> data, std::ostream &os);
 void compressZlib(const std::string &data, std::ostream &os);
 void decompressZlib(std::istream &is, std::ostream &os);
 
+struct z_stream_s;
+
+/*
+	These work on memory directly, without going through streams, and
+	keep their zlib context between calls so that it only has to be
+	reset instead of allocated again for every buffer.
+	They are not thread safe; each thread has to use its own.
+*/
+class ZlibCompressor
+{
+public:
+	// level is a zlib compression level (0-9), or -1 for the default
+	ZlibCompressor(int level=-1);
+	~ZlibCompressor();
+
+	// Appends the compressed data to os
+	void compress(const u8 *data, u32 size, std::string &os);
+
+private:
+	// Not copyable
+	ZlibCompressor(const ZlibCompressor &);
+	ZlibCompressor & operator=(const ZlibCompressor &);
+
+	z_stream_s *m_z;
+};
+
+class ZlibDecompressor
+{
+public:
+	ZlibDecompressor();
+	~ZlibDecompressor();
+
+	/*
+		These return the number of bytes of input used, so that reading
+		can continue after the compressed data.
+	*/
+	// Decompresses into a buffer of known size. The length of the
+	// decompressed data is stored in dest_len.
+	u32 decompress(const u8 *data, u32 size,
+			u8 *dest, u32 dest_size, u32 *dest_len);
+	// Decompresses data of unknown length, appending it to os.
+	u32 decompress(const u8 *data, u32 size, std::string &os);
+
+private:
+	// Not copyable
+	ZlibDecompressor(const ZlibDecompressor &);
+	ZlibDecompressor & operator=(const ZlibDecompressor &);
+
+	z_stream_s *m_z;
+};
+
+// One-off versions of the above
+void compressZlib(const u8 *data, u32 size, std::string &os);
+u32 decompressZlib(const u8 *data, u32 size,
+		u8 *dest, u32 dest_size, u32 *dest_len);
+u32 decompressZlib(const u8 *data, u32 size, std::string &os);
+
 // These choose between zlib and a self-made one according to version
 void compress(SharedBuffer<u8> data, std::ostream &os, u8 version);
 //void compress(const std::string &data, std::ostream &os, u8 version);
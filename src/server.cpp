@@ -335,6 +335,88 @@ void * EmergeThread::Thread()
 	return NULL;
 }
 
+/*
+	CenteredBlockSet
+*/
+
+void CenteredBlockSet::setRadius(s16 radius)
+{
+	m_radius = radius;
+	s32 side = 2*m_radius+1;
+	m_bits.set_used((side*side*side + 31) / 32);
+	clear();
+}
+
+void CenteredBlockSet::setCenter(v3s16 center)
+{
+	if(center == m_center)
+		return;
+	v3s16 old_center = m_center;
+	m_center = center;
+	if(m_count == 0)
+		return;
+
+	/*
+		Move the bits that are still in range to their new positions
+	*/
+	core::array<u32> old_bits = m_bits;
+	clear();
+	s32 side = 2*m_radius+1;
+	for(u32 w=0; w<old_bits.size(); w++)
+	{
+		u32 word = old_bits[w];
+		if(word == 0)
+			continue;
+		for(u32 b=0; b<32; b++)
+		{
+			if((word & ((u32)1<<b)) == 0)
+				continue;
+			s32 i = w*32 + b;
+			v3s16 p(
+				i % side - m_radius,
+				(i / side) % side - m_radius,
+				i / (side*side) - m_radius
+			);
+			insert(p + old_center);
+		}
+	}
+}
+
+void CenteredBlockSet::insert(v3s16 p)
+{
+	s32 i = index(p);
+	if(i == -1)
+		return;
+	u32 mask = (u32)1<<(i&31);
+	if(m_bits[i>>5] & mask)
+		return;
+	m_bits[i>>5] |= mask;
+	m_count++;
+}
+
+void CenteredBlockSet::remove(v3s16 p)
+{
+	s32 i = index(p);
+	if(i == -1)
+		return;
+	u32 mask = (u32)1<<(i&31);
+	if((m_bits[i>>5] & mask) == 0)
+		return;
+	m_bits[i>>5] &= ~mask;
+	m_count--;
+}
+
+void CenteredBlockSet::clear()
+{
+	for(u32 i=0; i<m_bits.size(); i++)
+		m_bits[i] = 0;
+	m_count = 0;
+}
+
+/*
+	RemoteClient
+*/
+
 void RemoteClient::GetNextBlocks(Server *server, float dtime,
 		core::array<PrioritySortedBlockTransfer> &dest)
 {
@@ -398,6 +480,36 @@ void RemoteClient::GetNextBlocks(Server *server, float dtime,
 		m_last_center = center;
 	}
 
+	/*
+		Keep the sent block set covering everything that can be sent
+		or have its objects sent from here, with a margin for the
+		predicted center.
+	*/
+	{
+		s16 radius = g_settings.getS16("max_block_send_distance");
+		s16 object_radius = g_settings.getS16("active_object_range");
+		if(object_radius > radius)
+			radius = object_radius;
+		radius += 2;
+		if(m_blocks_sent.getRadius() != radius)
+			m_blocks_sent.setRadius(radius);
+		m_blocks_sent.setCenter(center);
+
+		// Forget outdated blocks that went out of range too
+		core::list<v3s16> out_of_range;
+		for(core::map<v3s16, u32>::Iterator
+				i = m_blocks_outdated.getIterator();
+				i.atEnd()==false; i++)
+		{
+			v3s16 p = i.getNode()->getKey();
+			if(m_blocks_sent.covers(p) == false)
+				out_of_range.push_back(p);
+		}
+		for(core::list<v3s16>::Iterator i = out_of_range.begin();
+				i != out_of_range.end(); i++)
+			m_blocks_outdated.remove(*i);
+	}
+
 	/*dstream<<"m_nearest_unsent_reset_timer="
 			<<m_nearest_unsent_reset_timer<<std::endl;*/
 			
@@ -488,13 +600,12 @@ void RemoteClient::GetNextBlocks(Server *server, float dtime,
 			Get the border/face dot coordinates of a "d-radiused"
 			box
 		*/
-		core::list<v3s16> list;
-		getFacePositions(list, d);
+		const core::array<v3s16> &list =
+				server->m_face_position_cache.get(d);
 		
-		core::list<v3s16>::Iterator li;
-		for(li=list.begin(); li!=list.end(); li++)
+		for(u32 li=0; li<list.size(); li++)
 		{
-			v3s16 p = *li + center;
+			v3s16 p = list[li] + center;
 			
 			/*
 				Send throttling
@@ -521,6 +632,12 @@ void RemoteClient::GetNextBlocks(Server *server, float dtime,
 			// Don't send blocks that are currently being transferred
 			if(m_blocks_sending.find(p) != NULL)
 				continue;
+
+			/*
+				Don't send already sent blocks
+			*/
+			if(m_blocks_sent.contains(p))
+				continue;
 		
 			/*
 				Do not go over-limit
@@ -589,16 +706,6 @@ void RemoteClient::GetNextBlocks(Server *server, float dtime,
 				continue;
 			}
 			
-			/*
-				Don't send already sent blocks
-			*/
-			{
-				if(m_blocks_sent.find(p) != NULL)
-				{
-					continue;
-				}
-			}
-
 			/*
 				Check if map has this block
 			*/
@@ -863,21 +970,18 @@ void RemoteClient::SendObjectData(
 
 	for(s16 d = 0; d <= d_max; d++)
 	{
-		core::list<v3s16> list;
-		getFacePositions(list, d);
+		const core::array<v3s16> &list =
+				server->m_face_position_cache.get(d);
 		
-		core::list<v3s16>::Iterator li;
-		for(li=list.begin(); li!=list.end(); li++)
+		for(u32 li=0; li<list.size(); li++)
 		{
-			v3s16 p = *li + center;
+			v3s16 p = list[li] + center;
 
 			/*
 				Ignore blocks that haven't been sent to the client
 			*/
-			{
-				if(m_blocks_sent.find(p) == NULL)
-					continue;
-			}
+			if(m_blocks_sent.contains(p) == false)
+				continue;
 			
 			// Try stepping block and add it to a send queue
 			try
@@ -978,11 +1082,14 @@ void RemoteClient::GotBlock(v3s16 p)
 				" m_blocks_sending"<<std::endl;*/
 		m_excess_gotblocks++;
 	}
-	m_blocks_sent.insert(p, true);
+	m_blocks_sent.insert(p);
 }
 
 void RemoteClient::SentBlock(v3s16 p)
 {
+	// Whatever version the client had, it is being updated now
+	m_blocks_outdated.remove(p);
+
 	if(m_blocks_sending.find(p) == NULL)
 		m_blocks_sending.insert(p, 0.0);
 	else
@@ -996,8 +1103,8 @@ void RemoteClient::SetBlockNotSent(v3s16 p)
 	
 	if(m_blocks_sending.find(p) != NULL)
 		m_blocks_sending.remove(p);
-	if(m_blocks_sent.find(p) != NULL)
-		m_blocks_sent.remove(p);
+	m_blocks_sent.remove(p);
+	m_blocks_outdated.remove(p);
 }
 
 void RemoteClient::SetBlocksNotSent(core::map<v3s16, MapBlock*> &blocks)
@@ -1012,11 +1119,77 @@ void RemoteClient::SetBlocksNotSent(core::map<v3s16, MapBlock*> &blocks)
 
 		if(m_blocks_sending.find(p) != NULL)
 			m_blocks_sending.remove(p);
-		if(m_blocks_sent.find(p) != NULL)
+		m_blocks_sent.remove(p);
+		m_blocks_outdated.remove(p);
+	}
+}
+
+void RemoteClient::SetBlocksOutdated(core::map<v3s16, u32> &held_versions)
+{
+	m_nearest_unsent_d = 0;
+	
+	for(core::map<v3s16, u32>::Iterator
+			i = held_versions.getIterator();
+			i.atEnd()==false; i++)
+	{
+		v3s16 p = i.getNode()->getKey();
+		u32 version = i.getNode()->getValue();
+
+		/*
+			If the block is on the way, it is not known which version
+			the client will have, so it has to be sent again as a whole.
+		*/
+		if(m_blocks_sending.find(p) != NULL)
+		{
+			m_blocks_sending.remove(p);
+			m_blocks_outdated.remove(p);
+			continue;
+		}
+
+		/*
+			If the client has the block, remember its version.
+			If it is already outdated, the older version is kept.
+		*/
+		if(m_blocks_sent.contains(p))
+		{
 			m_blocks_sent.remove(p);
+			m_blocks_outdated.insert(p, version);
+		}
 	}
 }
 
+void RemoteClient::SetRelitBlocksNotSent(
+		core::map<v3s16, MapBlock*> &relit_blocks, Map &map)
+{
+	if(m_blocks_queued_lighting.size() == 0)
+		return;
+
+	core::list<v3s16> done;
+	for(core::map<v3s16, bool>::Iterator
+			i = m_blocks_queued_lighting.getIterator();
+			i.atEnd()==false; i++)
+	{
+		v3s16 p = i.getNode()->getKey();
+		if(relit_blocks.find(p) != NULL)
+			SetBlockNotSent(p);
+		// Forget it when its light can't change anymore
+		if(map.isLightingQueued(p) == false)
+			done.push_back(p);
+	}
+	for(core::list<v3s16>::Iterator i = done.begin();
+			i != done.end(); i++)
+		m_blocks_queued_lighting.remove(*i);
+}
+
+bool RemoteClient::GetOutdatedVersion(v3s16 p, u32 &held_version)
+{
+	core::map<v3s16, u32>::Node *n = m_blocks_outdated.find(p);
+	if(n == NULL)
+		return false;
+	held_version = n->getValue();
+	return true;
+}
+
 /*
 	PlayerInfo
 */
@@ -1064,6 +1237,8 @@ Server::Server(
 	m_con(PROTOCOL_ID, 512, CONNECTION_TIMEOUT, this),
 	m_authmanager(mapsavedir+"/auth.txt"),
 	m_banmanager(mapsavedir+"/ipban.txt"),
+	m_block_compressor(rangelim(
+			g_settings.getS32("network_compression_level"), -1, 9)),
 	m_thread(this),
 	m_emergethread(this),
 	m_time_counter(0),
@@ -1075,6 +1250,7 @@ Server::Server(
 	m_ignore_map_edit_events(false),
 	m_ignore_map_edit_events_peer_id(0)
 {
+	m_block_version_counter = 0;
 	m_liquid_transform_timer = 0.0;
 	m_print_info_timer = 0.0;
 	m_objectdata_timer = 0.0;
@@ -1322,7 +1498,10 @@ void Server::AsyncRunStep()
 		// Run Map's timers and unload unused data
 		ScopeProfiler sp(&g_profiler, "Server: map timer and unload");
 		m_env.getMap().timerUpdate(map_timer_and_unload_dtime,
-				g_settings.getFloat("server_unload_unused_data_timeout"));
+				g_settings.getFloat("server_unload_unused_data_timeout"),
+				Map::blockCountForMemory(
+				g_settings.getU16("server_map_memory_limit")),
+				NULL, &m_env.getActiveBlocks());
 	}
 	
 	/*
@@ -1380,6 +1559,17 @@ void Server::AsyncRunStep()
 		}
 	}
 
+	/*
+		Update lighting of blocks modified by players
+	*/
+	{
+		JMutexAutoLock lock(m_env_mutex);
+
+		ScopeProfiler sp(&g_profiler, "Server: lighting updates");
+		updateQueuedLighting(
+				g_settings.getU16("lighting_update_blocks_per_step"));
+	}
+
 	// Periodically print some info
 	{
 		float &counter = m_print_info_timer;
@@ -1744,11 +1934,12 @@ void Server::AsyncRunStep()
 			}
 			
 			/*
-				Set blocks not sent to far players
+				Record node changes and set blocks outdated for far
+				players
 			*/
-			if(far_players.size() > 0)
+			if(event->type == MEET_ADDNODE || event->type == MEET_REMOVENODE)
 			{
-				// Convert list format to that wanted by SetBlocksNotSent
+				// Convert list format to that wanted by journalNodeChange
 				core::map<v3s16, MapBlock*> modified_blocks2;
 				for(core::map<v3s16, bool>::Iterator
 						i = event->modified_blocks.getIterator();
@@ -1758,17 +1949,8 @@ void Server::AsyncRunStep()
 					modified_blocks2.insert(p,
 							m_env.getMap().getBlockNoCreateNoEx(p));
 				}
-				// Set blocks not sent
-				for(core::list<u16>::Iterator
-						i = far_players.begin();
-						i != far_players.end(); i++)
-				{
-					u16 peer_id = *i;
-					RemoteClient *client = getClient(peer_id);
-					if(client==NULL)
-						continue;
-					client->SetBlocksNotSent(modified_blocks2);
-				}
+				journalNodeChange(event->p, event->type == MEET_REMOVENODE,
+						event->n, modified_blocks2, far_players);
 			}
 
 			delete event;
@@ -1785,6 +1967,13 @@ void Server::AsyncRunStep()
 			prof.print(dstream);
 		}
 		
+		/*
+			Send the changes collected above
+		*/
+		{
+			JMutexAutoLock conlock(m_con_mutex);
+			SendNodeChanges();
+		}
 	}
 
 	/*
@@ -1851,6 +2040,9 @@ void Server::AsyncRunStep()
 					g_settings.getFloat("server_unload_unused_sectors_timeout"));
 					*/
 
+			// Don't save approximate lighting
+			updateQueuedLighting(0);
+
 			// Save only changed parts
 			m_env.getMap().save(true);
 
@@ -2486,6 +2678,8 @@ void Server::ProcessData(u8 *data, u32 datasize, u16 peer_id)
 					bool weared_out = titem->addWear(wear);
 					if(weared_out)
 						mlist->deleteItem(item_i);
+					else
+						mlist->setModified();
 					SendInventory(player->peer_id);
 				}
 			}
@@ -2688,6 +2882,10 @@ void Server::ProcessData(u8 *data, u32 datasize, u16 peer_id)
 						{
 							mlist->deleteItem(item_i);
 						}
+						else
+						{
+							mlist->setModified();
+						}
 					}
 				}
 
@@ -2729,21 +2927,14 @@ void Server::ProcessData(u8 *data, u32 datasize, u16 peer_id)
 			{
 				MapEditEventIgnorer ign(&m_ignore_map_edit_events);
 
-				m_env.getMap().removeNodeAndUpdate(p_under, modified_blocks);
+				m_env.getMap().removeNodeAndQueueLighting(p_under,
+						modified_blocks);
 			}
 			/*
-				Set blocks not sent to far players
+				Record the change and set blocks outdated for far players
 			*/
-			for(core::list<u16>::Iterator
-					i = far_players.begin();
-					i != far_players.end(); i++)
-			{
-				u16 peer_id = *i;
-				RemoteClient *client = getClient(peer_id);
-				if(client==NULL)
-					continue;
-				client->SetBlocksNotSent(modified_blocks);
-			}
+			journalNodeChange(p_under, true, MapNode(CONTENT_AIR),
+					modified_blocks, far_players);
 		}
 		
 		/*
@@ -2849,9 +3040,14 @@ void Server::ProcessData(u8 *data, u32 datasize, u16 peer_id)
 				{
 					// Remove from inventory and send inventory
 					if(mitem->getCount() == 1)
+					{
 						ilist->deleteItem(item_i);
+					}
 					else
+					{
 						mitem->remove(1);
+						ilist->setModified();
+					}
 					// Send inventory
 					UpdateCrafting(peer_id);
 					SendInventory(peer_id);
@@ -2866,21 +3062,15 @@ void Server::ProcessData(u8 *data, u32 datasize, u16 peer_id)
 				{
 					MapEditEventIgnorer ign(&m_ignore_map_edit_events);
 
-					m_env.getMap().addNodeAndUpdate(p_over, n, modified_blocks);
+					m_env.getMap().addNodeAndQueueLighting(p_over, n,
+							modified_blocks);
 				}
 				/*
-					Set blocks not sent to far players
+					Record the change and set blocks outdated for far
+					players
 				*/
-				for(core::list<u16>::Iterator
-						i = far_players.begin();
-						i != far_players.end(); i++)
-				{
-					u16 peer_id = *i;
-					RemoteClient *client = getClient(peer_id);
-					if(client==NULL)
-						continue;
-					client->SetBlocksNotSent(modified_blocks);
-				}
+				journalNodeChange(p_over, false, n,
+						modified_blocks, far_players);
 
 				/*
 					Calculate special events
@@ -2964,7 +3154,10 @@ void Server::ProcessData(u8 *data, u32 datasize, u16 peer_id)
 						}
 						// Else decrement it
 						else
+						{
 							item->remove(dropcount);
+							ilist->setModified();
+						}
 						
 						// Send inventory
 						UpdateCrafting(peer_id);
@@ -3408,6 +3601,12 @@ void Server::ProcessData(u8 *data, u32 datasize, u16 peer_id)
 		player->wieldItem(item);
 		SendWieldedItem(player);
 	}
+	else if(command == TOSERVER_REQUEST_INVENTORY)
+	{
+		// Forget what has been sent and send everything
+		getClient(peer_id)->sent_inventory_lists.clear();
+		SendInventory(peer_id);
+	}
 	else
 	{
 		derr_server<<"WARNING: Server::ProcessData(): Ignoring "
@@ -3673,6 +3872,13 @@ void Server::SendInventory(u16 peer_id)
 	Player* player = m_env.getPlayer(peer_id);
 	assert(player);
 
+	RemoteClient *client = getClient(peer_id);
+	if(client->net_proto_version >= 4)
+	{
+		SendInventoryDiff(client, player);
+		return;
+	}
+
 	/*
 		Serialize it
 	*/
@@ -3692,6 +3898,108 @@ void Server::SendInventory(u16 peer_id)
 	m_con.Send(peer_id, 0, data, true);
 }
 
+void Server::SendInventoryDiff(RemoteClient *client, Player *player)
+{
+	DSTACK(__FUNCTION_NAME);
+
+	std::ostringstream os(std::ios_base::binary);
+	u8 buf[12];
+	u16 list_count = 0;
+
+	for(u32 i=0; i<player->inventory.getListCount(); i++)
+	{
+		InventoryList *list = player->inventory.getListByIndex(i);
+		const InventoryList *clist = list;
+		const std::string &name = list->getName();
+
+		core::map<std::string, SentInventoryList>::Node *n =
+				client->sent_inventory_lists.find(name);
+		if(n == NULL)
+		{
+			SentInventoryList sent;
+			sent.version = 0;
+			sent.list_id = 0;
+			sent.modification_count = 0;
+			client->sent_inventory_lists.insert(name, sent);
+			n = client->sent_inventory_lists.find(name);
+		}
+		SentInventoryList &sent = n->getValue();
+
+		// Skip the list if it hasn't been modified since it was sent
+		if(sent.version != 0 && sent.list_id == list->getId()
+				&& sent.modification_count == list->getModificationCount())
+			continue;
+		sent.list_id = list->getId();
+		sent.modification_count = list->getModificationCount();
+
+		/*
+			Serialize the items and compare them to what was sent
+			the last time, to find the slots that changed
+		*/
+		core::array<std::string> items;
+		for(u32 j=0; j<list->getSize(); j++)
+		{
+			const InventoryItem *item = clist->getItem(j);
+			if(item == NULL)
+			{
+				items.push_back("");
+				continue;
+			}
+			std::ostringstream itemos(std::ios_base::binary);
+			item->serialize(itemos);
+			items.push_back(itemos.str());
+		}
+
+		// Send everything if the client doesn't have the list
+		bool all = (sent.version == 0 || sent.items.size() != items.size());
+
+		core::list<u16> changed;
+		for(u32 j=0; j<items.size(); j++)
+		{
+			if(all || items[j] != sent.items[j])
+				changed.push_back(j);
+		}
+		if(all == false && changed.size() == 0)
+			continue;
+
+		u32 base_version = all ? 0 : sent.version;
+		sent.version++;
+		// 0 means no base version
+		if(sent.version == 0)
+			sent.version = 1;
+		sent.items = items;
+
+		os<<serializeString(name);
+		writeU32(&buf[0], base_version);
+		writeU32(&buf[4], sent.version);
+		writeU16(&buf[8], items.size());
+		writeU16(&buf[10], changed.size());
+		os.write((char*)buf, 12);
+		for(core::list<u16>::Iterator j = changed.begin();
+				j != changed.end(); j++)
+		{
+			writeU16(buf, *j);
+			os.write((char*)buf, 2);
+			os<<serializeString(items[*j]);
+		}
+
+		list_count++;
+	}
+
+	if(list_count == 0)
+		return;
+
+	std::string s = os.str();
+
+	SharedBuffer<u8> data(2+2+s.size());
+	writeU16(&data[0], TOCLIENT_INVENTORY_DIFF);
+	writeU16(&data[2], list_count);
+	memcpy(&data[4], s.c_str(), s.size());
+
+	// Send as reliable
+	m_con.Send(client->peer_id, 0, data, true);
+}
+
 std::string getWieldedItemString(const Player *player)
 {
 	const InventoryItem *item = player->getWieldItem();
@@ -3869,6 +4177,16 @@ void Server::sendRemoveNode(v3s16 p, u16 ignore_id,
 			}
 		}
 
+		// Send later together with other changes if possible
+		if(client->net_proto_version >= 3)
+		{
+			PendingNodeChange change;
+			change.p = p;
+			change.remove = true;
+			client->pending_node_changes.push_back(change);
+			continue;
+		}
+
 		// Send as reliable
 		m_con.Send(client->peer_id, 0, reply, true);
 	}
@@ -3910,6 +4228,17 @@ void Server::sendAddNode(v3s16 p, MapNode n, u16 ignore_id,
 			}
 		}
 
+		// Send later together with other changes if possible
+		if(client->net_proto_version >= 3)
+		{
+			PendingNodeChange change;
+			change.p = p;
+			change.remove = false;
+			change.n = n;
+			client->pending_node_changes.push_back(change);
+			continue;
+		}
+
 		// Create packet
 		u32 replysize = 8 + MapNode::serializedLength(client->serialization_version);
 		SharedBuffer<u8> reply(replysize);
@@ -3924,6 +4253,102 @@ void Server::sendAddNode(v3s16 p, MapNode n, u16 ignore_id,
 	}
 }
 
+/*
+	Maximum number of changes in one TOCLIENT_NODECHANGES
+*/
+#define NODECHANGES_MAX_COUNT 1000
+
+void Server::SendNodeChanges()
+{
+	DSTACK(__FUNCTION_NAME);
+
+	for(core::map<u16, RemoteClient*>::Iterator
+		i = m_clients.getIterator();
+		i.atEnd() == false; i++)
+	{
+		RemoteClient *client = i.getNode()->getValue();
+		core::list<PendingNodeChange> &changes = client->pending_node_changes;
+		if(changes.size() == 0)
+			continue;
+		
+		u8 ser_version = client->serialization_version;
+		u32 nodesize = MapNode::serializedLength(ser_version);
+		SharedBuffer<u8> nodebuf(nodesize);
+
+		core::list<PendingNodeChange>::Iterator j = changes.begin();
+		while(j != changes.end())
+		{
+			std::ostringstream os(std::ios_base::binary);
+			u16 count = 0;
+			bool have_last_p = false;
+			v3s16 last_p;
+			bool have_last_n = false;
+			MapNode last_n;
+
+			for(; j != changes.end() && count < NODECHANGES_MAX_COUNT; j++)
+			{
+				PendingNodeChange &change = *j;
+
+				u8 flags = 0;
+				if(change.remove)
+					flags |= 0x01;
+				
+				v3s16 d = change.p - last_p;
+				bool relative = (have_last_p
+						&& d.X >= -128 && d.X <= 127
+						&& d.Y >= -128 && d.Y <= 127
+						&& d.Z >= -128 && d.Z <= 127);
+				if(relative)
+					flags |= 0x02;
+				
+				bool same_node = false;
+				if(change.remove == false)
+				{
+					same_node = (have_last_n && change.n == last_n);
+					if(same_node)
+						flags |= 0x04;
+				}
+
+				writeU8(os, flags);
+				if(relative)
+				{
+					writeU8(os, (u8)(s8)d.X);
+					writeU8(os, (u8)(s8)d.Y);
+					writeU8(os, (u8)(s8)d.Z);
+				}
+				else
+				{
+					u8 buf[6];
+					writeV3S16(buf, change.p);
+					os.write((char*)buf, 6);
+				}
+				if(change.remove == false && same_node == false)
+				{
+					change.n.serialize(*nodebuf, ser_version);
+					os.write((char*)*nodebuf, nodesize);
+					last_n = change.n;
+					have_last_n = true;
+				}
+
+				last_p = change.p;
+				have_last_p = true;
+				count++;
+			}
+
+			std::string s = os.str();
+			SharedBuffer<u8> reply(2+2+s.size());
+			writeU16(&reply[0], TOCLIENT_NODECHANGES);
+			writeU16(&reply[2], count);
+			memcpy((char*)&reply[4], s.c_str(), s.size());
+			
+			// Send as reliable, on the same channel as the single changes
+			m_con.Send(client->peer_id, 0, reply, true);
+		}
+
+		changes.clear();
+	}
+}
+
 void Server::setBlockNotSent(v3s16 p)
 {
 	for(core::map<u16, RemoteClient*>::Iterator
@@ -3935,26 +4360,124 @@ void Server::setBlockNotSent(v3s16 p)
 	}
 }
 
-void Server::SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver)
+void Server::journalNodeChange(v3s16 p, bool remove, MapNode n,
+		core::map<v3s16, MapBlock*> &modified_blocks,
+		core::list<u16> &far_players)
+{
+	core::map<v3s16, u32> held_versions;
+
+	/*
+		The change is recorded only in the block that has the node.
+		A neighbor in modified_blocks has only had its lighting changed;
+		replaying the change from its journal could overwrite a newer
+		version of the node the client got with the block it is in.
+	*/
+	v3s16 blockpos = getNodeBlockPos(p);
+	core::map<v3s16, MapBlock*>::Node *bn = modified_blocks.find(blockpos);
+	MapBlock *block = bn ? bn->getValue() : NULL;
+	if(block != NULL)
+	{
+		// Give the block a version that clients can refer to
+		if(block->getVersion() == 0)
+			block->setVersion(++m_block_version_counter);
+		held_versions.insert(blockpos, block->getVersion());
+		block->recordChange(p, remove, n, ++m_block_version_counter);
+	}
+
+	for(core::list<u16>::Iterator
+			i = far_players.begin();
+			i != far_players.end(); i++)
+	{
+		RemoteClient *client = getClient(*i);
+		if(client==NULL)
+			continue;
+		client->SetBlocksOutdated(held_versions);
+	}
+}
+
+bool Server::SendBlockChangesNoLock(RemoteClient *client, MapBlock *block,
+		u32 held_version)
 {
 	DSTACK(__FUNCTION_NAME);
 
-	v3s16 p = block->getPos();
+	if(client->net_proto_version < 2)
+		return false;
+
+	core::list<MapBlockChange> changes;
+	if(block->getChangesSince(held_version, changes) == false)
+		return false;
 	
-#if 0
-	// Analyze it a bit
-	bool completely_air = true;
-	for(s16 z0=0; z0<MAP_BLOCKSIZE; z0++)
-	for(s16 x0=0; x0<MAP_BLOCKSIZE; x0++)
-	for(s16 y0=0; y0<MAP_BLOCKSIZE; y0++)
+	/*
+		Only changes to the nodes of the block itself are sent; those
+		are the only ones it records.
+	*/
+	u32 nodesize = MapNode::serializedLength(client->serialization_version);
+	u32 replysize = 2+6+2;
+	for(core::list<MapBlockChange>::Iterator i = changes.begin();
+			i != changes.end(); i++)
+	{
+		if(getNodeBlockPos(i->p) != block->getPos())
+			return false;
+		replysize += 1+6;
+		if(i->remove == false)
+			replysize += nodesize;
+	}
+
+	SharedBuffer<u8> reply(replysize);
+	writeU16(&reply[0], TOCLIENT_BLOCKDIFF);
+	writeV3S16(&reply[2], block->getPos());
+	writeU16(&reply[8], changes.size());
+	u32 start = 10;
+	for(core::list<MapBlockChange>::Iterator i = changes.begin();
+			i != changes.end(); i++)
 	{
-		if(block->getNodeNoEx(v3s16(x0,y0,z0)).d != CONTENT_AIR)
+		writeU8(&reply[start], i->remove ? 1 : 0);
+		writeV3S16(&reply[start+1], i->p);
+		start += 7;
+		if(i->remove == false)
 		{
-			completely_air = false;
-			x0 = y0 = z0 = MAP_BLOCKSIZE; // Break out
+			i->n.serialize(&reply[start], client->serialization_version);
+			start += nodesize;
 		}
 	}
 
+	/*
+		Send on the same channel as the single node changes, so that
+		the changes are applied in the right order
+	*/
+	m_con.Send(client->peer_id, 0, reply, true);
+
+	return true;
+}
+
+void Server::updateQueuedLighting(u32 max_blocks)
+{
+	DSTACK(__FUNCTION_NAME);
+
+	core::map<v3s16, MapBlock*> relit_blocks;
+	m_env.getMap().updateQueuedLighting(max_blocks, relit_blocks);
+
+	JMutexAutoLock conlock(m_con_mutex);
+
+	for(core::map<u16, RemoteClient*>::Iterator
+			i = m_clients.getIterator();
+			i.atEnd() == false; i++)
+	{
+		RemoteClient *client = i.getNode()->getValue();
+		client->SetRelitBlocksNotSent(relit_blocks, m_env.getMap());
+	}
+}
+
+void Server::SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver)
+{
+	DSTACK(__FUNCTION_NAME);
+
+	v3s16 p = block->getPos();
+	
+#if 0
+	// Analyze it a bit
+	bool completely_air = block->getContents().isOnly(CONTENT_AIR);
+
 	// Print result
 	dstream<<"Server: Sending block ("<<p.X<<","<<p.Y<<","<<p.Z<<"): ";
 	if(completely_air)
@@ -3966,18 +4489,16 @@ void Server::SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver)
 		Create a packet with the block in the right format
 	*/
 	
-	std::ostringstream os(std::ios_base::binary);
-	block->serialize(os, ver);
-	std::string s = os.str();
-	SharedBuffer<u8> blockdata((u8*)s.c_str(), s.size());
+	// The block is serialized straight after the header
+	std::string s(8, 0);
+	writeU16((u8*)&s[0], TOCLIENT_BLOCKDATA);
+	writeS16((u8*)&s[2], p.X);
+	writeS16((u8*)&s[4], p.Y);
+	writeS16((u8*)&s[6], p.Z);
+	block->serialize(s, ver, m_block_compressor);
 
-	u32 replysize = 8 + blockdata.getSize();
-	SharedBuffer<u8> reply(replysize);
-	writeU16(&reply[0], TOCLIENT_BLOCKDATA);
-	writeS16(&reply[2], p.X);
-	writeS16(&reply[4], p.Y);
-	writeS16(&reply[6], p.Z);
-	memcpy(&reply[8], *blockdata, blockdata.getSize());
+	u32 replysize = s.size();
+	SharedBuffer<u8> reply((u8*)s.c_str(), replysize);
 
 	/*dstream<<"Server: Sending block ("<<p.X<<","<<p.Y<<","<<p.Z<<")"
 			<<":  \tpacket size: "<<replysize<<std::endl;*/
@@ -3995,6 +4516,13 @@ void Server::SendBlocks(float dtime)
 	JMutexAutoLock envlock(m_env_mutex);
 	JMutexAutoLock conlock(m_con_mutex);
 
+	/*
+		Send node changes made since the last step (by players) before
+		any blocks, so that changes sent in TOCLIENT_BLOCKDIFF are not
+		applied before older ones
+	*/
+	SendNodeChanges();
+
 	//TimeTaker timer("Server::SendBlocks");
 
 	core::array<PrioritySortedBlockTransfer> queue;
@@ -4046,9 +4574,21 @@ void Server::SendBlocks(float dtime)
 
 		RemoteClient *client = getClient(q.peer_id);
 
-		SendBlockNoLock(q.peer_id, block, client->serialization_version);
+		/*
+			If the client has an older version of the block, try to
+			send only the changes
+		*/
+		bool sent_changes = false;
+		u32 held_version;
+		if(client->GetOutdatedVersion(q.pos, held_version))
+			sent_changes = SendBlockChangesNoLock(client, block, held_version);
+		
+		if(sent_changes == false)
+			SendBlockNoLock(q.peer_id, block, client->serialization_version);
 
 		client->SentBlock(q.pos);
+		if(m_env.getMap().isLightingQueued(q.pos))
+			client->SentBlockWithQueuedLighting(q.pos);
 
 		total_sending++;
 	}
@@ -4371,7 +4911,11 @@ void Server::handlePeerChange(PeerChange &c)
 		{
 			Player *player = m_env.getPlayer(c.peer_id);
 			if(player != NULL)
+			{
 				player->peer_id = 0;
+				// Save the state it was left in
+				player->setModified(true);
+			}
 		}
 		
 		// Delete client
@@ -30,6 +30,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "inventory.h"
 #include "auth.h"
 #include "ban.h"
+#include "serialization.h"
 
 /*
 	Some random functions
@@ -226,6 +227,100 @@ struct PrioritySortedBlockTransfer
 	u16 peer_id;
 };
 
+/*
+	A set of block positions that only covers a cube of the given radius
+	around a center position. Stored as a bitmap, so lookups don't
+	allocate and don't depend on how many positions are in the set.
+
+	Positions outside the cube are not stored, and moving the center
+	drops the positions that fall out of it.
+*/
+class CenteredBlockSet
+{
+public:
+	CenteredBlockSet():
+		m_center(0,0,0),
+		m_radius(-1),
+		m_count(0)
+	{
+	}
+
+	s16 getRadius()
+	{
+		return m_radius;
+	}
+	// Clears the set
+	void setRadius(s16 radius);
+	void setCenter(v3s16 center);
+
+	// Whether p is inside the cube, ie. can be stored
+	bool covers(v3s16 p)
+	{
+		return index(p) != -1;
+	}
+	bool contains(v3s16 p)
+	{
+		s32 i = index(p);
+		if(i == -1)
+			return false;
+		return (m_bits[i>>5] & ((u32)1<<(i&31))) != 0;
+	}
+	void insert(v3s16 p);
+	void remove(v3s16 p);
+	void clear();
+
+	u32 size()
+	{
+		return m_count;
+	}
+
+private:
+	// Returns -1 if p is outside the cube
+	s32 index(v3s16 p)
+	{
+		v3s16 rel = p - m_center;
+		if(rel.X < -m_radius || rel.X > m_radius
+		|| rel.Y < -m_radius || rel.Y > m_radius
+		|| rel.Z < -m_radius || rel.Z > m_radius)
+			return -1;
+		s32 side = 2*m_radius+1;
+		return ((s32)(rel.Z+m_radius)*side + (rel.Y+m_radius))*side
+				+ (rel.X+m_radius);
+	}
+
+	v3s16 m_center;
+	s16 m_radius;
+	u32 m_count;
+	core::array<u32> m_bits;
+};
+
+/*
+	A node change waiting to be sent to a client
+*/
+struct PendingNodeChange
+{
+	v3s16 p;
+	bool remove;
+	MapNode n;
+};
+
+/*
+	An inventory list as it was last sent to a client
+*/
+struct SentInventoryList
+{
+	u32 version;
+	/*
+		The id of the list and its modification count when it was
+		sent; the items are compared only if the list has been
+		modified or replaced since.
+	*/
+	u32 list_id;
+	u32 modification_count;
+	// Serialized items, empty string for empty slots
+	core::array<std::string> items;
+};
+
 class RemoteClient
 {
 public:
@@ -240,6 +335,10 @@ class RemoteClient
 	u16 net_proto_version;
 	// Version is stored in here after INIT before INIT2
 	u8 pending_serialization_version;
+	// Node changes that are sent together by Server::SendNodeChanges()
+	core::list<PendingNodeChange> pending_node_changes;
+	// Inventory lists last sent with TOCLIENT_INVENTORY_DIFF
+	core::map<std::string, SentInventoryList> sent_inventory_lists;
 
 	RemoteClient():
 		m_time_from_building(9999),
@@ -284,6 +383,40 @@ class RemoteClient
 	void SetBlockNotSent(v3s16 p);
 	void SetBlocksNotSent(core::map<v3s16, MapBlock*> &blocks);
 
+	/*
+		Marks blocks as changed after the client got them, so that only
+		the changes have to be sent. held_versions maps the positions of
+		the blocks to the versions the client got.
+	*/
+	void SetBlocksOutdated(core::map<v3s16, u32> &held_versions);
+	/*
+		Returns true if the client has an outdated version of the block
+		and puts the version into held_version.
+	*/
+	bool GetOutdatedVersion(v3s16 p, u32 &held_version);
+	/*
+		Called for blocks that were sent while their lighting was
+		waiting for an update (see Map::isLightingQueued()).
+	*/
+	void SentBlockWithQueuedLighting(v3s16 p)
+	{
+		m_blocks_queued_lighting.insert(p, true);
+	}
+	/*
+		Called after queued lighting updates; relit_blocks are the
+		blocks whose light changed. Only blocks that the client got
+		with approximate light are sent again; the client relights the
+		others itself when it gets the node changes.
+	*/
+	void SetRelitBlocksNotSent(core::map<v3s16, MapBlock*> &relit_blocks,
+			Map &map);
+	// Whether the client has some version of the block
+	bool HasBlock(v3s16 p)
+	{
+		return m_blocks_sent.contains(p)
+				|| m_blocks_outdated.find(p) != NULL;
+	}
+
 	s32 SendingCount()
 	{
 		return m_blocks_sending.size();
@@ -327,10 +460,19 @@ class RemoteClient
 		- A block is cleared from here when client says it has
 		  deleted it from it's memory
 		
-		Key is position, value is dummy.
+		Only blocks near m_last_center are remembered; blocks that fall
+		out of range are forgotten and will be sent again if needed.
 		No MapBlock* is stored here because the blocks can get deleted.
 	*/
-	core::map<v3s16, bool> m_blocks_sent;
+	CenteredBlockSet m_blocks_sent;
+	/*
+		Blocks that have been sent to client but changed after that.
+		These are not in m_blocks_sent, so they will be sent again.
+
+		Key is position, value is the version of the block the
+		client has (see MapBlock::getVersion()).
+	*/
+	core::map<v3s16, u32> m_blocks_outdated;
 	s16 m_nearest_unsent_d;
 	v3s16 m_last_center;
 	float m_nearest_unsent_reset_timer;
@@ -345,6 +487,9 @@ class RemoteClient
 	*/
 	core::map<v3s16, float> m_blocks_sending;
 
+	// See SentBlockWithQueuedLighting()
+	core::map<v3s16, bool> m_blocks_queued_lighting;
+
 	/*
 		Count of excess GotBlocks().
 		There is an excess amount because the client sometimes
@@ -502,6 +647,11 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void SendObjectData(float dtime);
 	void SendPlayerInfos();
 	void SendInventory(u16 peer_id);
+	/*
+		Sends the slots of the inventory of player that have changed
+		since they were last sent to client (TOCLIENT_INVENTORY_DIFF)
+	*/
+	void SendInventoryDiff(RemoteClient *client, Player *player);
 	// send wielded item info about player to all
 	void SendWieldedItem(const Player *player);
 	// send wielded item info about all players to all players
@@ -519,10 +669,39 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 			core::list<u16> *far_players=NULL, float far_d_nodes=100);
 	void sendAddNode(v3s16 p, MapNode n, u16 ignore_id=0,
 			core::list<u16> *far_players=NULL, float far_d_nodes=100);
+	/*
+		Sends the node changes buffered by sendAddNode() and
+		sendRemoveNode() for clients that support TOCLIENT_NODECHANGES.
+		Connection should be locked when this is called.
+	*/
+	void SendNodeChanges();
 	void setBlockNotSent(v3s16 p);
+	/*
+		Records a node change in the change journal of the block the
+		node is in and marks the block outdated for far_players.
+		Has to be called for every node change sent with sendAddNode()
+		or sendRemoveNode(), after the map has been modified.
+	*/
+	void journalNodeChange(v3s16 p, bool remove, MapNode n,
+			core::map<v3s16, MapBlock*> &modified_blocks,
+			core::list<u16> &far_players);
+	/*
+		Updates queued lighting of blocks modified by players (see
+		Map::updateQueuedLighting()) and sends the relit blocks again
+		where needed.
+		Environment must be locked when called.
+	*/
+	void updateQueuedLighting(u32 max_blocks);
 	
 	// Environment and Connection must be locked when called
 	void SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver);
+	/*
+		Sends the changes made to block after held_version.
+		Returns false if it can't be done, and a whole block has to
+		be sent instead.
+	*/
+	bool SendBlockChangesNoLock(RemoteClient *client, MapBlock *block,
+			u32 held_version);
 	
 	// Sends blocks to clients (locks env and con on its own)
 	void SendBlocks(float dtime);
@@ -592,6 +771,16 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 
 	// Bann checking
 	BanManager m_banmanager;
+
+	// Used by RemoteClient for iterating blocks around the player.
+	// Only accessed from the server thread.
+	FacePositionCache m_face_position_cache;
+
+	// Compresses blocks for sending. Only accessed from the server thread.
+	ZlibCompressor m_block_compressor;
+
+	// Last assigned MapBlock version (behind m_env_mutex)
+	u32 m_block_version_counter;
 	
 	/*
 		Threads
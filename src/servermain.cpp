@@ -69,7 +69,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "materials.h"
 #include "config.h"
 #include "mineral.h"
+#include "content_craft.h"
 #include "filesys.h"
+#include "pregenerate.h"
 
 /*
 	Settings.
@@ -183,6 +185,12 @@ int main(int argc, char *argv[])
 	allowed_options.insert("disable-unittests", ValueSpec(VALUETYPE_FLAG));
 	allowed_options.insert("enable-unittests", ValueSpec(VALUETYPE_FLAG));
 	allowed_options.insert("map-dir", ValueSpec(VALUETYPE_STRING));
+	allowed_options.insert("pregenerate-min", ValueSpec(VALUETYPE_STRING,
+			"Generate map from block position (x,y,z) and exit"));
+	allowed_options.insert("pregenerate-max", ValueSpec(VALUETYPE_STRING,
+			"Generate map to block position (x,y,z) and exit"));
+	allowed_options.insert("pregenerate-threads", ValueSpec(VALUETYPE_STRING,
+			"Number of threads used for generating (default: all processors)"));
 
 	Settings cmd_args;
 	
@@ -272,6 +280,7 @@ int main(int argc, char *argv[])
 	
 	init_mapnode();
 	init_mineral();
+	craft_init();
 
 	/*
 		Run unit tests
@@ -322,6 +331,40 @@ int main(int argc, char *argv[])
 	else if(g_settings.exists("map-dir"))
 		map_dir = g_settings.get("map-dir");
 	
+	/*
+		Pregenerate map and exit
+	*/
+	if(cmd_args.exists("pregenerate-min") || cmd_args.exists("pregenerate-max"))
+	{
+		if(cmd_args.exists("pregenerate-min") == false
+				|| cmd_args.exists("pregenerate-max") == false)
+		{
+			dstream<<"Both --pregenerate-min and --pregenerate-max "
+					<<"have to be given"<<std::endl;
+			return 1;
+		}
+		v3f minf = cmd_args.getV3F("pregenerate-min");
+		v3f maxf = cmd_args.getV3F("pregenerate-max");
+		v3s16 blockpos_min(
+				MYMIN(minf.X, maxf.X),
+				MYMIN(minf.Y, maxf.Y),
+				MYMIN(minf.Z, maxf.Z));
+		v3s16 blockpos_max(
+				MYMAX(minf.X, maxf.X),
+				MYMAX(minf.Y, maxf.Y),
+				MYMAX(minf.Z, maxf.Z));
+
+		u32 thread_count = porting::getNumberOfProcessors();
+		if(cmd_args.exists("pregenerate-threads"))
+			thread_count = cmd_args.getU16("pregenerate-threads");
+
+		ServerMap map(map_dir);
+		MapPregenerator pregen(&map, blockpos_min, blockpos_max);
+		pregen.run(thread_count, kill);
+		
+		return 0;
+	}
+	
 	// Create server
 	Server server(map_dir.c_str(), configpath);
 	server.start(port);
@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common_irrlicht.h"
 #include "activeobject.h"
 #include "utility.h"
+#include "collision.h"
 
 /*
 
@@ -80,6 +81,27 @@ class ServerActiveObject : public ActiveObject
 			packet.
 	*/
 	virtual void step(float dtime, bool send_recommended){}
+
+	/*
+		The environment steps objects with these, so that the moves of
+		all objects can be done at the same time in many threads:
+		- stepBeforeMove() does everything up to moving the object and
+		  puts the move in move. If it returns false, there is no move
+		  and stepAfterMove() is not called.
+		- The environment does the moves (see CollisionMoveThreads)
+		- stepAfterMove() gets the result of the move and does the rest.
+		Both are called for one object at a time, in the order of ids.
+		By default, stepBeforeMove() calls step().
+	*/
+	virtual bool stepBeforeMove(float dtime, bool send_recommended,
+			CollisionMove &move)
+	{
+		step(dtime, send_recommended);
+		return false;
+	}
+	virtual void stepAfterMove(bool send_recommended,
+			const CollisionMove &move)
+	{}
 	
 	/*
 		The return value of this is passed to the client-side object
@@ -32,6 +32,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "porting.h"
 #include "content_mapnode.h"
 #include "mapsector.h"
+#include "mapblock_visibility.h"
+
+// Print how long the lighting versions take on a larger area
+#define TEST_LIGHTING_TIMINGS 0
 
 /*
 	Asserts that the exception occurs
@@ -242,6 +246,7 @@ struct TestVoxelManipulator
 		VoxelArea a(v3s16(-1,-1,-1), v3s16(1,1,1));
 		assert(a.index(0,0,0) == 1*3*3 + 1*3 + 1);
 		assert(a.index(-1,-1,-1) == 0);
+		assert(a.position(a.index(1,-1,0)) == v3s16(1,-1,0));
 		
 		VoxelArea c(v3s16(-2,-2,-2), v3s16(2,2,2));
 		// An area that is 1 bigger in x+ and z-
@@ -372,6 +377,443 @@ struct TestVoxelManipulator
 	}
 };
 
+struct TestVoxelLighting
+{
+	/*
+		Air with scattered stone and a wall with a hole in it, lit
+		by a few sources. Light reaches the edges of the area, so the
+		area grows while spreading.
+	*/
+	VoxelArea makeVolume(VoxelManipulator &v,
+			core::map<v3s16, bool> &light_sources)
+	{
+		VoxelArea area(v3s16(0,0,0), v3s16(23,15,23));
+		v.addArea(area);
+		for(s16 z=area.MinEdge.Z; z<=area.MaxEdge.Z; z++)
+		for(s16 y=area.MinEdge.Y; y<=area.MaxEdge.Y; y++)
+		for(s16 x=area.MinEdge.X; x<=area.MaxEdge.X; x++)
+		{
+			MapNode n(CONTENT_AIR);
+			if((x*7 + y*13 + z*3) % 11 == 0)
+				n.setContent(CONTENT_STONE);
+			if(x == 12 && !(y >= 6 && y <= 8 && z >= 10 && z <= 12))
+				n.setContent(CONTENT_STONE);
+			v.setNode(v3s16(x,y,z), n);
+		}
+
+		v3s16 sources[4] = {
+			v3s16(3,3,3),
+			v3s16(20,10,5),
+			v3s16(6,15,18),
+			v3s16(10,7,11),
+		};
+		u8 lights[4] = {LIGHT_MAX, LIGHT_MAX, LIGHT_SUN, 8};
+		for(u16 i=0; i<4; i++)
+		{
+			v.getNodeRef(sources[i]).setLight(LIGHTBANK_DAY, lights[i]);
+			light_sources.insert(sources[i], true);
+		}
+		return area;
+	}
+
+	void compareLight(VoxelManipulator &v1, VoxelManipulator &v2,
+			VoxelArea area)
+	{
+		for(s16 z=area.MinEdge.Z; z<=area.MaxEdge.Z; z++)
+		for(s16 y=area.MinEdge.Y; y<=area.MaxEdge.Y; y++)
+		for(s16 x=area.MinEdge.X; x<=area.MaxEdge.X; x++)
+		{
+			v3s16 p(x,y,z);
+			assert(v1.getNode(p).getLight(LIGHTBANK_DAY)
+					== v2.getNode(p).getLight(LIGHTBANK_DAY));
+		}
+	}
+
+	void Run()
+	{
+		/*
+			Spreading has to give the same result as the recursive
+			versions
+		*/
+
+		VoxelManipulator v_recursive;
+		VoxelManipulator v_set;
+		VoxelManipulator v_queue;
+		core::map<v3s16, bool> light_sources;
+		VoxelArea area = makeVolume(v_recursive, light_sources);
+		makeVolume(v_set, light_sources);
+		makeVolume(v_queue, light_sources);
+
+		for(core::map<v3s16, bool>::Iterator
+				i = light_sources.getIterator();
+				i.atEnd() == false; i++)
+			v_recursive.spreadLight(LIGHTBANK_DAY, i.getNode()->getKey());
+		v_set.spreadLight(LIGHTBANK_DAY, light_sources);
+		{
+			core::map<v3s16, u8> no_nodes;
+			v_queue.updateLight(LIGHTBANK_DAY, no_nodes, light_sources);
+		}
+
+		compareLight(v_recursive, v_queue, area);
+		compareLight(v_set, v_queue, area);
+		// Light gets through the hole in the wall
+		assert(v_queue.getNode(v3s16(13,7,11)).getLight(LIGHTBANK_DAY) > 0);
+
+		/*
+			Removing lights has to give the same result as unspreading
+			and then spreading
+		*/
+
+		core::map<v3s16, u8> unlight_from;
+		v3s16 removed[2] = {v3s16(3,3,3), v3s16(6,15,18)};
+		for(u16 i=0; i<2; i++)
+		{
+			MapNode &n1 = v_set.getNodeRef(removed[i]);
+			unlight_from.insert(removed[i], n1.getLight(LIGHTBANK_DAY));
+			n1.setLight(LIGHTBANK_DAY, 0);
+			v_queue.getNodeRef(removed[i]).setLight(LIGHTBANK_DAY, 0);
+		}
+
+		{
+			core::map<v3s16, bool> found_sources;
+			v_set.unspreadLight(LIGHTBANK_DAY, unlight_from, found_sources);
+			v_set.spreadLight(LIGHTBANK_DAY, found_sources);
+		}
+		{
+			core::map<v3s16, bool> no_sources;
+			v_queue.updateLight(LIGHTBANK_DAY, unlight_from, no_sources);
+		}
+
+		compareLight(v_set, v_queue, area);
+		// Nothing else reaches this far
+		assert(v_queue.getNode(v3s16(3,3,3)).getLight(LIGHTBANK_DAY) == 0);
+	}
+};
+
+/*
+	Times spreading and removing light with the recursive versions and
+	with updateLight(). Only run when TEST_LIGHTING_TIMINGS is set.
+*/
+struct TestVoxelLightingTimings
+{
+	VoxelArea makeVolume(VoxelManipulator &v,
+			core::map<v3s16, bool> &light_sources)
+	{
+		VoxelArea area(v3s16(0,0,0), v3s16(79,47,79));
+		v.addArea(area);
+		for(s16 z=area.MinEdge.Z; z<=area.MaxEdge.Z; z++)
+		for(s16 y=area.MinEdge.Y; y<=area.MaxEdge.Y; y++)
+		for(s16 x=area.MinEdge.X; x<=area.MaxEdge.X; x++)
+		{
+			MapNode n(CONTENT_AIR);
+			if((x*7 + y*13 + z*3) % 11 == 0)
+				n.setContent(CONTENT_STONE);
+			v3s16 p(x,y,z);
+			v.setNode(p, n);
+			if(x % 10 == 5 && y % 12 == 6 && z % 10 == 5)
+			{
+				v.getNodeRef(p).setLight(LIGHTBANK_DAY, LIGHT_MAX);
+				light_sources.insert(p, true);
+			}
+		}
+		return area;
+	}
+
+	void Run()
+	{
+		VoxelManipulator v_recursive;
+		VoxelManipulator v_set;
+		VoxelManipulator v_queue;
+		core::map<v3s16, bool> light_sources;
+		makeVolume(v_recursive, light_sources);
+		makeVolume(v_set, light_sources);
+		makeVolume(v_queue, light_sources);
+
+		{
+			TimeTaker timer("spreadLight() from each source");
+			for(core::map<v3s16, bool>::Iterator
+					i = light_sources.getIterator();
+					i.atEnd() == false; i++)
+				v_recursive.spreadLight(LIGHTBANK_DAY, i.getNode()->getKey());
+		}
+		{
+			TimeTaker timer("spreadLight() from all sources");
+			v_set.spreadLight(LIGHTBANK_DAY, light_sources);
+		}
+		{
+			TimeTaker timer("updateLight() spreading");
+			core::map<v3s16, u8> no_nodes;
+			v_queue.updateLight(LIGHTBANK_DAY, no_nodes, light_sources);
+		}
+
+		core::map<v3s16, u8> unlight_from;
+		for(core::map<v3s16, bool>::Iterator
+				i = light_sources.getIterator();
+				i.atEnd() == false; i++)
+		{
+			v3s16 p = i.getNode()->getKey();
+			if(p.X % 20 != 5)
+				continue;
+			MapNode &n1 = v_set.getNodeRef(p);
+			unlight_from.insert(p, n1.getLight(LIGHTBANK_DAY));
+			n1.setLight(LIGHTBANK_DAY, 0);
+			v_queue.getNodeRef(p).setLight(LIGHTBANK_DAY, 0);
+		}
+
+		{
+			TimeTaker timer("unspreadLight() and spreadLight()");
+			core::map<v3s16, bool> found_sources;
+			v_set.unspreadLight(LIGHTBANK_DAY, unlight_from, found_sources);
+			v_set.spreadLight(LIGHTBANK_DAY, found_sources);
+		}
+		{
+			TimeTaker timer("updateLight() removing");
+			core::map<v3s16, bool> no_sources;
+			v_queue.updateLight(LIGHTBANK_DAY, unlight_from, no_sources);
+		}
+	}
+};
+
+struct TestMapBlockContents
+{
+	void Run()
+	{
+		u32 nodecount = MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE;
+
+		MapBlock b(NULL, v3s16(0,0,0));
+		const MapBlockContents &c = b.getContents();
+
+		// A new block is all ignore
+		assert(c.isOnly(CONTENT_IGNORE));
+		assert(c.count(CONTENT_IGNORE) == nodecount);
+
+		MapNode n(CONTENT_AIR);
+		for(s16 z=0; z<MAP_BLOCKSIZE; z++)
+		for(s16 y=0; y<MAP_BLOCKSIZE; y++)
+		for(s16 x=0; x<MAP_BLOCKSIZE; x++)
+			b.setNode(v3s16(x,y,z), n);
+		assert(c.isOnly(CONTENT_AIR));
+		assert(c.contains(CONTENT_IGNORE) == false);
+		assert(c.getAirCount() == nodecount);
+
+		n = MapNode(CONTENT_STONE);
+		b.setNode(v3s16(1,2,3), n);
+		assert(c.getTypeCount() == 2);
+		assert(c.count(CONTENT_STONE) == 1);
+		assert(c.getSolidCount() == 1);
+		assert(c.getAirCount() == nodecount - 1);
+
+		// Replacing the stone removes it from the counts
+		n = MapNode(CONTENT_WATERSOURCE);
+		b.setNode(v3s16(1,2,3), n);
+		assert(c.contains(CONTENT_STONE) == false);
+		assert(c.getTypeCount() == 2);
+		assert(c.getSolidCount() == 0);
+		assert(c.getLiquidCount() == 1);
+
+		n = MapNode(CONTENT_TORCH);
+		b.setNode(v3s16(4,5,6), n);
+		assert(c.getLightSourceCount() == 1);
+		assert(c.getAirCount() == nodecount - 2);
+
+		// The summary is rebuilt when the block is deserialized
+		std::ostringstream os(std::ios_base::binary);
+		b.serialize(os, SER_FMT_VER_HIGHEST);
+		std::istringstream is(os.str(), std::ios_base::binary);
+		MapBlock b2(NULL, v3s16(0,0,0));
+		b2.deSerialize(is, SER_FMT_VER_HIGHEST);
+		const MapBlockContents &c2 = b2.getContents();
+		assert(c2.getTypeCount() == 3);
+		assert(c2.count(CONTENT_AIR) == nodecount - 2);
+		assert(c2.count(CONTENT_WATERSOURCE) == 1);
+		assert(c2.count(CONTENT_TORCH) == 1);
+		assert(c2.getLightSourceCount() == 1);
+	}
+};
+
+struct TestSunlightHeights
+{
+	void Run()
+	{
+		Map map(dstream);
+		ServerMapSector *sector = new ServerMapSector(&map, v2s16(0,0));
+		s16 y;
+
+		// Not known until initialized or loaded
+		assert(sector->getSunlightHeight(v2s16(1,1), y) == false);
+
+		sector->initSunlightHeights();
+		assert(sector->getSunlightHeight(v2s16(1,1), y));
+		assert(y == SUNLIGHT_HEIGHT_NONE);
+
+		MapNode air(CONTENT_AIR);
+		MapNode stone(CONTENT_STONE);
+
+		// Two blocks of air on top of each other
+		MapBlock *b0 = sector->createBlankBlock(0);
+		MapBlock *b1 = sector->createBlankBlock(1);
+		for(s16 z0=0; z0<MAP_BLOCKSIZE; z0++)
+		for(s16 y0=0; y0<MAP_BLOCKSIZE; y0++)
+		for(s16 x0=0; x0<MAP_BLOCKSIZE; x0++)
+		{
+			b0->setNode(v3s16(x0,y0,z0), air);
+			b1->setNode(v3s16(x0,y0,z0), air);
+		}
+		sector->updateSunlightHeights(b1);
+		sector->updateSunlightHeights(b0);
+		assert(sector->getSunlightHeight(v2s16(1,1), y));
+		assert(y == SUNLIGHT_HEIGHT_NONE);
+
+		// Stone at the bottom of the upper block
+		b1->setNode(v3s16(1,0,1), stone);
+		sector->updateSunlightHeight(v3s16(1,MAP_BLOCKSIZE,1));
+		sector->getSunlightHeight(v2s16(1,1), y);
+		assert(y == MAP_BLOCKSIZE);
+
+		// Stone under it doesn't change it
+		b0->setNode(v3s16(1,3,1), stone);
+		sector->updateSunlightHeight(v3s16(1,3,1));
+		sector->getSunlightHeight(v2s16(1,1), y);
+		assert(y == MAP_BLOCKSIZE);
+
+		// Removing the highest one finds the one under it
+		b1->setNode(v3s16(1,0,1), air);
+		sector->updateSunlightHeight(v3s16(1,MAP_BLOCKSIZE,1));
+		sector->getSunlightHeight(v2s16(1,1), y);
+		assert(y == 3);
+
+		// A block that has been changed is looked through as a whole
+		b0->setNode(v3s16(1,3,1), air);
+		b0->setNode(v3s16(1,7,1), stone);
+		sector->updateSunlightHeights(b0);
+		sector->getSunlightHeight(v2s16(1,1), y);
+		assert(y == 7);
+
+		// The heights are stored in the metadata
+		std::ostringstream os(std::ios_base::binary);
+		sector->serialize(os, SER_FMT_VER_HIGHEST);
+		std::istringstream is(os.str(), std::ios_base::binary);
+		core::map<v2s16, MapSector*> sectors;
+		ServerMapSector *sector2 = ServerMapSector::deSerialize(
+				is, &map, v2s16(0,0), sectors);
+		assert(sector2->getSunlightHeight(v2s16(1,1), y));
+		assert(y == 7);
+		assert(sector2->getSunlightHeight(v2s16(2,1), y));
+		assert(y == SUNLIGHT_HEIGHT_NONE);
+
+		delete sector2;
+		delete sector;
+	}
+};
+
+struct TestBlockVisibility
+{
+	// Blocks that are not given are not loaded
+	class TC : public BlockConnectivitySource
+	{
+	public:
+		bool getFaceConnectivity(v3s16 blockpos, u16 &connectivity)
+		{
+			core::map<v3s16, u16>::Node *n = blocks.find(blockpos);
+			if(n == NULL)
+				return false;
+			connectivity = n->getValue();
+			return true;
+		}
+		core::map<v3s16, u16> blocks;
+	};
+
+	bool contains(core::array<v3s16> &a, v3s16 p)
+	{
+		return a.linear_search(p) != -1;
+	}
+
+	void Run()
+	{
+		/*
+			Face connectivity
+		*/
+
+		VoxelManipulator v;
+		VoxelArea area(v3s16(0,0,0), v3s16(1,1,1)*(MAP_BLOCKSIZE-1));
+
+		// Nodes that are not known are seen through
+		assert(get_face_connectivity(v, v3s16(0,0,0))
+				== FACE_CONNECTIVITY_ALL);
+
+		v.addArea(area);
+		for(s16 z=0; z<MAP_BLOCKSIZE; z++)
+		for(s16 y=0; y<MAP_BLOCKSIZE; y++)
+		for(s16 x=0; x<MAP_BLOCKSIZE; x++)
+			v.setNodeNoRef(v3s16(x,y,z), MapNode(CONTENT_STONE));
+		assert(get_face_connectivity(v, v3s16(0,0,0)) == 0);
+
+		// A tunnel along X
+		for(s16 x=0; x<MAP_BLOCKSIZE; x++)
+			v.setNodeNoRef(v3s16(x,5,7), MapNode(CONTENT_AIR));
+		u16 tunnel = get_face_connectivity(v, v3s16(0,0,0));
+		// Faces are numbered like g_6dirs: 2 = X+, 5 = X-
+		assert(faces_connected(tunnel, 2, 5));
+		assert(faces_connected(tunnel, 1, 4) == false);
+		assert(faces_connected(tunnel, 0, 2) == false);
+
+		// A shaft from the tunnel to the top
+		for(s16 y=5; y<MAP_BLOCKSIZE; y++)
+			v.setNodeNoRef(v3s16(3,y,7), MapNode(CONTENT_AIR));
+		u16 c = get_face_connectivity(v, v3s16(0,0,0));
+		assert(faces_connected(c, 1, 5));
+		assert(faces_connected(c, 1, 2));
+		assert(faces_connected(c, 1, 4) == false);
+
+		/*
+			Visible blocks
+		*/
+
+		TC tc;
+		v3f camera_pos = intToFloat(v3s16(1,1,1)*MAP_BLOCKSIZE/2, BS);
+		v3f camera_dir(1,0,0);
+		f32 range = 100;
+		// Solid ground around the tunnel and at its end
+		for(s16 z=-1; z<=1; z++)
+		for(s16 y=-1; y<=1; y++)
+		for(s16 x=-1; x<=7; x++)
+			tc.blocks.insert(v3s16(x,y,z), 0);
+		tc.blocks[v3s16(0,0,0)] = FACE_CONNECTIVITY_ALL;
+		for(s16 x=1; x<=4; x++)
+			tc.blocks[v3s16(x,0,0)] = tunnel;
+		// A wall in the tunnel
+		tc.blocks[v3s16(3,0,0)] = 0;
+		tc.blocks[v3s16(6,0,0)] = FACE_CONNECTIVITY_ALL;
+
+		core::array<v3s16> visible;
+		find_visible_blocks(&tc, camera_pos, camera_dir, range, visible);
+		assert(contains(visible, v3s16(0,0,0)));
+		assert(contains(visible, v3s16(2,0,0)));
+		// The wall is seen but not what is behind it
+		assert(contains(visible, v3s16(3,0,0)));
+		assert(contains(visible, v3s16(4,0,0)) == false);
+		// The ground around the tunnel is not seen
+		assert(contains(visible, v3s16(1,1,0)) == false);
+		assert(contains(visible, v3s16(2,0,1)) == false);
+
+		tc.blocks[v3s16(3,0,0)] = tunnel;
+		visible.clear();
+		find_visible_blocks(&tc, camera_pos, camera_dir, range, visible);
+		assert(contains(visible, v3s16(4,0,0)));
+		assert(contains(visible, v3s16(5,0,0)));
+		assert(contains(visible, v3s16(6,0,0)) == false);
+
+		// Blocks that are not loaded are seen through but not listed
+		tc.blocks.remove(v3s16(2,0,0));
+		visible.clear();
+		find_visible_blocks(&tc, camera_pos, camera_dir, range, visible);
+		assert(contains(visible, v3s16(1,0,0)));
+		assert(contains(visible, v3s16(2,0,0)) == false);
+		assert(contains(visible, v3s16(3,0,0)));
+		assert(contains(visible, v3s16(4,0,0)));
+	}
+};
+
 /*
 	NOTE: These tests became non-working then NodeContainer was removed.
 	      These should be redone, utilizing some kind of a virtual
@@ -1069,6 +1511,12 @@ void run_tests()
 	TEST(TestCompress);
 	TEST(TestMapNode);
 	TEST(TestVoxelManipulator);
+	TEST(TestVoxelLighting);
+	if(TEST_LIGHTING_TIMINGS)
+		TEST(TestVoxelLightingTimings);
+	TEST(TestMapBlockContents);
+	TEST(TestSunlightHeights);
+	TEST(TestBlockVisibility);
 	//TEST(TestMapBlock);
 	//TEST(TestMapSector);
 	if(INTERNET_SIMULATOR == false){
@@ -32,6 +32,12 @@ typedef pthread_t threadid_t;
 #define __FUNCTION_NAME __PRETTY_FUNCTION__
 #endif
 
+#ifdef _MSC_VER
+#define __THREAD_LOCAL __declspec(thread)
+#else
+#define __THREAD_LOCAL __thread
+#endif
+
 inline threadid_t get_current_thread_id()
 {
 #if (defined(WIN32) || defined(_WIN32_WCE))
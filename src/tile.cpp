@@ -22,6 +22,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "main.h" // for g_settings
 #include "filesys.h"
 #include "utility.h"
+#include "porting.h"
+#include "strfnd.h"
+#include "sha1.h"
+#include <fstream>
+#include <iomanip>
 
 /*
 	A cache from texture name to texture path
@@ -480,6 +485,153 @@ AtlasPointer TextureSource::getTexture(u32 id)
 	return m_atlaspointer_cache[id].a;
 }
 
+/*
+	Position of a texture in the main atlas, in pixels
+*/
+struct AtlasCacheEntry
+{
+	std::string name;
+	v2s32 pos;
+	core::dimension2d<u32> dim;
+};
+
+/*
+	The main atlas is cached in files between runs
+*/
+
+static std::string getAtlasCacheDir()
+{
+	return porting::path_userdata + "/cache/textures";
+}
+
+/*
+	Makes a key that changes whenever the main atlas would come out
+	differently: it is a hash of the names of the textures in it and the
+	contents of the files they are made of.
+*/
+static std::string getAtlasCacheKey(const core::array<std::string> &sourcelist)
+{
+	SHA1 sha1;
+	// Change this when the atlas is made differently
+	std::string version = "atlas1";
+	sha1.addBytes(version.c_str(), version.size());
+	for(u32 i=0; i<sourcelist.size(); i++)
+	{
+		const std::string &name = sourcelist[i];
+		sha1.addBytes(name.c_str(), name.size()+1);
+		
+		// Hash the files that the name refers to
+		Strfnd f(name);
+		while(f.atend() == false)
+		{
+			std::string part = f.next("^");
+			// Parts starting with '[' are generated, not loaded
+			if(part == "" || part[0] == '[')
+				continue;
+			std::string path = getTexturePath(part);
+			sha1.addBytes(path.c_str(), path.size()+1);
+			std::ifstream is(path.c_str(), std::ios_base::binary);
+			char buf[1024];
+			while(is.good())
+			{
+				is.read(buf, sizeof(buf));
+				sha1.addBytes(buf, is.gcount());
+			}
+		}
+	}
+	unsigned char *digest = sha1.getDigest();
+	std::ostringstream os;
+	for(u32 i=0; i<20; i++)
+		os<<std::hex<<std::setw(2)<<std::setfill('0')<<(u32)digest[i];
+	free(digest);
+	return os.str();
+}
+
+/*
+	Loads the atlas image and its layout saved by saveAtlasCache().
+	Returns NULL if there is no cached atlas with the key.
+*/
+static video::IImage* loadAtlasCache(video::IVideoDriver *driver,
+		const std::string &key, core::array<AtlasCacheEntry> &layout)
+{
+	std::string dir = getAtlasCacheDir();
+	std::ifstream is((dir + "/main_atlas.txt").c_str());
+	if(is.good() == false)
+		return NULL;
+	
+	std::string cached_key;
+	std::getline(is, cached_key);
+	if(cached_key != key)
+	{
+		dstream<<"INFO: Cached texture atlas is out of date"<<std::endl;
+		return NULL;
+	}
+
+	core::array<AtlasCacheEntry> entries;
+	for(;;)
+	{
+		std::string line;
+		std::getline(is, line);
+		if(is.eof() && line == "")
+			break;
+		if(is.fail())
+			return NULL;
+		std::istringstream ls(line);
+		AtlasCacheEntry entry;
+		ls>>entry.name>>entry.pos.X>>entry.pos.Y
+				>>entry.dim.Width>>entry.dim.Height;
+		if(ls.fail())
+			return NULL;
+		entries.push_back(entry);
+	}
+
+	video::IImage *img = driver->createImageFromFile(
+			(dir + "/main_atlas.png").c_str());
+	if(img == NULL)
+		return NULL;
+	
+	// Make a copy with the right color format
+	video::IImage *img2 =
+			driver->createImage(video::ECF_A8R8G8B8, img->getDimension());
+	img->copyTo(img2);
+	img->drop();
+
+	layout = entries;
+	return img2;
+}
+
+/*
+	Saves the atlas image and its layout for the next run
+*/
+static void saveAtlasCache(video::IVideoDriver *driver,
+		const std::string &key, video::IImage *img,
+		const core::array<AtlasCacheEntry> &layout)
+{
+	std::string dir = getAtlasCacheDir();
+	if(fs::CreateAllDirs(dir) == false)
+	{
+		dstream<<"WARNING: Couldn't create texture cache directory \""
+				<<dir<<"\""<<std::endl;
+		return;
+	}
+
+	if(driver->writeImageToFile(img, (dir + "/main_atlas.png").c_str())
+			== false)
+	{
+		dstream<<"WARNING: Couldn't write cached texture atlas"<<std::endl;
+		return;
+	}
+
+	std::ofstream os((dir + "/main_atlas.txt").c_str());
+	os<<key<<"\n";
+	for(u32 i=0; i<layout.size(); i++)
+	{
+		const AtlasCacheEntry &entry = layout[i];
+		os<<entry.name<<" "<<entry.pos.X<<" "<<entry.pos.Y<<" "
+				<<entry.dim.Width<<" "<<entry.dim.Height<<"\n";
+	}
+}
+
 void TextureSource::buildMainAtlas() 
 {
 	dstream<<"TextureSource::buildMainAtlas()"<<std::endl;
@@ -491,11 +643,8 @@ void TextureSource::buildMainAtlas()
 
 	JMutexAutoLock lock(m_atlaspointer_cache_mutex);
 
-	// Create an image of the right size
+	// Size of the atlas image
 	core::dimension2d<u32> atlas_dim(1024,1024);
-	video::IImage *atlas_img =
-			driver->createImage(video::ECF_A8R8G8B8, atlas_dim);
-	assert(atlas_img);
 
 	/*
 		A list of stuff to add. This should contain as much of the
@@ -527,120 +676,157 @@ void TextureSource::buildMainAtlas()
 	// Padding to disallow texture bleeding
 	s32 padding = 16;
 
+	// Each texture is tiled a few times in the X direction
+	u16 xwise_tiling = 16;
+
+	// Where each texture is in the atlas
+	core::array<AtlasCacheEntry> layout;
+
 	/*
-		First pass: generate almost everything
+		Use the atlas of an earlier run if nothing it was made of has
+		changed
 	*/
-	core::position2d<s32> pos_in_atlas(0,0);
+	std::string cache_key = getAtlasCacheKey(sourcelist);
+	video::IImage *atlas_img = loadAtlasCache(driver, cache_key, layout);
+	if(atlas_img != NULL)
+	{
+		dstream<<"INFO: TextureSource::buildMainAtlas(): Using cached "
+				<<"texture atlas"<<std::endl;
+		atlas_dim = atlas_img->getDimension();
+	}
+	else
+	{
+		// Create an image of the right size
+		atlas_img = driver->createImage(video::ECF_A8R8G8B8, atlas_dim);
+		assert(atlas_img);
+
+		/*
+			First pass: generate almost everything
+		*/
+		core::position2d<s32> pos_in_atlas(0,0);
 	
-	pos_in_atlas.Y += padding;
+		pos_in_atlas.Y += padding;
 
-	for(u32 i=0; i<sourcelist.size(); i++)
-	{
-		std::string name = sourcelist[i];
+		for(u32 i=0; i<sourcelist.size(); i++)
+		{
+			std::string name = sourcelist[i];
 
-		/*video::IImage *img = driver->createImageFromFile(
-				getTexturePath(name.c_str()).c_str());
-		if(img == NULL)
-			continue;
+			/*video::IImage *img = driver->createImageFromFile(
+					getTexturePath(name.c_str()).c_str());
+			if(img == NULL)
+				continue;
 		
-		core::dimension2d<u32> dim = img->getDimension();
-		// Make a copy with the right color format
-		video::IImage *img2 =
-				driver->createImage(video::ECF_A8R8G8B8, dim);
-		img->copyTo(img2);
-		img->drop();*/
+			core::dimension2d<u32> dim = img->getDimension();
+			// Make a copy with the right color format
+			video::IImage *img2 =
+					driver->createImage(video::ECF_A8R8G8B8, dim);
+			img->copyTo(img2);
+			img->drop();*/
 		
-		// Generate image by name
-		video::IImage *img2 = generate_image_from_scratch(name, m_device);
-		if(img2 == NULL)
-		{
-			dstream<<"WARNING: TextureSource::buildMainAtlas(): Couldn't generate texture atlas: Couldn't generate image \""<<name<<"\""<<std::endl;
-			continue;
-		}
+			// Generate image by name
+			video::IImage *img2 = generate_image_from_scratch(name, m_device);
+			if(img2 == NULL)
+			{
+				dstream<<"WARNING: TextureSource::buildMainAtlas(): Couldn't generate texture atlas: Couldn't generate image \""<<name<<"\""<<std::endl;
+				continue;
+			}
 
-		core::dimension2d<u32> dim = img2->getDimension();
+			core::dimension2d<u32> dim = img2->getDimension();
 
-		// Don't add to atlas if image is large
-		core::dimension2d<u32> max_size_in_atlas(32,32);
-		if(dim.Width > max_size_in_atlas.Width
-		|| dim.Height > max_size_in_atlas.Height)
-		{
-			dstream<<"INFO: TextureSource::buildMainAtlas(): Not adding "
-					<<"\""<<name<<"\" because image is large"<<std::endl;
-			continue;
-		}
+			// Don't add to atlas if image is large
+			core::dimension2d<u32> max_size_in_atlas(32,32);
+			if(dim.Width > max_size_in_atlas.Width
+			|| dim.Height > max_size_in_atlas.Height)
+			{
+				dstream<<"INFO: TextureSource::buildMainAtlas(): Not adding "
+						<<"\""<<name<<"\" because image is large"<<std::endl;
+				continue;
+			}
 
-		// Stop making atlas if atlas is full
-		if(pos_in_atlas.Y + dim.Height > atlas_dim.Height)
-		{
-			dstream<<"WARNING: TextureSource::buildMainAtlas(): "
-					<<"Atlas is full, not adding more textures."
-					<<std::endl;
-			break;
-		}
+			// Stop making atlas if atlas is full
+			if(pos_in_atlas.Y + dim.Height > atlas_dim.Height)
+			{
+				dstream<<"WARNING: TextureSource::buildMainAtlas(): "
+						<<"Atlas is full, not adding more textures."
+						<<std::endl;
+				break;
+			}
 		
-        dstream<<"INFO: TextureSource::buildMainAtlas(): Adding \""<<name
-                <<"\" to texture atlas"<<std::endl;
-
-		// Tile it a few times in the X direction
-		u16 xwise_tiling = 16;
-		for(u32 j=0; j<xwise_tiling; j++)
-		{
-			// Copy the copy to the atlas
-			img2->copyToWithAlpha(atlas_img,
-					pos_in_atlas + v2s32(j*dim.Width,0),
-					core::rect<s32>(v2s32(0,0), dim),
-					video::SColor(255,255,255,255),
-					NULL);
-		}
+	        dstream<<"INFO: TextureSource::buildMainAtlas(): Adding \""<<name
+	                <<"\" to texture atlas"<<std::endl;
 
-		// Copy the borders a few times to disallow texture bleeding
-		for(u32 side=0; side<2; side++) // top and bottom
-		for(s32 y0=0; y0<padding; y0++)
-		for(s32 x0=0; x0<(s32)xwise_tiling*(s32)dim.Width; x0++)
-		{
-			s32 dst_y;
-			s32 src_y;
-			if(side==0)
+			// Tile it a few times in the X direction
+			for(u32 j=0; j<xwise_tiling; j++)
 			{
-				dst_y = y0 + pos_in_atlas.Y + dim.Height;
-				src_y = pos_in_atlas.Y + dim.Height - 1;
+				// Copy the copy to the atlas
+				img2->copyToWithAlpha(atlas_img,
+						pos_in_atlas + v2s32(j*dim.Width,0),
+						core::rect<s32>(v2s32(0,0), dim),
+						video::SColor(255,255,255,255),
+						NULL);
 			}
-			else
+
+			// Copy the borders a few times to disallow texture bleeding
+			for(u32 side=0; side<2; side++) // top and bottom
+			for(s32 y0=0; y0<padding; y0++)
+			for(s32 x0=0; x0<(s32)xwise_tiling*(s32)dim.Width; x0++)
 			{
-				dst_y = -y0 + pos_in_atlas.Y-1;
-				src_y = pos_in_atlas.Y;
+				s32 dst_y;
+				s32 src_y;
+				if(side==0)
+				{
+					dst_y = y0 + pos_in_atlas.Y + dim.Height;
+					src_y = pos_in_atlas.Y + dim.Height - 1;
+				}
+				else
+				{
+					dst_y = -y0 + pos_in_atlas.Y-1;
+					src_y = pos_in_atlas.Y;
+				}
+				s32 x = x0 + pos_in_atlas.X * dim.Width;
+				video::SColor c = atlas_img->getPixel(x, src_y);
+				atlas_img->setPixel(x,dst_y,c);
 			}
-			s32 x = x0 + pos_in_atlas.X * dim.Width;
-			video::SColor c = atlas_img->getPixel(x, src_y);
-			atlas_img->setPixel(x,dst_y,c);
+
+			img2->drop();
+
+			AtlasCacheEntry entry;
+			entry.name = name;
+			entry.pos = pos_in_atlas;
+			entry.dim = dim;
+			layout.push_back(entry);
+
+			// Increment position
+			pos_in_atlas.Y += dim.Height + padding * 2;
 		}
 
-		img2->drop();
+		saveAtlasCache(driver, cache_key, atlas_img, layout);
+	}
+
+	/*
+		Add textures to caches
+	*/
+	for(u32 i=0; i<layout.size(); i++)
+	{
+		const AtlasCacheEntry &entry = layout[i];
 
-		/*
-			Add texture to caches
-		*/
-		
 		// Get next id
 		u32 id = m_atlaspointer_cache.size();
 
 		// Create AtlasPointer
 		AtlasPointer ap(id);
 		ap.atlas = NULL; // Set on the second pass
-		ap.pos = v2f((float)pos_in_atlas.X/(float)atlas_dim.Width,
-				(float)pos_in_atlas.Y/(float)atlas_dim.Height);
-		ap.size = v2f((float)dim.Width/(float)atlas_dim.Width,
-				(float)dim.Width/(float)atlas_dim.Height);
+		ap.pos = v2f((float)entry.pos.X/(float)atlas_dim.Width,
+				(float)entry.pos.Y/(float)atlas_dim.Height);
+		ap.size = v2f((float)entry.dim.Width/(float)atlas_dim.Width,
+				(float)entry.dim.Width/(float)atlas_dim.Height);
 		ap.tiled = xwise_tiling;
 
 		// Create SourceAtlasPointer and add to containers
-		SourceAtlasPointer nap(name, ap, atlas_img, pos_in_atlas, dim);
+		SourceAtlasPointer nap(entry.name, ap, atlas_img, entry.pos,
+				entry.dim);
 		m_atlaspointer_cache.push_back(nap);
-		m_name_to_id.insert(name, id);
-			
-		// Increment position
-		pos_in_atlas.Y += dim.Height + padding * 2;
+		m_name_to_id.insert(entry.name, id);
 	}
 
 	/*
@@ -142,6 +142,34 @@ const v3s16 g_27dirs[27] =
 	v3s16(0,0,0),
 };
 
+/*
+	FacePositionCache
+*/
+
+FacePositionCache::~FacePositionCache()
+{
+	for(u32 i=0; i<m_tables.size(); i++)
+		delete m_tables[i];
+}
+
+const core::array<v3s16> & FacePositionCache::get(u16 d)
+{
+	while(m_tables.size() <= d)
+	{
+		core::list<v3s16> list;
+		getFacePositions(list, m_tables.size());
+
+		core::array<v3s16> *table = new core::array<v3s16>;
+		table->reallocate(list.size());
+		for(core::list<v3s16>::Iterator i = list.begin();
+				i != list.end(); i++)
+			table->push_back(*i);
+
+		m_tables.push_back(table);
+	}
+	return *m_tables[d];
+}
+
 static unsigned long next = 1;
 
 /* RAND_MAX assumed to be 32767 */
@@ -638,6 +638,26 @@ inline void getFacePositions(core::list<v3s16> &list, u16 d)
 	}
 }
 
+/*
+	Precomputed tables of getFacePositions() results, so that the
+	borders of a "d-radius" cube don't have to be rebuilt into a new
+	list every time they are walked through.
+
+	Returned arrays stay valid as long as the cache exists.
+	Not thread-safe; use one cache per thread.
+*/
+class FacePositionCache
+{
+public:
+	~FacePositionCache();
+
+	const core::array<v3s16> & get(u16 d);
+
+private:
+	// Indexed by d; pointers so that references stay valid on growth
+	core::array<core::array<v3s16>*> m_tables;
+};
+
 class IndentationRaiser
 {
 public:
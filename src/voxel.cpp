@@ -166,22 +166,22 @@ void VoxelManipulator::addArea(VoxelArea area)
 	// Allocate and clear new data
 	MapNode *new_data = new MapNode[new_size];
 	u8 *new_flags = new u8[new_size];
-	for(s32 i=0; i<new_size; i++)
-	{
-		new_flags[i] = VOXELFLAG_NOT_LOADED;
-	}
+	memset(new_flags, VOXELFLAG_NOT_LOADED, new_size);
 	
-	// Copy old data
+	// Copy old data a row at a time. Nodes that are not loaded keep
+	// their flags, so copying their data too doesn't matter.
 	
-	for(s32 z=m_area.MinEdge.Z; z<=m_area.MaxEdge.Z; z++)
-	for(s32 y=m_area.MinEdge.Y; y<=m_area.MaxEdge.Y; y++)
-	for(s32 x=m_area.MinEdge.X; x<=m_area.MaxEdge.X; x++)
+	if(m_data)
 	{
-		// If loaded, copy data and flags
-		if((m_flags[m_area.index(x,y,z)] & VOXELFLAG_NOT_LOADED) == false)
+		s32 row_length = m_area.getExtent().X;
+		for(s32 z=m_area.MinEdge.Z; z<=m_area.MaxEdge.Z; z++)
+		for(s32 y=m_area.MinEdge.Y; y<=m_area.MaxEdge.Y; y++)
 		{
-			new_data[new_area.index(x,y,z)] = m_data[m_area.index(x,y,z)];
-			new_flags[new_area.index(x,y,z)] = m_flags[m_area.index(x,y,z)];
+			s32 i_old = m_area.index(m_area.MinEdge.X,y,z);
+			s32 i_new = new_area.index(m_area.MinEdge.X,y,z);
+			memcpy(&new_data[i_new], &m_data[i_old],
+					row_length*sizeof(MapNode));
+			memcpy(&new_flags[i_new], &m_flags[i_old], row_length);
 		}
 	}
 
@@ -670,4 +670,251 @@ void VoxelManipulator::spreadLight(enum LightBank bank,
 }
 #endif
 
+/*
+	FIFO queues of m_data indices, one for each light level.
+	pop() takes from the brightest level that has something in it.
+*/
+class LightQueue
+{
+public:
+	LightQueue():
+		m_level(-1)
+	{
+		for(u16 i=0; i<=LIGHT_SUN; i++)
+			m_heads[i] = 0;
+	}
+
+	void push(u8 level, u32 i)
+	{
+		assert(level <= LIGHT_SUN);
+		m_indices[level].push_back(i);
+		if((s16)level > m_level)
+			m_level = level;
+	}
+
+	bool pop(u8 &level, u32 &i)
+	{
+		while(m_level >= 0)
+		{
+			core::array<u32> &indices = m_indices[m_level];
+			if(m_heads[m_level] < indices.size())
+			{
+				level = m_level;
+				i = indices[m_heads[m_level]];
+				m_heads[m_level]++;
+				return true;
+			}
+			// Empty; keep the memory for the next round
+			indices.set_used(0);
+			m_heads[m_level] = 0;
+			m_level--;
+		}
+		return false;
+	}
+
+	// Translates the queued indices when the area has changed
+	void remap(const VoxelArea &from, const VoxelArea &to)
+	{
+		for(u16 l=0; l<=LIGHT_SUN; l++)
+		{
+			core::array<u32> &indices = m_indices[l];
+			for(u32 j=m_heads[l]; j<indices.size(); j++)
+				indices[j] = to.index(from.position(indices[j]));
+		}
+	}
+
+private:
+	core::array<u32> m_indices[LIGHT_SUN+1];
+	// Index of the next item to pop on each level
+	u32 m_heads[LIGHT_SUN+1];
+	// Highest level that can have something in it
+	s16 m_level;
+};
+
+/*
+	Emerges p and its neighbors unless they are loaded already, like
+	the recursive versions do for every node. If the area grows,
+	everything that holds indices is translated to the new area.
+*/
+static void emerge_light_neighbors(VoxelManipulator &v, v3s16 p,
+		LightQueue &queue, core::array<u32> &found_sources)
+{
+	VoxelArea &area = v.m_area;
+	if(p.X > area.MinEdge.X && p.X < area.MaxEdge.X
+			&& p.Y > area.MinEdge.Y && p.Y < area.MaxEdge.Y
+			&& p.Z > area.MinEdge.Z && p.Z < area.MaxEdge.Z)
+	{
+		v3s16 em = area.getExtent();
+		u32 stride_z = (u32)em.X * em.Y;
+		u32 i = area.index(p);
+		u8 flags = v.m_flags[i]
+				| v.m_flags[i+1] | v.m_flags[i-1]
+				| v.m_flags[i+em.X] | v.m_flags[i-em.X]
+				| v.m_flags[i+stride_z] | v.m_flags[i-stride_z];
+		if((flags & VOXELFLAG_NOT_LOADED) == 0)
+			return;
+	}
+
+	VoxelArea old_area = area;
+	v.emerge(VoxelArea(p - v3s16(1,1,1), p + v3s16(1,1,1)));
+	if(v.m_area == old_area)
+		return;
+
+	queue.remap(old_area, v.m_area);
+	for(u32 j=0; j<found_sources.size(); j++)
+		found_sources[j] = v.m_area.index(
+				old_area.position(found_sources[j]));
+}
+
+/*
+	Index offsets to the 6 neighbors, in the same order as dirs in
+	the recursive versions
+*/
+static void get_light_neighbor_offsets(const VoxelArea &area, s32 *offsets)
+{
+	v3s16 em = area.getExtent();
+	s32 stride_z = (s32)em.X * em.Y;
+	offsets[0] = stride_z; // back
+	offsets[1] = em.X; // top
+	offsets[2] = 1; // right
+	offsets[3] = -stride_z; // front
+	offsets[4] = -em.X; // bottom
+	offsets[5] = -1; // left
+}
+
+void VoxelManipulator::updateLight(enum LightBank bank,
+		core::map<v3s16, u8> & from_nodes,
+		core::map<v3s16, bool> & light_sources)
+{
+	LightQueue queue;
+	// Nodes where unspreading stopped; marked with VOXELFLAG_CHECKED4
+	core::array<u32> found_sources;
+	s32 offsets[6];
+	u8 level;
+	u32 i;
+
+	/*
+		Unspread.
+
+		The level of a node is the light it had before it was set
+		to 0. A neighbor is darkened only if it is dimmer than that,
+		so nodes are always queued on a lower level than the one
+		being handled and every node is handled once.
+	*/
+	for(core::map<v3s16, u8>::Iterator j = from_nodes.getIterator();
+			j.atEnd() == false; j++)
+	{
+		v3s16 p = j.getNode()->getKey();
+		emerge_light_neighbors(*this, p, queue, found_sources);
+		queue.push(j.getNode()->getValue(), m_area.index(p));
+	}
+
+	while(queue.pop(level, i))
+	{
+		v3s16 p = m_area.position(i);
+		emerge_light_neighbors(*this, p, queue, found_sources);
+		i = m_area.index(p);
+		get_light_neighbor_offsets(m_area, offsets);
+
+		for(u16 d=0; d<6; d++)
+		{
+			u32 n2i = i + offsets[d];
+
+			if(m_flags[n2i] & VOXELFLAG_INEXISTENT)
+				continue;
+
+			MapNode &n2 = m_data[n2i];
+			u8 light2 = n2.getLight(bank);
+
+			if(light2 < level)
+			{
+				if(n2.light_propagates() && light2 != 0)
+				{
+					n2.setLight(bank, 0);
+					queue.push(light2, n2i);
+				}
+			}
+			else if((m_flags[n2i] & VOXELFLAG_CHECKED4) == 0)
+			{
+				m_flags[n2i] |= VOXELFLAG_CHECKED4;
+				found_sources.push_back(n2i);
+			}
+		}
+	}
+
+	/*
+		Queue the sources with the light they have after unspreading
+	*/
+	for(u32 j=0; j<found_sources.size(); j++)
+	{
+		i = found_sources[j];
+		m_flags[i] &= ~VOXELFLAG_CHECKED4;
+		queue.push(m_data[i].getLight(bank), i);
+	}
+	found_sources.clear();
+
+	for(core::map<v3s16, bool>::Iterator j = light_sources.getIterator();
+			j.atEnd() == false; j++)
+	{
+		v3s16 p = j.getNode()->getKey();
+		emerge_light_neighbors(*this, p, queue, found_sources);
+		i = m_area.index(p);
+		if(m_flags[i] & VOXELFLAG_INEXISTENT)
+			continue;
+		queue.push(m_data[i].getLight(bank), i);
+	}
+
+	/*
+		Spread.
+
+		Brighter levels go first, so most nodes get their final light
+		before they are handled. An item whose node has been queued
+		again on another level since is skipped.
+	*/
+	while(queue.pop(level, i))
+	{
+		if(m_data[i].getLight(bank) != level)
+			continue;
+
+		v3s16 p = m_area.position(i);
+		emerge_light_neighbors(*this, p, queue, found_sources);
+		i = m_area.index(p);
+		get_light_neighbor_offsets(m_area, offsets);
+
+		u8 newlight = diminish_light(level);
+
+		for(u16 d=0; d<6; d++)
+		{
+			u32 n2i = i + offsets[d];
+
+			if(m_flags[n2i] & VOXELFLAG_INEXISTENT)
+				continue;
+
+			MapNode &n2 = m_data[n2i];
+			u8 light2 = n2.getLight(bank);
+
+			/*
+				If the neighbor is brighter than the current node,
+				queue it (it will light up this node on its turn)
+			*/
+			if(light2 > undiminish_light(level))
+			{
+				queue.push(light2, n2i);
+			}
+			/*
+				If the neighbor is dimmer than how much light this node
+				would spread on it, light it and queue it
+			*/
+			if(light2 < newlight)
+			{
+				if(n2.light_propagates())
+				{
+					n2.setLight(bank, newlight);
+					queue.push(newlight, n2i);
+				}
+			}
+		}
+	}
+}
+
 //END
@@ -270,7 +270,21 @@ class VoxelArea
 	{
 		return index(p.X, p.Y, p.Z);
 	}
-	
+
+	/*
+		Translates array index back to virtual coordinates
+	*/
+	v3s16 position(s32 i) const
+	{
+		v3s16 em = getExtent();
+		s32 stride_z = (s32)em.Y*em.X;
+		s16 z = i / stride_z;
+		i -= z * stride_z;
+		s16 y = i / em.X;
+		s16 x = i - y * em.X;
+		return MinEdge + v3s16(x,y,z);
+	}
+
 	// Translate index in the X coordinate
 	void add_x(const v3s16 &extent, u32 &i, s16 a)
 	{
@@ -505,7 +519,21 @@ class VoxelManipulator /*: public NodeContainer*/
 	void spreadLight(enum LightBank bank, v3s16 p);
 	void spreadLight(enum LightBank bank,
 			core::map<v3s16, bool> & from_nodes);
-	
+
+	/*
+		Does the same as unspreadLight(bank, from_nodes, light_sources)
+		followed by spreadLight(bank, light_sources), but in one pass
+		and without recursion or sets of positions.
+
+		Nodes are queued by array index in one FIFO per light level
+		and brighter levels are handled first. light_sources is not
+		modified; the sources found when unspreading are queued
+		directly.
+	*/
+	void updateLight(enum LightBank bank,
+			core::map<v3s16, u8> & from_nodes,
+			core::map<v3s16, bool> & light_sources);
+
 	/*
 		Virtual functions
 	*/